@@ -0,0 +1,434 @@
+// Copyright (c) 2019 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+// Headless benchmarks for the host-side costs of rvg: baking, updating
+// device objects, staging uploads and recording.
+// Does not need a surface, so runs e.g. on lavapipe
+// (VK_ICD_FILENAMES=.../lvp_icd.x86_64.json ./bench_rvg).
+// Usage: bench_rvg [output.json] [iterations]
+// Writes the results as json to the given file (rvg-bench.json if not given).
+
+#include <rvg/context.hpp>
+#include <rvg/polygon.hpp>
+#include <rvg/shapes.hpp>
+#include <rvg/state.hpp>
+#include <rvg/text.hpp>
+#include <rvg/font.hpp>
+
+#include <vpp/vk.hpp>
+#include <vpp/device.hpp>
+#include <vpp/queue.hpp>
+#include <vpp/submit.hpp>
+#include <vpp/commandAllocator.hpp>
+#include <vpp/handles.hpp>
+#include <vpp/image.hpp>
+#include <vpp/formats.hpp>
+#include <vpp/physicalDevice.hpp>
+#include <nytl/vecOps.hpp>
+#include <dlg/dlg.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <ostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#ifndef RVG_BENCH_FONT
+	#define RVG_BENCH_FONT "OpenSans-Regular.ttf"
+#endif
+
+namespace {
+
+using Clock = std::chrono::high_resolution_clock;
+using Params = std::vector<std::pair<std::string, double>>;
+
+constexpr vk::Extent2D fbExtent = {512, 512};
+constexpr auto warmup = 3u;
+
+struct Result {
+	std::string name;
+	Params params;
+	std::vector<double> times; // microseconds
+};
+
+struct Globals {
+	vpp::Instance instance;
+	std::optional<vpp::Device> device;
+
+	vpp::RenderPass rp;
+	vpp::ViewableImage attachment;
+	vpp::Framebuffer fb;
+
+	unsigned iterations {50};
+	std::vector<Result> results;
+} globals;
+
+void initGlobals() {
+	vk::ApplicationInfo appInfo;
+	appInfo.pApplicationName = "bench_rvg";
+	appInfo.apiVersion = VK_API_VERSION_1_0;
+
+	vk::InstanceCreateInfo instanceInfo;
+	instanceInfo.pApplicationInfo = &appInfo;
+
+	globals.instance = {instanceInfo};
+	globals.device.emplace(globals.instance);
+	auto& dev = *globals.device;
+
+	auto usage = vk::ImageUsageBits::colorAttachment;
+	auto vci = vpp::ViewableImageCreateInfo(vk::Format::r8g8b8a8Unorm,
+		vk::ImageAspectBits::color, fbExtent, usage);
+	globals.attachment = {dev.devMemAllocator(), vci};
+
+	vk::AttachmentDescription attachment;
+	attachment.format = vk::Format::r8g8b8a8Unorm;
+	attachment.samples = vk::SampleCountBits::e1;
+	attachment.loadOp = vk::AttachmentLoadOp::clear;
+	attachment.storeOp = vk::AttachmentStoreOp::store;
+	attachment.stencilLoadOp = vk::AttachmentLoadOp::dontCare;
+	attachment.stencilStoreOp = vk::AttachmentStoreOp::dontCare;
+	attachment.initialLayout = vk::ImageLayout::undefined;
+	attachment.finalLayout = vk::ImageLayout::colorAttachmentOptimal;
+
+	vk::AttachmentReference colorReference;
+	colorReference.attachment = 0;
+	colorReference.layout = vk::ImageLayout::colorAttachmentOptimal;
+
+	vk::SubpassDescription subpass;
+	subpass.pipelineBindPoint = vk::PipelineBindPoint::graphics;
+	subpass.colorAttachmentCount = 1;
+	subpass.pColorAttachments = &colorReference;
+
+	vk::RenderPassCreateInfo renderPassInfo;
+	renderPassInfo.attachmentCount = 1;
+	renderPassInfo.pAttachments = &attachment;
+	renderPassInfo.subpassCount = 1;
+	renderPassInfo.pSubpasses = &subpass;
+	globals.rp = {dev, renderPassInfo};
+
+	vk::FramebufferCreateInfo fbInfo;
+	fbInfo.renderPass = globals.rp;
+	fbInfo.attachmentCount = 1;
+	fbInfo.pAttachments = &globals.attachment.vkImageView();
+	fbInfo.width = fbExtent.width;
+	fbInfo.height = fbExtent.height;
+	fbInfo.layers = 1u;
+	globals.fb = {dev, fbInfo};
+}
+
+std::unique_ptr<rvg::Context> createContext() {
+	rvg::ContextSettings settings;
+	settings.renderPass = globals.rp;
+	settings.subpass = 0u;
+	return std::make_unique<rvg::Context>(*globals.device, settings);
+}
+
+// Submits the work queued by stageUpload and waits for the
+// semaphore it returned.
+void waitUpload(rvg::Context& ctx, vk::Semaphore semaphore) {
+	if(!semaphore) {
+		return;
+	}
+
+	static auto stage = nytl::Flags {vk::PipelineStageBits::allCommands};
+	vk::SubmitInfo submission;
+	submission.pWaitSemaphores = &semaphore;
+	submission.pWaitDstStageMask = &stage;
+	submission.waitSemaphoreCount = 1u;
+
+	auto& qs = ctx.device().queueSubmitter();
+	qs.wait(qs.add(submission));
+}
+
+// Updates the device objects and waits for the uploads to finish.
+// Used to bring the context into a clean state between iterations.
+void sync(rvg::Context& ctx) {
+	ctx.updateDevice();
+	waitUpload(ctx, ctx.stageUpload());
+}
+
+/// Runs the given benchmark. Only the time spent in run is measured,
+/// setup is called before each iteration.
+template<typename S, typename R>
+void bench(std::string name, Params params, S&& setup, R&& run) {
+	Result result {std::move(name), std::move(params), {}};
+	result.times.reserve(globals.iterations);
+	for(auto i = 0u; i < warmup + globals.iterations; ++i) {
+		setup();
+		auto start = Clock::now();
+		run();
+		auto end = Clock::now();
+
+		if(i >= warmup) {
+			using Micro = std::chrono::duration<double, std::micro>;
+			result.times.push_back(Micro(end - start).count());
+		}
+	}
+
+	dlg_info("{}: {} us", result.name, result.times[result.times.size() / 2]);
+	globals.results.push_back(std::move(result));
+}
+
+auto circlePoints(unsigned count) {
+	std::vector<nytl::Vec2f> points;
+	points.reserve(count);
+	for(auto i = 0u; i < count; ++i) {
+		auto a = 2 * 3.14159265f * i / count;
+		points.push_back({200.f + 100.f * std::cos(a), 200.f + 100.f * std::sin(a)});
+	}
+
+	return points;
+}
+
+// - benchmarks -
+void benchPolygonUpdate(rvg::Context& ctx) {
+	struct Mode {
+		const char* name;
+		rvg::DrawMode mode;
+	};
+
+	rvg::DrawMode fill {true, 0.f};
+	rvg::DrawMode stroke {false, 2.f};
+	rvg::DrawMode aaFill = fill;
+	aaFill.aaFill = true;
+	rvg::DrawMode aaStroke = stroke;
+	aaStroke.aaStroke = true;
+
+	Mode modes[] = {
+		{"fill", fill},
+		{"stroke", stroke},
+		{"fill.aa", aaFill},
+		{"stroke.aa", aaStroke},
+	};
+
+	for(auto& mode : modes) {
+		for(auto count : {16u, 256u, 4096u, 65536u}) {
+			auto points = circlePoints(count);
+			rvg::Polygon polygon(ctx);
+			polygon.update(points, mode.mode);
+			sync(ctx);
+
+			auto name = std::string("Polygon::update.") + mode.name;
+			bench(name, {{"points", count}},
+				[&]{ sync(ctx); },
+				[&]{ polygon.update(points, mode.mode); });
+		}
+	}
+}
+
+void benchTextUpdate(rvg::Context& ctx, const rvg::Font& font) {
+	for(auto length : {8u, 64u, 512u, 4096u}) {
+		std::string texts[2];
+		for(auto i = 0u; i < length; ++i) {
+			texts[0] += char('a' + i % 26);
+			texts[1] += char('A' + i % 26);
+		}
+
+		rvg::Text text(ctx, {0.f, 0.f}, texts[0], font, 14.f);
+		sync(ctx);
+
+		auto i = 0u;
+		bench("Text::update", {{"length", length}},
+			[&]{ sync(ctx); },
+			[&]{ text.change()->text = texts[++i % 2]; });
+	}
+}
+
+void benchUpdateDevice(rvg::Context& ctx) {
+	for(auto deviceLocal : {false, true}) {
+		for(auto count : {1u, 64u, 1024u, 8192u}) {
+			std::vector<rvg::Transform> transforms;
+			transforms.reserve(count);
+			for(auto i = 0u; i < count; ++i) {
+				transforms.emplace_back(ctx, deviceLocal);
+			}
+
+			sync(ctx);
+
+			auto i = 0u;
+			auto name = deviceLocal ?
+				"Context::updateDevice.deviceLocal" :
+				"Context::updateDevice.hostVisible";
+			bench(name, {{"dirty", count}},
+				[&]{
+					sync(ctx);
+					auto m = nytl::identity<4, float>();
+					m[0][3] = float(++i % 2);
+					for(auto& t : transforms) {
+						t.matrix(m);
+					}
+				}, [&]{ ctx.updateDevice(); });
+		}
+	}
+}
+
+void benchStageUpload(rvg::Context& ctx) {
+	for(auto count : {1u, 64u, 1024u}) {
+		std::vector<rvg::Transform> transforms;
+		transforms.reserve(count);
+		for(auto i = 0u; i < count; ++i) {
+			transforms.emplace_back(ctx, true);
+		}
+
+		sync(ctx);
+
+		// stageUpload must not be called again before the work it
+		// queued completed, waited for outside of the measured time
+		auto i = 0u;
+		vk::Semaphore semaphore {};
+		bench("Context::stageUpload", {{"objects", count}},
+			[&]{
+				waitUpload(ctx, semaphore);
+				semaphore = {};
+				sync(ctx);
+				auto m = nytl::identity<4, float>();
+				m[1][3] = float(++i % 2);
+				for(auto& t : transforms) {
+					t.matrix(m);
+				}
+				ctx.updateDevice();
+			}, [&]{ semaphore = ctx.stageUpload(); });
+
+		waitUpload(ctx, semaphore);
+	}
+}
+
+void benchRecord(rvg::Context& ctx) {
+	auto& dev = ctx.device();
+	auto qf = dev.queueSubmitter().queue().family();
+	auto cb = dev.commandAllocator().get(qf,
+		vk::CommandPoolCreateBits::resetCommandBuffer);
+
+	auto paint = rvg::Paint(ctx, rvg::colorPaint(rvg::Color::red));
+	for(auto count : {1u, 64u, 1024u, 8192u}) {
+		std::vector<rvg::RectShape> shapes;
+		shapes.reserve(count);
+		for(auto i = 0u; i < count; ++i) {
+			auto pos = nytl::Vec2f {float(i % 64) * 8.f, float(i / 64) * 8.f};
+			shapes.emplace_back(ctx, pos, nytl::Vec2f {6.f, 6.f},
+				rvg::DrawMode {true, 1.f});
+		}
+
+		sync(ctx);
+
+		bench("record", {{"shapes", count}}, []{}, [&]{
+			const auto clearValue = vk::ClearValue {{0.f, 0.f, 0.f, 1.f}};
+			vk::beginCommandBuffer(cb, {});
+			vk::cmdBeginRenderPass(cb, {
+				globals.rp,
+				globals.fb,
+				{0u, 0u, fbExtent.width, fbExtent.height},
+				1,
+				&clearValue
+			}, {});
+
+			vk::Viewport vp {0.f, 0.f,
+				(float) fbExtent.width, (float) fbExtent.height, 0.f, 1.f};
+			vk::cmdSetViewport(cb, 0, 1, vp);
+			vk::cmdSetScissor(cb, 0, 1, {0, 0, fbExtent.width, fbExtent.height});
+
+			ctx.bindDefaults(cb);
+			paint.bind(cb);
+			for(auto& shape : shapes) {
+				shape.fill(cb);
+				shape.stroke(cb);
+			}
+
+			vk::cmdEndRenderPass(cb);
+			vk::endCommandBuffer(cb);
+		});
+	}
+}
+
+// - output -
+std::string quoted(std::string_view str) {
+	std::string ret = "\"";
+	for(auto c : str) {
+		if(c == '"' || c == '\\') {
+			ret += '\\';
+		}
+		ret += c;
+	}
+
+	return ret + "\"";
+}
+
+void writeJson(std::ostream& os, std::string_view deviceName) {
+	os << "{\n";
+	os << "\t\"device\": " << quoted(deviceName) << ",\n";
+	os << "\t\"iterations\": " << globals.iterations << ",\n";
+	os << "\t\"unit\": \"us\",\n";
+	os << "\t\"results\": [";
+
+	auto first = true;
+	for(auto& res : globals.results) {
+		auto times = res.times;
+		std::sort(times.begin(), times.end());
+		auto sum = 0.0;
+		for(auto t : times) {
+			sum += t;
+		}
+
+		os << (first ? "\n" : ",\n");
+		first = false;
+
+		os << "\t\t{\"name\": " << quoted(res.name) << ", \"params\": {";
+		auto firstParam = true;
+		for(auto& [name, value] : res.params) {
+			os << (firstParam ? "" : ", ") << quoted(name) << ": " << value;
+			firstParam = false;
+		}
+
+		os << "}, \"mean\": " << sum / times.size();
+		os << ", \"median\": " << times[times.size() / 2];
+		os << ", \"min\": " << times.front();
+		os << ", \"max\": " << times.back() << "}";
+	}
+
+	os << "\n\t]\n}\n";
+}
+
+} // anon namespace
+
+int main(int argc, char** argv) {
+	if(argc > 2) {
+		globals.iterations = std::max(std::atoi(argv[2]), 1);
+	}
+
+	initGlobals();
+
+	{
+		auto pctx = createContext();
+		auto& ctx = *pctx;
+		auto font = rvg::Font(ctx, RVG_BENCH_FONT);
+
+		benchPolygonUpdate(ctx);
+		benchTextUpdate(ctx, font);
+		benchUpdateDevice(ctx);
+		benchStageUpload(ctx);
+		benchRecord(ctx);
+
+		vk::deviceWaitIdle(ctx.device());
+	}
+
+	auto props = vk::getPhysicalDeviceProperties(
+		globals.device->vkPhysicalDevice());
+	std::string_view deviceName = props.deviceName.data();
+
+	auto output = argc > 1 ? argv[1] : "rvg-bench.json";
+	std::ofstream ofs(output);
+	writeJson(ofs, deviceName);
+	dlg_info("Wrote results to {}", output);
+
+	globals.fb = {};
+	globals.rp = {};
+	globals.attachment = {};
+	globals.device.reset();
+	globals.instance = {};
+}
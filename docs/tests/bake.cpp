@@ -0,0 +1,141 @@
+// Compares the bulk bake kernels (src/rvg/bake.cpp) with katachi,
+// which they replace for strokes and fills without point colors.
+// Polygon removes the closing point of loops and fills before baking,
+// the points here are already without it.
+
+#include <bugged.hpp>
+#include "rvg/bake.hpp" // internal, see src_inc
+#include <katachi/stroke.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace rvg;
+
+namespace {
+
+struct Baked {
+	std::vector<Vec2f> points;
+	std::vector<Vec2f> aa;
+	std::vector<Vec2f> fill; // only for fills
+};
+
+Baked katachiStroke(Span<const Vec2f> points, float width, bool loop) {
+	Baked ret;
+	auto settings = ktc::StrokeSettings {width, loop, 0.f};
+	ktc::bakeStroke(points, settings, [&](const auto& vertex) {
+		ret.points.push_back(vertex.position);
+		ret.aa.push_back(vertex.aa);
+	});
+	return ret;
+}
+
+Baked kernelStroke(Span<const Vec2f> points, float width, bool loop) {
+	Baked ret;
+	auto count = strokeVertexCount(points.size(), loop);
+	ret.points.resize(count);
+	ret.aa.resize(count);
+	bakeStroke(points, width, loop, ret.points, ret.aa);
+	return ret;
+}
+
+Baked katachiFill(Span<const Vec2f> points, float fringe) {
+	Baked ret;
+	ktc::bakeFillAA(points, fringe, [&](const auto& vertex) {
+		ret.fill.push_back(vertex.position);
+	}, [&](const auto& vertex) {
+		ret.points.push_back(vertex.position);
+		ret.aa.push_back(vertex.aa);
+	});
+	return ret;
+}
+
+Baked kernelFill(Span<const Vec2f> points, float fringe) {
+	Baked ret;
+	ret.fill.resize(fillAAVertexCount(points.size()));
+	ret.points.resize(fringeVertexCount(points.size()));
+	ret.aa.resize(ret.points.size());
+	bakeFillAA(points, fringe, ret.fill, ret.points, ret.aa);
+	return ret;
+}
+
+bool finite(Vec2f v) {
+	return std::isfinite(v.x) && std::isfinite(v.y);
+}
+
+bool nearlyEqual(Vec2f a, Vec2f b) {
+	constexpr auto eps = 1e-4f;
+	return std::abs(a.x - b.x) <= eps * (1.f + std::abs(b.x)) &&
+		std::abs(a.y - b.y) <= eps * (1.f + std::abs(b.y));
+}
+
+// Returns the number of differing vertices. Vertices katachi can't
+// compute (not finite, e.g. at zero length segments) are skipped.
+unsigned differences(const std::vector<Vec2f>& kernel,
+		const std::vector<Vec2f>& expected) {
+	if(kernel.size() != expected.size()) {
+		return unsigned(std::max(kernel.size(), expected.size()));
+	}
+
+	auto ret = 0u;
+	for(auto i = 0u; i < kernel.size(); ++i) {
+		ret += finite(expected[i]) && !nearlyEqual(kernel[i], expected[i]);
+	}
+
+	return ret;
+}
+
+unsigned compareStroke(Span<const Vec2f> points, float width, bool loop) {
+	auto kernel = kernelStroke(points, width, loop);
+	auto expected = katachiStroke(points, width, loop);
+	return differences(kernel.points, expected.points) +
+		differences(kernel.aa, expected.aa);
+}
+
+unsigned compareFill(Span<const Vec2f> points, float fringe) {
+	auto kernel = kernelFill(points, fringe);
+	auto expected = katachiFill(points, fringe);
+	return differences(kernel.fill, expected.fill) +
+		differences(kernel.points, expected.points) +
+		differences(kernel.aa, expected.aa);
+}
+
+// an odd number of points, the last one is baked by the scalar tail
+const std::vector<Vec2f> square = {
+	{0.f, 0.f}, {10.f, 0.f}, {10.f, 10.f}, {5.f, 12.f}, {0.f, 10.f}};
+
+// sharp angles, the miter joins are limited
+const std::vector<Vec2f> zigzag = {
+	{0.f, 0.f}, {10.f, 0.f}, {0.f, 1.f}, {10.f, 2.f}, {0.f, 3.f}, {10.f, 10.f}};
+
+const std::vector<Vec2f> duplicates = {
+	{0.f, 0.f}, {0.f, 0.f}, {5.f, 0.f}, {5.f, 0.f}, {5.f, 0.f},
+	{5.f, 5.f}, {0.f, 5.f}};
+
+} // anon namespace
+
+TEST(openStroke) {
+	EXPECT(compareStroke(square, 2.f, false), 0u);
+	EXPECT(compareStroke(zigzag, 3.f, false), 0u);
+	EXPECT(compareStroke(Span<const Vec2f>(square).first(2), 1.f, false), 0u);
+}
+
+TEST(loopStroke) {
+	EXPECT(compareStroke(square, 2.f, true), 0u);
+	EXPECT(compareStroke(zigzag, 3.f, true), 0u);
+}
+
+TEST(duplicatePoints) {
+	EXPECT(compareStroke(duplicates, 2.f, false), 0u);
+	EXPECT(compareStroke(duplicates, 2.f, true), 0u);
+	EXPECT(compareFill(duplicates, 1.5f), 0u);
+}
+
+TEST(fillAA) {
+	EXPECT(compareFill(square, 1.5f), 0u);
+	EXPECT(compareFill(zigzag, 1.5f), 0u);
+
+	// counter-clockwise, the fringe still has to be outside
+	std::vector<Vec2f> reversed(square.rbegin(), square.rend());
+	EXPECT(compareFill(reversed, 1.5f), 0u);
+}
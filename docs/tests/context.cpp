@@ -2,7 +2,94 @@
 
 #include <rvg/context.hpp>
 #include <rvg/polygon.hpp>
+#include <rvg/shapes.hpp>
+#include <rvg/instanced.hpp>
+#include <rvg/scene.hpp>
+#include <rvg/layer.hpp>
 #include "main.hpp"
+#include "rvg/bake.hpp" // internal, see src_inc
+#include "rvg/triangulate.hpp"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+// Reads the stroke vertices back, e.g. the ones written by stroke.comp.
+// Only for hostVisible polygons after the upload work has finished.
+class StrokeReadback : public rvg::Polygon {
+public:
+	using rvg::Polygon::Polygon;
+
+	std::vector<nytl::Vec2f> strokeVertices() const {
+		auto count = vertexCounts(rvg::DrawType::stroke)[0];
+		auto data = context().mapped(stroke_.pBuf);
+		std::vector<nytl::Vec2f> ret(count);
+		std::memcpy(ret.data(), data.data() + stroke_.vertexOffset(),
+			count * sizeof(nytl::Vec2f));
+		return ret;
+	}
+};
+
+// Exposes the dash pattern used for the stroke, see DrawMode::dash.
+class DashCheck : public rvg::Polygon {
+public:
+	using rvg::Polygon::Polygon;
+	const auto& dashes() const { return dash_; }
+};
+
+// Exposes the vertex format each draw uses, see
+// ContextSettings::compactPrecision. Valid after updateDevice.
+class CompactCheck : public rvg::Polygon {
+public:
+	using rvg::Polygon::Polygon;
+
+	bool compactFill() const { return fill_.compact; }
+	bool compactStroke() const { return stroke_.compact; }
+};
+
+bool nearlyEqual(nytl::Vec2f a, nytl::Vec2f b, float eps = 1e-3f) {
+	return std::abs(a.x - b.x) <= eps * (1.f + std::abs(b.x)) &&
+		std::abs(a.y - b.y) <= eps * (1.f + std::abs(b.y));
+}
+
+// Area of the polygon given by the points in [begin, end).
+float outlineArea(const std::vector<nytl::Vec2f>& points,
+		unsigned begin, unsigned end) {
+	auto sum = 0.f;
+	for(auto i = begin; i < end; ++i) {
+		auto& a = points[i];
+		auto& b = points[i + 1 == end ? begin : i + 1];
+		sum += a.x * b.y - b.x * a.y;
+	}
+
+	return 0.5f * std::abs(sum);
+}
+
+// Summed area of the triangles given by the indices.
+float triangleArea(const std::vector<nytl::Vec2f>& points,
+		const std::vector<std::uint32_t>& indices) {
+	auto sum = 0.f;
+	for(auto i = 0u; i + 2 < indices.size(); i += 3) {
+		auto& a = points[indices[i]];
+		auto& b = points[indices[i + 1]];
+		auto& c = points[indices[i + 2]];
+		auto ab = b - a;
+		auto ac = c - a;
+		sum += 0.5f * std::abs(ab.x * ac.y - ab.y * ac.x);
+	}
+
+	return sum;
+}
+
+// Triangulates the points, returns the summed triangle area or a
+// negative value if the indices are invalid.
+float triangulatedArea(const std::vector<nytl::Vec2f>& points,
+		const std::vector<unsigned>& holes = {}) {
+	std::vector<std::uint32_t> indices;
+	rvg::triangulate(points, holes, indices);
+	auto valid = indices.size() % 3 == 0 && std::all_of(indices.begin(),
+		indices.end(), [&](auto i) { return i < points.size(); });
+	return valid ? triangleArea(points, indices) : -1.f;
+}
 
 TEST(basicSetup) {
 	auto pctx = createContext();
@@ -63,3 +150,906 @@ TEST(basicSetup) {
 
 	renderSubmit(ctx, cmdBuf);
 }
+
+TEST(path) {
+	auto pctx = createContext();
+	auto& ctx = *pctx;
+
+	// half circle with sweep in positive angle direction, i.e. above
+	// the x axis in y-down coordinates
+	rvg::PathShape path(ctx, {true, 0.f});
+	path.moveTo({0.f, 0.f});
+	path.arcTo({5.f, 5.f}, 0.f, false, true, {10.f, 0.f});
+	path.quadTo({5.f, 5.f}, {0.f, 0.f});
+	path.update();
+
+	auto bounds = path.bounds();
+	EXPECT(std::abs(bounds.position.x) < 0.01f, true);
+	EXPECT(std::abs(bounds.position.y + 5.f) < 0.01f, true);
+	EXPECT(std::abs(bounds.size.x - 10.f) < 0.01f, true);
+
+	// more segments at a larger scale
+	auto count = path.polygon().vertexCounts(rvg::DrawType::fill)[0];
+	path.scale(10.f);
+	EXPECT(path.scale(), 16.f);
+	EXPECT(path.polygon().vertexCounts(rvg::DrawType::fill)[0] > count, true);
+
+	rvg::Paint paint {ctx, rvg::colorPaint(rvg::Color::red)};
+	ctx.updateDevice();
+	auto cmdBuf = record(ctx, [&](auto& cb){
+		paint.bind(cb);
+		path.fill(cb);
+	});
+
+	renderSubmit(ctx, cmdBuf);
+}
+
+TEST(subpaths) {
+	rvg::ContextSettings settings;
+	settings.stencilFill = true;
+	auto pctx = createContext(settings);
+	auto& ctx = *pctx;
+
+	// square with a square hole, the second moveTo starts a subpath
+	auto build = [](rvg::PathShape& path) {
+		path.moveTo({0.f, 0.f});
+		path.lineTo({10.f, 0.f});
+		path.lineTo({10.f, 10.f});
+		path.lineTo({0.f, 10.f});
+		path.close();
+		path.moveTo({2.f, 2.f});
+		path.lineTo({2.f, 8.f});
+		path.lineTo({8.f, 8.f});
+		path.lineTo({8.f, 2.f});
+	};
+
+	rvg::DrawMode mode {true};
+	mode.fillRule = rvg::FillRule::triangulated;
+	rvg::PathShape triangulated(ctx, mode);
+	build(triangulated);
+	EXPECT(triangulated.commands().size(), 8u);
+	triangulated.update();
+	EXPECT(triangulated.polygon().vertexCounts(rvg::DrawType::fill)[0], 24u);
+
+	// every subpath is closed for the stencil fan
+	mode.fillRule = rvg::FillRule::evenOdd;
+	rvg::PathShape stencil(ctx, mode);
+	build(stencil);
+	stencil.update();
+	EXPECT(stencil.polygon().vertexCounts(rvg::DrawType::fill)[0], 10u);
+	EXPECT(stencil.bounds().size.x >= 10.f, true);
+
+	// clear starts over
+	stencil.clear();
+	EXPECT(stencil.commands().empty(), true);
+
+	rvg::Paint paint {ctx, rvg::colorPaint(rvg::Color::red)};
+	ctx.updateDevice();
+	auto cmdBuf = record(ctx, [&](auto& cb){
+		paint.bind(cb);
+		triangulated.fill(cb);
+	});
+
+	renderSubmit(ctx, cmdBuf);
+}
+
+TEST(triangulated) {
+	auto pctx = createContext();
+	auto& ctx = *pctx;
+
+	// square with a square hole
+	std::vector<nytl::Vec2f> points = {
+		{0.f, 0.f}, {10.f, 0.f}, {10.f, 10.f}, {0.f, 10.f},
+		{2.f, 2.f}, {2.f, 8.f}, {8.f, 8.f}, {8.f, 2.f},
+	};
+
+	rvg::DrawMode mode {true};
+	mode.fillRule = rvg::FillRule::triangulated;
+	mode.holes = {4u};
+
+	rvg::Polygon polygon {ctx};
+	polygon.update(points, mode);
+	EXPECT(polygon.vertexCounts(rvg::DrawType::fill)[0], 24u);
+	EXPECT(polygon.commandCount(rvg::DrawType::fill), 2u);
+
+	// the triangles cover the outline without the holes, with
+	// indices into the points
+	auto eps = 1e-3f;
+	auto area = outlineArea(points, 0, 4) - outlineArea(points, 4, 8);
+	EXPECT(std::abs(triangulatedArea(points, {4u}) - area) < eps, true);
+
+	// concave outline, two holes with different orientations
+	std::vector<nytl::Vec2f> concave = {
+		{0.f, 0.f}, {20.f, 0.f}, {20.f, 10.f}, {12.f, 4.f}, {8.f, 10.f},
+		{0.f, 10.f},
+		{2.f, 2.f}, {2.f, 6.f}, {5.f, 6.f}, {5.f, 2.f},
+		{14.f, 1.f}, {18.f, 1.f}, {18.f, 3.f},
+	};
+
+	area = outlineArea(concave, 0, 6);
+	EXPECT(std::abs(triangulatedArea(concave) - area) < eps, true);
+	area -= outlineArea(concave, 6, 10) + outlineArea(concave, 10, 13);
+	EXPECT(std::abs(triangulatedArea(concave, {6u, 10u}) - area) < eps, true);
+
+	// large enough for the grid of reflex points
+	std::vector<nytl::Vec2f> star;
+	for(auto i = 0u; i < 512u; ++i) {
+		auto a = 2 * 3.14159f * i / 512;
+		auto r = i % 2 ? 50.f : 100.f;
+		star.push_back({r * std::cos(a), r * std::sin(a)});
+	}
+
+	area = outlineArea(star, 0, star.size());
+	EXPECT(std::abs(triangulatedArea(star) - area) < 1e-4f * area, true);
+
+	// degenerate input must not hang or produce invalid indices
+	std::vector<nytl::Vec2f> collinear = {
+		{0.f, 0.f}, {1.f, 0.f}, {2.f, 0.f}, {3.f, 0.f}};
+	EXPECT(std::abs(triangulatedArea(collinear)) < eps, true);
+
+	std::vector<nytl::Vec2f> same(5, {1.f, 1.f});
+	EXPECT(std::abs(triangulatedArea(same)) < eps, true);
+
+	auto flatHole = points;
+	flatHole.resize(4);
+	flatHole.insert(flatHole.end(), {{3.f, 3.f}, {5.f, 3.f}, {7.f, 3.f}});
+	area = outlineArea(points, 0, 4);
+	EXPECT(std::abs(triangulatedArea(flatHole, {4u}) - area) < eps, true);
+	EXPECT(triangulatedArea({{0.f, 0.f}, {1.f, 1.f}}), 0.f);
+
+	rvg::Paint paint {ctx, rvg::colorPaint(rvg::Color::red)};
+	ctx.updateDevice();
+	auto cmdBuf = record(ctx, [&](auto& cb){
+		paint.bind(cb);
+		polygon.fill(cb);
+	});
+
+	renderSubmit(ctx, cmdBuf);
+}
+
+TEST(stencilFill) {
+	rvg::ContextSettings settings;
+	settings.stencilFill = true;
+	auto pctx = createContext(settings);
+	auto& ctx = *pctx;
+
+	// self-intersecting star. The fan is drawn into the stencil buffer,
+	// then the quad covering the bounds
+	std::vector<nytl::Vec2f> points;
+	for(auto i = 0u; i < 5u; ++i) {
+		auto a = 4 * 3.14159f * i / 5;
+		points.push_back({10.f * std::cos(a), 10.f * std::sin(a)});
+	}
+
+	rvg::DrawMode mode {true};
+	mode.fillRule = rvg::FillRule::nonZero;
+
+	rvg::Polygon polygon {ctx};
+	polygon.update(points, mode);
+	EXPECT(polygon.commandCount(rvg::DrawType::fill), 2u);
+	auto counts = polygon.vertexCounts(rvg::DrawType::fill);
+	EXPECT(counts.size(), 2u);
+	EXPECT(counts[0], 5u);
+	EXPECT(counts[1], 4u);
+
+	mode.fillRule = rvg::FillRule::evenOdd;
+	rvg::Polygon evenOdd {ctx};
+	evenOdd.update(points, mode);
+	EXPECT(evenOdd.commandCount(rvg::DrawType::fill), 2u);
+	EXPECT(evenOdd.vertexCounts(rvg::DrawType::fill)[1], 4u);
+
+	// the test render pass has no stencil attachment, the stencil
+	// state is ignored. TEST(layer) renders with one
+	rvg::Paint paint {ctx, rvg::colorPaint(rvg::Color::red)};
+	ctx.updateDevice();
+	auto cmdBuf = record(ctx, [&](auto& cb){
+		paint.bind(cb);
+		polygon.fill(cb);
+		evenOdd.fill(cb);
+	});
+
+	renderSubmit(ctx, cmdBuf);
+}
+
+TEST(bakeDirect) {
+	auto pctx = createContext();
+	auto& ctx = *pctx;
+
+	std::vector<nytl::Vec2f> points = {
+		{0.f, 0.f}, {10.f, 0.f}, {10.f, 10.f}, {0.f, 10.f},
+	};
+
+	rvg::DrawMode mode {true, 2.f, true};
+	mode.aaFill = true;
+	mode.aaStroke = true;
+
+	// vertices are only baked in updateDevice but counts must match
+	rvg::Polygon host {ctx};
+	host.update(points, mode);
+	mode.bakeDirect = true;
+	rvg::Polygon direct {ctx};
+	direct.update(points, mode);
+
+	EXPECT(direct.vertexCounts(rvg::DrawType::fill) ==
+		host.vertexCounts(rvg::DrawType::fill), true);
+	EXPECT(direct.vertexCounts(rvg::DrawType::stroke)[0], 10u);
+
+	rvg::Paint paint {ctx, rvg::colorPaint(rvg::Color::red)};
+	ctx.updateDevice();
+	auto cmdBuf = record(ctx, [&](auto& cb){
+		paint.bind(cb);
+		direct.fill(cb);
+		direct.stroke(cb);
+	});
+
+	renderSubmit(ctx, cmdBuf);
+}
+
+TEST(compact) {
+	rvg::ContextSettings settings;
+	settings.compactPrecision = 0.005f;
+	auto pctx = createContext(settings);
+	auto& ctx = *pctx;
+
+	rvg::DrawMode mode {true, 2.f, true};
+	mode.aaFill = true;
+	mode.aaStroke = true;
+
+	// the second one is too large for the precision, uses floats
+	std::vector<nytl::Vec2f> points = {{0.f, 0.f}, {100.f, 0.f}, {100.f, 100.f}};
+	CompactCheck small {ctx};
+	small.update(points, mode);
+
+	auto largePoints = points;
+	for(auto& p : largePoints) {
+		p = {10.f * p.x, 10.f * p.y};
+	}
+
+	CompactCheck large {ctx};
+	large.update(largePoints, mode);
+
+	// the format doesn't change the vertex counts
+	EXPECT(small.vertexCounts(rvg::DrawType::fill) ==
+		large.vertexCounts(rvg::DrawType::fill), true);
+	EXPECT(small.vertexCounts(rvg::DrawType::stroke) ==
+		large.vertexCounts(rvg::DrawType::stroke), true);
+
+	rvg::Paint paint {ctx, rvg::colorPaint(rvg::Color::red)};
+	ctx.updateDevice();
+	EXPECT(small.compactFill(), true);
+	EXPECT(small.compactStroke(), true);
+	EXPECT(large.compactFill(), false);
+	EXPECT(large.compactStroke(), false);
+
+	// moving within the precision keeps the format and buffers
+	points[1] = {90.f, 0.f};
+	small.update(points, mode);
+	EXPECT(ctx.updateDevice(), false);
+	EXPECT(small.compactFill(), true);
+
+	// growing beyond it switches to floats, needs a rerecord
+	small.update(largePoints, mode);
+	EXPECT(ctx.updateDevice(), true);
+	EXPECT(small.compactFill(), false);
+	EXPECT(small.compactStroke(), false);
+
+	auto cmdBuf = record(ctx, [&](auto& cb){
+		paint.bind(cb);
+		small.fill(cb);
+		small.stroke(cb);
+		large.fill(cb);
+		large.stroke(cb);
+	});
+
+	renderSubmit(ctx, cmdBuf);
+}
+
+TEST(computeStroke) {
+	auto pctx = createContext();
+	auto& ctx = *pctx;
+
+	// waveform with a few duplicated points, expanded on the gpu if
+	// the upload queue supports compute
+	std::vector<nytl::Vec2f> points;
+	for(auto i = 0u; i < 1000u; ++i) {
+		points.push_back({float(i), 50.f + 40.f * std::sin(0.1f * i)});
+		if(i % 100 == 50) {
+			points.push_back(points.back());
+			points.push_back(points.back());
+		}
+	}
+
+	rvg::DrawMode mode {false, 2.f};
+	mode.aaStroke = true;
+	mode.computeStroke = true;
+
+	StrokeReadback polygon {ctx};
+	polygon.update(points, mode);
+	auto count = unsigned(rvg::strokeVertexCount(points.size(), false));
+	EXPECT(polygon.vertexCounts(rvg::DrawType::stroke)[0], count);
+
+	rvg::Paint paint {ctx, rvg::colorPaint(rvg::Color::red)};
+	ctx.updateDevice();
+	auto cmdBuf = record(ctx, [&](auto& cb){
+		paint.bind(cb);
+		polygon.stroke(cb);
+	});
+
+	renderSubmit(ctx, cmdBuf);
+	if(!ctx.uploadCompute()) {
+		return;
+	}
+
+	// same vertices as the cpu path, see Polygon::updateStroke for the width
+	std::vector<nytl::Vec2f> expected(count);
+	auto width = 2.f + 1.5f * ctx.fringe();
+	rvg::bakeStroke(points, width, false, expected);
+
+	auto vertices = polygon.strokeVertices();
+	auto same = 0u;
+	for(auto i = 0u; i < count; ++i) {
+		same += nearlyEqual(vertices[i], expected[i]);
+	}
+
+	EXPECT(same, count);
+}
+
+TEST(lines) {
+	auto pctx = createContext();
+	auto& ctx = *pctx;
+
+	// grid, one instance per segment
+	std::vector<nytl::Vec2f> points;
+	for(auto i = 0u; i < 10u; ++i) {
+		points.push_back({10.f * i, 0.f});
+		points.push_back({10.f * i, 100.f});
+	}
+
+	rvg::DrawMode mode {false, 1.f};
+	mode.aaStroke = true;
+	mode.strokeType = rvg::StrokeType::lineList;
+
+	rvg::Polygon polygon {ctx};
+	polygon.update(points, mode);
+	EXPECT(polygon.vertexCounts(rvg::DrawType::stroke)[0], 4u);
+	EXPECT(ctx.updateDevice(), true);
+
+	// only the header is written, no rerecord
+	auto width = polygon.bounds().size.x;
+	polygon.strokeWidth(3.f);
+	EXPECT(ctx.updateDevice(), false);
+	EXPECT(std::abs(polygon.bounds().size.x - width - 2.f) < 0.01f, true);
+
+	rvg::Paint paint {ctx, rvg::colorPaint(rvg::Color::red)};
+	auto cmdBuf = record(ctx, [&](auto& cb){
+		paint.bind(cb);
+		polygon.stroke(cb);
+	});
+
+	renderSubmit(ctx, cmdBuf);
+}
+
+TEST(strokeStyle) {
+	auto pctx = createContext();
+	auto& ctx = *pctx;
+
+	std::vector<nytl::Vec2f> points = {{0.f, 0.f}, {10.f, 0.f}, {10.f, 10.f}};
+	rvg::DrawMode mode {false, 2.f};
+	mode.aaStroke = true;
+	rvg::Polygon miter {ctx};
+	miter.update(points, mode);
+
+	// round caps and joins add fans
+	mode.cap = rvg::LineCap::round;
+	mode.join = rvg::LineJoin::round;
+	rvg::Polygon round {ctx};
+	round.update(points, mode);
+	EXPECT(round.vertexCounts(rvg::DrawType::stroke)[0] >
+		miter.vertexCounts(rvg::DrawType::stroke)[0], true);
+
+	// dashing doesn't change the geometry, still one draw
+	mode.dash = {4.f, 2.f, 1.f};
+	rvg::Polygon dashed {ctx};
+	dashed.update(points, mode);
+	EXPECT(dashed.vertexCounts(rvg::DrawType::stroke)[0],
+		round.vertexCounts(rvg::DrawType::stroke)[0]);
+
+	// invalid patterns are fixed up: repeated odd patterns are cut to
+	// maxDashes, negative lengths are zero, no length means solid
+	mode.dash = {1.f, 2.f, 3.f, 4.f, 5.f};
+	DashCheck many {ctx};
+	many.update(points, mode);
+	EXPECT(many.dashes().size(), rvg::DrawMode::maxDashes);
+
+	mode.dash = {2.f, -1.f};
+	DashCheck negative {ctx};
+	negative.update(points, mode);
+	EXPECT(negative.dashes().size(), 2u);
+	EXPECT(negative.dashes()[1], 0.f);
+
+	mode.dash = {0.f, 0.f};
+	DashCheck empty {ctx};
+	empty.update(points, mode);
+	EXPECT(empty.dashes().empty(), true);
+
+	rvg::Paint paint {ctx, rvg::colorPaint(rvg::Color::red)};
+	ctx.updateDevice();
+	auto cmdBuf = record(ctx, [&](auto& cb){
+		paint.bind(cb);
+		miter.stroke(cb);
+		round.stroke(cb);
+		dashed.stroke(cb);
+		many.stroke(cb);
+		negative.stroke(cb);
+		empty.stroke(cb);
+	});
+
+	renderSubmit(ctx, cmdBuf);
+}
+
+TEST(transform) {
+	auto pctx = createContext();
+	auto& ctx = *pctx;
+
+	std::vector<nytl::Vec2f> points = {{0.f, 0.f}, {10.f, 0.f}, {10.f, 10.f}};
+	rvg::DrawMode mode {true, 1.f};
+	mode.transform[0][2] = 5.f;
+
+	rvg::Polygon polygon {ctx};
+	polygon.update(points, mode);
+	EXPECT(polygon.bounds().position.x, 3.f); // miter limit 4
+	EXPECT(ctx.updateDevice(), true);
+
+	// translations only transform the baked vertices, no rerecord
+	auto moved = mode.transform;
+	moved[1][2] = 10.f;
+	EXPECT(polygon.transform(moved), true);
+	EXPECT(polygon.bounds().position.y, 8.f);
+	EXPECT(ctx.updateDevice(), false);
+
+	// non-uniform scaling changes the stroke, needs an update
+	auto scaled = moved;
+	scaled[0][0] = 2.f;
+	EXPECT(polygon.transform(scaled), false);
+}
+
+TEST(sharedIndices) {
+	auto pctx = createContext();
+	auto& ctx = *pctx;
+
+	using rvg::IndexPattern;
+	EXPECT(rvg::Context::indexCount(IndexPattern::quads, 8u), 12u);
+	EXPECT(rvg::Context::indexCount(IndexPattern::strip, 5u), 9u);
+	EXPECT(rvg::Context::indexCount(IndexPattern::strip, 2u), 0u);
+
+	auto span = ctx.sharedIndices(IndexPattern::quads, 8u);
+	EXPECT(span.size(), 12u * sizeof(std::uint32_t));
+
+	// growing reallocates the buffer, i.e. needs a rerecord
+	ctx.updateDevice();
+	ctx.sharedIndices(IndexPattern::quads, 4096u);
+	EXPECT(ctx.updateDevice(), true);
+	auto& buf = ctx.sharedIndexBuffer(IndexPattern::quads);
+	EXPECT(buf.size() >= 6u * 1024u * sizeof(std::uint32_t), true);
+	EXPECT(buf.buffer().vkHandle() == span.buffer().vkHandle() &&
+		buf.offset() == span.offset(), false);
+}
+
+TEST(scene) {
+	auto pctx = createContext();
+	auto& ctx = *pctx;
+
+	rvg::Paint red {ctx, rvg::colorPaint(rvg::Color::red)};
+	rvg::Paint blue {ctx, rvg::colorPaint(rvg::Color::blue)};
+	rvg::RectShape r1 {ctx, {0.f, 0.f}, {10.f, 10.f}, {true, 1.f}};
+	rvg::RectShape r2 {ctx, {20.f, 0.f}, {10.f, 10.f}, {true, 1.f}};
+	rvg::RectShape r3 {ctx, {40.f, 0.f}, {10.f, 10.f}, {true, 1.f}};
+
+	rvg::Scene scene(ctx);
+	scene.fill(r1, {&red}, r1.bounds());
+	scene.fill(r2, {&blue}, r2.bounds());
+	auto id = scene.stroke(r2, {&red}, r2.bounds());
+	scene.fill(r3, {&red}, r3.bounds());
+	EXPECT(scene.size(), 4u);
+
+	EXPECT(scene.remove(id), true);
+	EXPECT(scene.remove(id), false);
+	EXPECT(scene.size(), 3u);
+
+	ctx.updateDevice();
+	auto cmdBuf = record(ctx, [&](auto& cb){
+		scene.record(cb);
+	});
+
+	renderSubmit(ctx, cmdBuf);
+}
+
+TEST(damage) {
+	rvg::ContextSettings settings;
+	settings.dynamicScissor = true;
+	auto pctx = createContext(settings);
+	auto& ctx = *pctx;
+
+	// identity transform, i.e. in ndc. r3 is outside the viewport
+	rvg::Paint red {ctx, rvg::colorPaint(rvg::Color::red)};
+	rvg::RectShape r1 {ctx, {-1.f, -1.f}, {0.5f, 0.5f}, {true, 0.f}};
+	rvg::RectShape r2 {ctx, {0.5f, 0.5f}, {0.5f, 0.5f}, {true, 0.f}};
+	rvg::RectShape r3 {ctx, {2.f, 2.f}, {0.5f, 0.5f}, {true, 0.f}};
+
+	rvg::Scene scene(ctx);
+	scene.fill(r1, {&red});
+	scene.fill(r2, {&red});
+	scene.fill(r3, {&red});
+
+	auto vp = vk::Viewport {0.f, 0.f, float(fbExtent.width),
+		float(fbExtent.height), 0.f, 1.f};
+	ctx.updateDevice();
+	EXPECT(scene.damage(vp).size(), 2u);
+	ctx.updateDevice();
+	EXPECT(scene.damage(vp).empty(), true);
+
+	r1.update();
+	ctx.updateDevice();
+	auto regions = scene.damage(vp);
+	EXPECT(regions.size(), 1u);
+	EXPECT(regions[0].offset.x, 0);
+	EXPECT(regions[0].extent.width, 128u);
+
+	auto cmdBuf = record(ctx, [&](auto& cb){
+		scene.record(cb, regions, vk::ClearColorValue {{0.f, 0.f, 0.f, 1.f}});
+	});
+
+	renderSubmit(ctx, cmdBuf);
+
+	// b and c are merged into a region overlapping the one of a
+	// that was already checked against both, in pixels:
+	// a: (0, 0, 32, 32), b: (64, 0, 32, 48), c: (16, 40, 64, 32)
+	rvg::RectShape a {ctx, {-1.f, -1.f}, {0.125f, 0.125f}, {true, 0.f}};
+	rvg::RectShape b {ctx, {-0.75f, -1.f}, {0.125f, 0.1875f}, {true, 0.f}};
+	rvg::RectShape c {ctx, {-0.9375f, -0.84375f}, {0.25f, 0.125f}, {true, 0.f}};
+
+	rvg::Scene merged(ctx);
+	merged.fill(a, {&red});
+	merged.fill(b, {&red});
+	merged.fill(c, {&red});
+
+	ctx.updateDevice();
+	regions = merged.damage(vp);
+	EXPECT(regions.size(), 1u);
+	EXPECT(regions[0].offset.x, 0);
+	EXPECT(regions[0].offset.y, 0);
+	EXPECT(regions[0].extent.width, 96u);
+	EXPECT(regions[0].extent.height, 72u);
+}
+
+TEST(culling) {
+	auto pctx = createContext();
+	auto& ctx = *pctx;
+
+	// with the identity transform only r1 is inside the viewport
+	rvg::Paint red {ctx, rvg::colorPaint(rvg::Color::red)};
+	rvg::RectShape r1 {ctx, {-0.5f, -0.5f}, {1.f, 1.f}, {true, 0.f}};
+	rvg::RectShape r2 {ctx, {20.f, 0.f}, {10.f, 10.f}, {true, 0.1f}};
+
+	rvg::Scene scene(ctx);
+	scene.fill(r1, {&red});
+	scene.fill(r2, {&red});
+	scene.stroke(r2, {&red});
+
+	scene.culling(rvg::Scene::Culling::cpu);
+	EXPECT(scene.updateCulling(), true);
+	EXPECT(scene.updateCulling(), false);
+
+	scene.culling(rvg::Scene::Culling::gpu);
+	EXPECT(scene.updateCulling(), true);
+	EXPECT(scene.updateCulling(), false);
+	ctx.updateDevice();
+
+	auto& dev = ctx.device();
+	auto qf = dev.queueSubmitter().queue().family();
+	auto cullBuf = dev.commandAllocator().get(qf);
+	vk::beginCommandBuffer(cullBuf, {});
+	scene.recordCull(cullBuf);
+	vk::endCommandBuffer(cullBuf);
+
+	auto renderBuf = record(ctx, [&](auto& cb){
+		scene.record(cb);
+	});
+
+	auto semaphore = ctx.stageUpload();
+	std::array<vk::CommandBuffer, 2> cbs {cullBuf, renderBuf};
+	vk::SubmitInfo submission;
+	submission.commandBufferCount = cbs.size();
+	submission.pCommandBuffers = cbs.data();
+
+	if(semaphore) {
+		static auto stage = nytl::Flags {vk::PipelineStageBits::allCommands};
+		submission.pWaitSemaphores = &semaphore;
+		submission.pWaitDstStageMask = &stage;
+		submission.waitSemaphoreCount = 1u;
+	}
+
+	auto& qs = dev.queueSubmitter();
+	qs.wait(qs.add(submission));
+}
+
+TEST(instanced) {
+	rvg::ContextSettings settings;
+	settings.instancing = true;
+	auto pctx = createContext(settings);
+	auto& ctx = *pctx;
+
+	std::vector<nytl::Vec2f> points = {{0.f, 0.f}, {1.f, 0.f}, {1.f, 1.f}};
+	rvg::InstancedShape shape {ctx, points, {true, 0.1f}};
+	EXPECT(shape.instances().size(), 0u);
+	ctx.updateDevice();
+
+	// changing instances only rerecords when the buffer grows
+	auto id = shape.add({{1.f, 1.f}, 2.f});
+	shape.add({{2.f, 1.f}});
+	shape.add({{3.f, 1.f}});
+	EXPECT(ctx.updateDevice(), true);
+	EXPECT(shape.instance(id).scale, 2.f);
+
+	shape.instance(id, {{3.f, 3.f}, 1.f, 0.5f});
+	shape.remove(1u);
+	EXPECT(ctx.updateDevice(), false);
+	EXPECT(shape.instances().size(), 2u);
+	EXPECT(shape.instance(id).rotation, 0.5f);
+
+	rvg::Paint paint {ctx, rvg::pointColorPaint()};
+	auto cmdBuf = record(ctx, [&](auto& cb){
+		paint.bind(cb);
+		shape.fill(cb);
+		shape.stroke(cb);
+	});
+
+	renderSubmit(ctx, cmdBuf);
+}
+
+TEST(layer) {
+	rvg::ContextSettings settings;
+	settings.stencilFill = true;
+	auto pctx = createContext(settings);
+	auto& ctx = *pctx;
+
+	// self-intersecting star, stencil fills need the layer's own
+	// stencil attachment
+	std::vector<nytl::Vec2f> star;
+	for(auto i = 0u; i < 5u; ++i) {
+		auto a = 4 * 3.14159f * i / 5;
+		star.push_back({50.f + 40.f * std::cos(a), 50.f + 40.f * std::sin(a)});
+	}
+
+	rvg::DrawMode mode {true};
+	mode.fillRule = rvg::FillRule::nonZero;
+	rvg::Polygon polygon {ctx};
+	polygon.update(star, mode);
+
+	rvg::Paint red {ctx, rvg::colorPaint(rvg::Color::red)};
+	rvg::RectShape rect {ctx, {10.f, 10.f}, {20.f, 20.f}, {true, 0.f}};
+	rvg::Scene scene(ctx);
+	scene.fill(rect, {&red});
+	scene.fill(polygon, {&red});
+
+	rvg::Layer layer(ctx, scene, {{0.f, 0.f}, {100.f, 100.f}});
+	EXPECT(ctx.layerStencilFormat() != vk::Format::undefined, true);
+	EXPECT(layer.size(), (nytl::Vec2ui{100u, 100u}));
+
+	ctx.updateDevice();
+	auto cmdBuf = record(ctx, [&](auto& cb){
+		layer.draw(cb);
+	});
+
+	renderSubmit(ctx, cmdBuf);
+}
+
+TEST(uploadQueue) {
+	// another family the device has a queue for, otherwise the
+	// rendering family is used
+	auto& dev = *globals.device;
+	auto render = dev.queueSubmitter().queue().family();
+	auto families = vk::getPhysicalDeviceQueueFamilyProperties(
+		dev.vkPhysicalDevice());
+
+	rvg::ContextSettings settings;
+	settings.uploadQueueFamily = render;
+	auto transfer = vk::QueueBits::transfer | vk::QueueBits::graphics |
+		vk::QueueBits::compute;
+	for(auto i = 0u; i < families.size(); ++i) {
+		if(i != render && (families[i].queueFlags & transfer) &&
+				dev.queue(i)) {
+			settings.uploadQueueFamily = i;
+			break;
+		}
+	}
+
+	auto pctx = createContext(settings);
+	auto& ctx = *pctx;
+	EXPECT(ctx.renderQueueFamily(), render);
+	EXPECT(ctx.uploadQueueFamily(), *settings.uploadQueueFamily);
+
+	std::vector<nytl::Vec2f> points = {{0.f, 0.f}, {100.f, 0.f}, {100.f, 100.f}};
+	rvg::DrawMode mode {true, 2.f};
+	mode.deviceLocal = true;
+
+	rvg::Polygon polygon {ctx};
+	polygon.update(points, mode);
+
+	rvg::Paint paint {ctx, rvg::colorPaint(rvg::Color::red)};
+	ctx.updateDevice();
+	auto cmdBuf = record(ctx, [&](auto& cb){
+		paint.bind(cb);
+		polygon.fill(cb);
+		polygon.stroke(cb);
+	});
+
+	renderSubmit(ctx, cmdBuf);
+
+	// staged again, the buffers keep their size
+	points[1] = {50.f, 0.f};
+	polygon.update(points, mode);
+	EXPECT(ctx.updateDevice(), false);
+	renderSubmit(ctx, cmdBuf);
+	EXPECT(ctx.stats().stagedBytes > 0u, true);
+}
+
+TEST(uniformArena) {
+	auto pctx = createContext();
+	auto& ctx = *pctx;
+
+	// more transforms than fit into one block
+	auto& arena = ctx.transformArena(false);
+	auto count = rvg::UniformArena::blockSlots + 10u;
+	std::vector<rvg::Transform> transforms;
+	transforms.reserve(count);
+	for(auto i = 0u; i < count; ++i) {
+		transforms.emplace_back(ctx, false);
+	}
+
+	auto& t0 = transforms[0];
+	auto& t1 = transforms[1];
+	EXPECT(t0.ds() == t1.ds(), true);
+	EXPECT(t1.dsOffset() - t0.dsOffset(), arena.stride());
+	EXPECT(t0.ds() == transforms.back().ds(), false);
+	EXPECT(arena.stride() % 16u, 0u);
+
+	// freed slots are reused
+	auto ds = transforms[5].ds();
+	auto offset = transforms[5].dsOffset();
+	transforms[5] = {};
+	rvg::Transform reused {ctx, false};
+	EXPECT(reused.ds() == ds, true);
+	EXPECT(reused.dsOffset(), offset);
+
+	rvg::Paint paint {ctx, rvg::colorPaint(rvg::Color::red)};
+	rvg::RectShape rect {ctx, {10.f, 10.f}, {20.f, 20.f}, {true, 0.f}};
+	ctx.updateDevice();
+	auto cmdBuf = record(ctx, [&](auto& cb){
+		paint.bind(cb);
+		reused.bind(cb);
+		rect.fill(cb);
+		transforms.back().bind(cb);
+		rect.fill(cb);
+	});
+
+	renderSubmit(ctx, cmdBuf);
+}
+
+TEST(pushState) {
+	rvg::ContextSettings settings;
+	settings.pushState = true;
+	auto pctx = createContext(settings);
+	auto& ctx = *pctx;
+
+	rvg::Paint paint {ctx, rvg::colorPaint(rvg::Color::red)};
+	rvg::RectShape rect {ctx, {10.f, 10.f}, {20.f, 20.f}, {true, 2.f}};
+	rvg::Transform transform {ctx};
+	rvg::Scissor scissor {ctx, {{0.f, 0.f}, {20.f, 20.f}}};
+	ctx.updateDevice();
+
+	auto scale = nytl::identity<3, float>();
+	scale[0][0] = scale[1][1] = 2.f;
+	auto cmdBuf = record(ctx, [&](auto& cb){
+		paint.bind(cb);
+		ctx.pushTransform(cb, scale);
+		ctx.pushScissor(cb, {{0.f, 0.f}, {15.f, 15.f}});
+		rect.fill(cb);
+
+		transform.bind(cb);
+		scissor.bind(cb);
+		rect.stroke(cb);
+	});
+
+	renderSubmit(ctx, cmdBuf);
+
+	// the values were recorded into the command buffer
+	EXPECT(ctx.updateDevice(), false);
+	transform.matrix(nytl::identity<4, float>());
+	EXPECT(ctx.updateDevice(), true);
+}
+
+TEST(dynamicScissor) {
+	rvg::ContextSettings settings;
+	settings.dynamicScissor = true;
+	auto pctx = createContext(settings);
+	auto& ctx = *pctx;
+
+	// identity transform, i.e. the scissor is in ndc
+	rvg::Paint paint {ctx, rvg::colorPaint(rvg::Color::red)};
+	rvg::RectShape rect {ctx, {-1.f, -1.f}, {2.f, 2.f}, {true, 0.f}};
+	rvg::Transform transform {ctx};
+	rvg::Scissor scissor {ctx, {{-1.f, -1.f}, {1.f, 1.f}}};
+
+	auto rotation = nytl::identity<4, float>();
+	rotation[0][0] = rotation[1][1] = 0.f;
+	rotation[0][1] = 1.f;
+	rotation[1][0] = -1.f;
+	rvg::Transform rotated {ctx, rotation};
+
+	auto vp = vk::Viewport {0.f, 0.f, float(fbExtent.width),
+		float(fbExtent.height), 0.f, 1.f};
+	ctx.updateDevice();
+
+	// rotated transforms fall back to the shader scissor
+	bool hardware {}, fallback {true};
+	auto cmdBuf = record(ctx, [&](auto& cb){
+		paint.bind(cb);
+		transform.bind(cb);
+		hardware = scissor.bind(cb, transform, vp);
+		rect.fill(cb);
+
+		rotated.bind(cb);
+		fallback = scissor.bind(cb, rotated, vp);
+		rect.fill(cb);
+	});
+
+	EXPECT(hardware, true);
+	EXPECT(fallback, false);
+	renderSubmit(ctx, cmdBuf);
+
+	// the hardware scissor was recorded into the command buffer
+	EXPECT(ctx.updateDevice(), false);
+	scissor.rect({{-0.5f, -0.5f}, {1.f, 1.f}});
+	EXPECT(ctx.updateDevice(), true);
+}
+
+TEST(gpuProfiling) {
+	rvg::ContextSettings settings;
+	settings.gpuProfiling = true;
+	settings.maxProfilingRegions = 4u;
+	auto pctx = createContext(settings);
+	auto& ctx = *pctx;
+	auto supported = bool(ctx.device().properties().limits.
+		timestampComputeAndGraphics);
+
+	rvg::Paint paint {ctx, rvg::colorPaint(rvg::Color::red)};
+	rvg::RectShape rect {ctx, {10.f, 10.f}, {20.f, 20.f}, {true, 2.f}};
+	ctx.updateDevice();
+
+	// nested regions with the same label are accumulated
+	auto cmdBuf = record(ctx, [&](auto& cb){
+		paint.bind(cb);
+		ctx.beginRegion(cb, "rect");
+		rect.fill(cb);
+		ctx.beginRegion(cb, "rect");
+		rect.stroke(cb);
+		ctx.endRegion(cb);
+		ctx.endRegion(cb);
+	});
+
+	// the results of a frame are resolved in the next stageUpload
+	renderSubmit(ctx, cmdBuf);
+	EXPECT(ctx.stats().gpu.empty(), true);
+
+	ctx.updateDevice();
+	renderSubmit(ctx, cmdBuf);
+	auto& gpu = ctx.stats().gpu;
+	auto it = std::find_if(gpu.begin(), gpu.end(),
+		[](auto& region) { return region.label == "rect"; });
+	EXPECT(it != gpu.end(), supported);
+	if(it != gpu.end()) {
+		EXPECT(it->count, 2u);
+		EXPECT(it->time.count() >= 0.0, true);
+	}
+}
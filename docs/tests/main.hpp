@@ -154,8 +154,8 @@ int main() {
 	return ret;
 }
 
-std::unique_ptr<rvg::Context> createContext() {
-	rvg::ContextSettings settings;
+std::unique_ptr<rvg::Context> createContext(
+		rvg::ContextSettings settings = {}) {
 	settings.renderPass = globals.rp;
 	settings.subpass = 0u;
 	settings.pipelineCache = globals.cache;
@@ -7,15 +7,24 @@
 #include <rvg/fwd.hpp>
 #include <rvg/state.hpp>
 #include <rvg/paint.hpp>
+#include <rvg/uniformArena.hpp>
+#include <rvg/stats.hpp>
 
 #include <vpp/trackedDescriptor.hpp>
 #include <vpp/pipeline.hpp>
 #include <vpp/image.hpp>
 #include <vpp/handles.hpp>
+#include <vpp/submit.hpp>
+#include <vpp/sharedBuffer.hpp>
+#include <vpp/memoryMap.hpp>
 #include <nytl/nonCopyable.hpp>
 
 #include <variant>
+#include <array>
+#include <optional>
+#include <string_view>
 #include <unordered_set>
+#include <unordered_map>
 
 namespace rvg {
 
@@ -45,6 +54,84 @@ struct ContextSettings {
 
 	/// The multisample bits to use for the pipelines.
 	vk::SampleCountBits samples {};
+
+	/// Whether transform and scissor are passed to the shaders as push
+	/// constants instead of uniform buffers.
+	/// They can then be set per draw via Context::pushTransform and
+	/// Context::pushScissor without any allocation, upload or descriptor
+	/// set which is ideal for immediate-mode style code.
+	/// Transform and Scissor objects can still be used but their values
+	/// are recorded into the command buffer when bound, i.e. changing
+	/// them always triggers a rerecord.
+	/// Only affine 2D transforms are supported in this mode, the z and
+	/// projective parts of Transform matrices are ignored.
+	bool pushState {false};
+
+	/// The queue family to record and submit upload work (the staging
+	/// copies for deviceLocal buffers and textures) on.
+	/// Should be a family with a dedicated transfer queue so that large
+	/// uploads don't have to compete with rendering work.
+	/// Ownership of uploaded resources is then transferred to the family of
+	/// the device's default queueSubmitter, the semaphore returned by
+	/// stageUpload can be used for synchronization as usual.
+	/// If not set, equal to the rendering family or if the device has no
+	/// queue of the given family, uploads will be done on the
+	/// queueSubmitter of the device.
+	std::optional<unsigned> uploadQueueFamily {};
+
+	/// Whether to create additional pipelines without shader scissor.
+	/// Scissor::bind with a transform and viewport can then apply
+	/// rectangular scissors via the dynamic vkCmdSetScissor state instead
+	/// of per-vertex clip distances or per-fragment discards.
+	/// The scissor set by the application is then overwritten, its
+	/// render pass and viewport setup must leave it to Scissor::bind.
+	bool dynamicScissor {false};
+
+	/// Whether to create instanced variants of all pipelines.
+	/// Needed for InstancedShape.
+	bool instancing {false};
+
+	/// The maximum distance (in pixels) between curves (e.g. the rounded
+	/// corners of a RectShape) and the polygons approximating them.
+	/// Smaller values result in more vertices.
+	float curveTolerance {0.25f};
+
+	/// Whether to create the pipelines for filling non-convex polygons,
+	/// see FillRule. The subpass must then use a depth-stencil attachment
+	/// with a stencil component that is cleared to zero.
+	/// Layers get their own stencil attachment then.
+	bool stencilFill {false};
+
+	/// The maximum position error (in local coordinates) for which
+	/// polygons use the compact vertex format: positions as 16-bit
+	/// fixed point values relative to the bounds of each draw and 16-bit
+	/// antialiasing coordinates, halving their memory and bandwidth.
+	/// Draws whose bounds are too large for this precision, stencil fills
+	/// and instanced polygons use 32-bit floats. Zero disables the compact
+	/// format and the additional pipelines for it.
+	float compactPrecision {0.f};
+
+	/// Callbacks for external tracing tools, see TraceHooks.
+	TraceHooks trace {};
+
+	/// Whether to measure the GPU time of uploads and of regions
+	/// marked with Context::beginRegion/endRegion via timestamp queries.
+	/// The results are available in FrameStats::gpu. When enabled,
+	/// stageUpload always submits work (resetting the queries), i.e. always
+	/// returns a semaphore. Upload times are only measured when uploads
+	/// are done on the rendering queue family.
+	bool gpuProfiling {false};
+
+	/// The maximum number of profiling regions recorded at the same time.
+	unsigned maxProfilingRegions {256};
+};
+
+/// Index patterns of the shared index buffers, see Context::sharedIndices.
+/// Allow to draw strips and quads with the list pipeline, i.e. to
+/// concatenate them into one draw without degenerate triangles.
+enum class IndexPattern {
+	quads, /// two triangles per 4 vertices (in strip order)
+	strip, /// the triangles of a triangle strip, with consistent winding
 };
 
 /// Drawing context. Manages all pipelines and layouts needed to
@@ -61,7 +148,8 @@ public:
 		Texture*,
 		Transform*,
 		Scissor*,
-		FontAtlas*>;
+		FontAtlas*,
+		InstancedShape*>;
 
 	/// Descriptor set bindings.
 	static constexpr auto transformBindSet = 0u;
@@ -70,6 +158,62 @@ public:
 	static constexpr auto scissorBindSet = 3u;
 	static constexpr auto aaStrokeBindSet = 4u;
 
+	/// Push constant layout (offsets in bytes).
+	/// The draw type is always pushed (fragment stage). Transform and
+	/// scissor only with ContextSettings::pushState. The stage of the
+	/// scissor is vertex with clipDistance, fragment otherwise.
+	/// There is a single range per stage, the scissor therefore lies
+	/// between the type and the transform.
+	static constexpr auto pushTypeOffset = 0u; // u32
+	static constexpr auto pushScissorOffset = 16u; // vec4 (pos, size)
+	static constexpr auto pushTransformOffset = 32u; // 2 x vec4 (rows)
+	static constexpr auto pushStateEnd = 64u;
+
+	/// The fan, strip and list pipelines for one shader configuration.
+	struct Pipelines {
+		vpp::Pipeline fan;
+		vpp::Pipeline strip;
+		vpp::Pipeline list; // indexed, for FillRule::triangulated
+		vpp::Pipeline lines; // for StrokeType::lines
+		vpp::Pipeline fanInstanced; // only with ContextSettings::instancing
+		vpp::Pipeline stripInstanced;
+		vpp::Pipeline stencilNonZero; // only with ContextSettings::stencilFill
+		vpp::Pipeline stencilEvenOdd;
+		vpp::Pipeline cover;
+		vpp::Pipeline fanCompact; // only with ContextSettings::compactPrecision
+		vpp::Pipeline stripCompact;
+		vpp::Pipeline listCompact;
+	};
+
+	/// Compute pipeline and layouts, for culling on the gpu (see Scene)
+	/// and stroke expansion (see DrawMode::computeStroke).
+	struct ComputePipeline {
+		vpp::TrDsLayout dsLayout; // storage buffers
+		vpp::PipelineLayout layout; // push constants
+		vpp::Pipeline pipe;
+	};
+
+	using CullPipeline = ComputePipeline;
+
+	/// Per command buffer recording state.
+	struct RecordState {
+		bool layer {}; // whether it renders a Layer, kept by bindDefaults
+		bool hwScissor {}; // whether a dynamic hardware scissor is used
+		vk::Rect2D fullScissor {}; // the scissor to reset it to
+		std::vector<unsigned> queries; // profiling regions, query pairs
+		std::vector<unsigned> openRegions;
+
+		// Bound state, only valid while tracking is enabled.
+		// See Context::trackState.
+		bool track {};
+		vk::Pipeline pipeline {};
+		std::uint32_t type {0xFFFFFFFFu}; // pushed draw type
+		std::array<vk::Buffer, 4> vertexBuffers {};
+		std::array<vk::DeviceSize, 4> vertexOffsets {};
+		std::array<vk::DescriptorSet, 5> descriptors {};
+		std::array<std::uint32_t, 5> dynamicOffsets {};
+	};
+
 	/// Specifies the thickness of the anti aliasing area.
 	/// A greater fringe may result in smoother but also
 	/// more blurry edges.
@@ -107,25 +251,107 @@ public:
 	///   If this is false, the submission must later on be done manually,
 	///   the work will only be queued (i.e. added) to the device's
 	///   queueSubmitter.
+	///   When a separate upload queue family is used (see
+	///   ContextSettings::uploadQueueFamily), the transfer work is always
+	///   submitted immediately, only the ownership acquisition on the
+	///   rendering queue is affected by this parameter.
 	vk::Semaphore stageUpload(bool submit = false);
 
 	/// Must be called once per frame when there is no command buffer
 	/// executing that references objects associated with this context.
-	/// Will update device objects (like buffers).
+	/// Will update device objects (like buffers) and flush all
+	/// non-coherent hostVisible memory written since the last call.
 	/// Returns whether a rerecord is needed. Submitting a previously
 	/// recorded command buffer referencing objects associated with this
 	/// Context when this returns true results in undefined behaviour.
 	bool updateDevice();
 
 	/// Signal that a rerecord is needed.
-	void rerecord() { rerecord_ = true; }
+	void rerecord();
+
+	/// Returns the statistics of the last completed frame, i.e. of
+	/// everything between the last two stageUpload calls.
+	const FrameStats& stats() const { return lastStats_; }
+
+	/// Returns all objects that were updated in the last updateDevice call,
+	/// i.e. whose rendering might have changed. Can be used for damage
+	/// tracking, see Scene::damage.
+	const auto& updatedObjects() const { return updated_; }
+
+	/// Only available with ContextSettings::pushState.
+	/// Sets the transform or scissor for all following draws in the given
+	/// command buffer (until something else is bound/pushed), without
+	/// the need for a Transform or Scissor object.
+	/// The last row of the transform is ignored, it must be affine.
+	void pushTransform(vk::CommandBuffer, const nytl::Mat3f&) const;
+	void pushTransform(vk::CommandBuffer, const nytl::Mat4f&) const;
+	void pushScissor(vk::CommandBuffer, const nytl::Rect2f&) const;
+
+	/// Only has an effect with ContextSettings::gpuProfiling.
+	/// Marks a region in the given command buffer whose GPU time
+	/// should be measured. Regions can be nested and there can be multiple
+	/// regions with the same label, their times are accumulated.
+	/// Must be used after bindDefaults in the command buffer, the
+	/// queries are freed when bindDefaults is called again for it.
+	void beginRegion(vk::CommandBuffer, std::string_view label);
+	void endRegion(vk::CommandBuffer);
 
 
 	// internal resources, mainly used by other rvg classes for rendering
 	const auto& device() const { return device_; };
 	const auto& pipeLayout() const { return pipeLayout_; }
-	const auto& fanPipe() const { return fanPipe_; }
-	const auto& stripPipe() const { return stripPipe_; }
+	const auto& fanPipe() const { return pipes_.fan; }
+	const auto& stripPipe() const { return pipes_.strip; }
+	const auto& listPipe() const { return pipes_.list; }
+
+	// The pipelines to use for drawing in the given command buffer,
+	// depends on whether a hardware scissor is bound in it or
+	// whether it renders a layer.
+	const Pipelines& pipes(vk::CommandBuffer) const;
+
+	// The render pass used for rendering layers, compatible with
+	// all Layer framebuffers. Created (with the pipelines for it)
+	// on first use. With ContextSettings::stencilFill, it has a
+	// stencil attachment (cleared to zero) of layerStencilFormat.
+	const vpp::RenderPass& layerRenderPass();
+	vk::Format layerStencilFormat() const { return layerStencilFormat_; }
+
+	// The compute pipeline for culling, created on first use.
+	// Items, draw commands. Push constant: u32 item count.
+	const ComputePipeline& cullPipeline();
+
+	// The compute pipeline for stroke expansion, created on first use.
+	// Points, vertices, aa coords. Push constants: see stroke.comp.
+	const ComputePipeline& strokePipeline();
+
+	// Whether upload command buffers can record compute work, i.e.
+	// whether the upload queue family supports compute.
+	bool uploadCompute() const { return uploadCompute_; }
+
+	// Layers are updated after all other device objects in updateDevice.
+	// A layer command buffer added in updateDevice will be submitted
+	// after the uploads in the next stageUpload call.
+	void registerLayer(Layer&);
+	void unregisterLayer(Layer&) noexcept;
+	void addLayerDraw(vk::CommandBuffer);
+
+	// State tracked while recording the given command buffer.
+	// Reset by bindDefaults.
+	RecordState& recordState(vk::CommandBuffer);
+
+	// Enables or disables tracking of the pipeline, vertex buffers
+	// and descriptor sets bound by rvg in the given command buffer.
+	// While enabled, the bind functions below skip redundant binds,
+	// nothing else must be bound in the command buffer then.
+	// Enabling it resets the tracked state.
+	void trackState(vk::CommandBuffer, bool);
+
+	void bindPipeline(vk::CommandBuffer, vk::Pipeline);
+	void pushType(vk::CommandBuffer, std::uint32_t type);
+	void bindVertexBuffers(vk::CommandBuffer, unsigned first,
+		nytl::Span<const vk::Buffer>, nytl::Span<const vk::DeviceSize>);
+	void bindDescriptorSet(vk::CommandBuffer, unsigned set, vk::DescriptorSet,
+		std::optional<std::uint32_t> dynamicOffset = {});
 
 	const auto& dsLayoutTransform() const { return dsLayoutTransform_; }
 	const auto& dsLayoutScissor() const { return dsLayoutScissor_; }
@@ -133,6 +359,12 @@ public:
 	const auto& dsLayoutFontAtlas() const { return dsLayoutFontAtlas_; }
 	const auto& dsLayoutStrokeAA() const { return dsLayoutStrokeAA_; }
 
+	// The arenas all Transform, Scissor and Paint objects allocate their
+	// uniform buffers from. Indexed by whether they are deviceLocal.
+	auto& transformArena(bool deviceLocal) { return transformArenas_[deviceLocal]; }
+	auto& scissorArena(bool deviceLocal) { return scissorArenas_[deviceLocal]; }
+	auto& paintArena(bool deviceLocal) { return paintArenas_[deviceLocal]; }
+
 	// TODO: allow to assign custom allocators per settings
 	vpp::DescriptorAllocator& dsAllocator() const;
 	vpp::BufferAllocator& bufferAllocator() const;
@@ -150,21 +382,81 @@ public:
 
 	const auto& settings() const { return settings_; }
 	bool antiAliasing() const { return settings().antiAliasing; }
+	vk::ShaderStageFlags scissorStage() const;
+
+	/// The queue families used for rendering and uploading.
+	/// Will be the same family if no separate upload queue is used.
+	unsigned renderQueueFamily() const { return renderFamily_; }
+	unsigned uploadQueueFamily() const { return uploadFamily_; }
+
+	// Returns the u32 indices to draw the given number of vertices in the
+	// given pattern with the list pipeline. The buffers are shared by all
+	// objects and only grow, which triggers a rerecord. Must only be
+	// called from updateDevice.
+	vpp::BufferSpan sharedIndices(IndexPattern, unsigned vertexCount);
+
+	// The current shared index buffer of the given pattern, never grows it.
+	// Objects must not keep the spans returned by sharedIndices since
+	// the buffer is replaced when another object grows it. They should
+	// use this when recording instead.
+	const vpp::SubBuffer& sharedIndexBuffer(IndexPattern pattern) const {
+		return sharedIndices_[unsigned(pattern)]; }
+	static unsigned indexCount(IndexPattern, unsigned vertexCount);
 
 	// internal DeviceObject communication
 	vpp::CommandBuffer uploadCmdBuf();
 	void addCommandBuffer(DevRes, vpp::CommandBuffer&&);
 	void addStage(vpp::SubBuffer&& buf);
 
+	// Must be called for all resources written by an upload command buffer
+	// (as returned by uploadCmdBuf) after the writing commands.
+	// Records the queue family ownership release (and the acquire on the
+	// rendering queue) if needed. For buffers, srcStage and srcAccess
+	// describe the writes, transfer writes by default. The span must
+	// only cover the written range: the rest of the buffer stays owned
+	// by the rendering family and would be undefined after a transfer
+	// of ownership it was never released for. For images, the
+	// given barrier must describe the final transition into the layout
+	// used for rendering.
+	void finishUpload(DevRes, vk::CommandBuffer, const vpp::BufferSpan&,
+		vk::PipelineStageFlags srcStage = vk::PipelineStageBits::transfer,
+		vk::AccessFlags srcAccess = vk::AccessBits::transferWrite);
+	void finishUpload(DevRes, vk::CommandBuffer, vk::ImageMemoryBarrier);
+
+	// Returns the mapped memory of the given hostVisible buffer span.
+	// The memory is expected to be fully written, it will be flushed
+	// (if not coherent) and unmapped in the next updateDevice call.
+	// The buffer must stay alive until then.
+	nytl::Span<std::byte> mapped(const vpp::BufferSpan&);
+
+	// Statistics of the current frame, for device objects to report
+	// their work. Signal a rerecord with a specific cause.
+	FrameStats& frameStats() { return stats_; }
+	void rerecord(const DeviceObject&, RerecordReason);
+
 	void registerUpdateDevice(DevRes);
 	bool deviceObjectDestroyed(::rvg::DeviceObject&) noexcept;
 	void deviceObjectMoved(::rvg::DeviceObject&, ::rvg::DeviceObject&) noexcept;
 
 private:
+	Pipelines createPipes(vk::RenderPass, unsigned subpass,
+		vk::SampleCountBits, bool shaderScissor,
+		bool premultiplied = false, bool stencil = false) const;
+
+	void resolveQueries();
+	void resetQueries(vk::CommandBuffer);
+
 	// Per-frame objects mainly used to efficiently upload data
 	struct Temporaries {
 		std::vector<std::pair<DevRes, vpp::CommandBuffer>> cmdBufs;
 		std::vector<vpp::SubBuffer> stages;
+
+		// ownership acquire barriers for the rendering queue family,
+		// only used with a separate upload queue family
+		std::vector<std::pair<DevRes, vk::BufferMemoryBarrier>> bufAcquires;
+		std::vector<std::pair<DevRes, vk::ImageMemoryBarrier>> imgAcquires;
+
+		std::vector<vk::CommandBuffer> layerDraws;
 	};
 
 	// NOTE: order here is rather important since some of them depend
@@ -177,9 +469,14 @@ private:
 	Temporaries currentFrame_;
 	Temporaries oldFrame_;
 
-	vpp::Pipeline fanPipe_;
-	vpp::Pipeline stripPipe_;
 	vpp::PipelineLayout pipeLayout_;
+	Pipelines pipes_;
+	Pipelines noScissorPipes_; // only with dynamicScissor
+	vpp::RenderPass layerRenderPass_; // created on first use
+	Pipelines layerPipes_;
+	vk::Format layerStencilFormat_ {vk::Format::undefined};
+	std::unique_ptr<ComputePipeline> cullPipeline_; // created on first use
+	std::unique_ptr<ComputePipeline> strokePipeline_;
 
 	vpp::TrDsLayout dsLayoutTransform_;
 	vpp::TrDsLayout dsLayoutScissor_;
@@ -189,6 +486,10 @@ private:
 
 	vpp::Sampler texSampler_;
 
+	std::array<UniformArena, 2> transformArenas_;
+	std::array<UniformArena, 2> scissorArenas_;
+	std::array<UniformArena, 2> paintArenas_;
+
 	Texture emptyImage_;
 	vpp::TrDs dummyTex_;
 
@@ -200,10 +501,51 @@ private:
 	vpp::SubBuffer defaultStrokeAABuf_;
 	vpp::TrDs defaultStrokeAA_;
 
+	// hostVisible, indexed by IndexPattern, see sharedIndices
+	std::array<vpp::SubBuffer, 2> sharedIndices_;
+	std::array<unsigned, 2> sharedIndexVertices_ {};
+
 	bool rerecord_ {};
+	std::unordered_map<vk::CommandBuffer, RecordState> recordStates_;
+
+	FrameStats stats_; // current frame
+	FrameStats lastStats_;
+	std::unordered_set<const DeviceObject*> updated_;
+	std::vector<Layer*> layers_;
+
+	// gpu profiling, queries are used in pairs (begin, end)
+	// The first pair is used for the upload command buffer.
+	static constexpr auto uploadQuery = 0u;
+	bool profiling_ {};
+	bool queriesReset_ {}; // whether the queries were ever reset
+	vpp::QueryPool queryPool_;
+	std::vector<unsigned> freeQueries_;
+	std::vector<std::string> queryLabels_; // per pair
 
 	vpp::Semaphore uploadSemaphore_;
 	vpp::CommandBuffer uploadCmdBuf_;
+	std::vector<vk::CommandBuffer> submitCmdBufs_; // must outlive submission
+
+	// only used with a separate upload queue family
+	unsigned renderFamily_ {};
+	unsigned uploadFamily_ {};
+	bool uploadCompute_ {};
+	std::optional<vpp::QueueSubmitter> uploadSubmitter_;
+	vpp::Semaphore transferSemaphore_;
+	vpp::CommandBuffer acquireCmdBuf_;
+
+	// maps of all hostVisible memory written since the last updateDevice
+	// call and the ranges to flush in it. Released after flushing, see
+	// mapped.
+	struct Map {
+		vpp::MemoryMapView view;
+		vk::DeviceSize size;
+	};
+
+	std::unordered_map<vk::DeviceMemory, Map> maps_;
+	std::vector<vk::MappedMemoryRange> flushRanges_;
+
+	void flushMapped();
 };
 
 } // namespace rvg
@@ -8,6 +8,14 @@
 
 namespace rvg {
 
+/// Location of an indirect draw command (vk::DrawIndirectCommand)
+/// on the device. Allows to copy the draw commands of objects, see e.g.
+/// Polygon::commands.
+struct IndirectCommand {
+	vk::Buffer buffer {};
+	vk::DeviceSize offset {};
+};
+
 /// Simple base class for objects that register themself for
 /// updateDevice callbacks at their associated Context.
 class DeviceObject {
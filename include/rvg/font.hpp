@@ -51,6 +51,7 @@ protected:
 	Texture texture_;
 	bool invalid_ {};
 	std::vector<std::vector<std::byte>> blobs_;
+	unsigned glyphCount_ {}; // number of cached glyphs, for stats
 };
 
 // TODO: we should probably rather have something like
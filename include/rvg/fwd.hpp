@@ -15,6 +15,8 @@ struct DrawInstance;
 struct ContextSettings;
 struct PaintData;
 struct DrawMode;
+struct FrameStats;
+struct TraceHooks;
 
 class DeviceObject;
 class Context;
@@ -22,13 +24,20 @@ class Context;
 class Polygon;
 class RectShape;
 class CircleShape;
+class PathShape;
+class InstancedShape;
 class Shape;
+class Scene;
+class Layer;
 
 class Texture;
 class Paint;
 class Transform;
 class Scissor;
 
+class UniformArena;
+class UniformSlot;
+
 class FontAtlas;
 class Font;
 class Text;
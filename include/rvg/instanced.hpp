@@ -0,0 +1,92 @@
+// Copyright (c) 2019 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <rvg/fwd.hpp>
+#include <rvg/deviceObject.hpp>
+#include <rvg/polygon.hpp>
+
+#include <nytl/vec.hpp>
+#include <nytl/span.hpp>
+#include <vpp/sharedBuffer.hpp>
+#include <vector>
+
+namespace rvg {
+
+/// Many copies of the same polygon, drawn with a single instanced
+/// (indirect) draw call per fill or stroke.
+/// Every instance has its own offset, scale, rotation and color.
+/// The color is only used when drawing with a pointColorPaint, the
+/// DrawMode point colors have no effect.
+/// Requires ContextSettings::instancing.
+/// Changing, adding or removing instances only uploads the changed
+/// instance data and the instance count, it only triggers a rerecord
+/// when the buffer has to be reallocated.
+class InstancedShape : public DeviceObject {
+public:
+	/// Transformation and color of one instance, the polygon points
+	/// are rotated, then scaled and then offset.
+	struct Instance {
+		Vec2f offset {};
+		float scale {1.f};
+		float rotation {}; /// in radians
+		Vec4u8 color {255, 255, 255, 255}; /// srgb
+	};
+
+	static_assert(sizeof(Instance) == 20, "Must match the vertex layout");
+
+public:
+	InstancedShape() = default;
+	InstancedShape(Context&, Span<const Vec2f> points, const DrawMode&,
+		Span<const Instance> instances = {});
+
+	/// Changes the shared polygon of all instances.
+	void update(Span<const Vec2f> points, const DrawMode&);
+
+	/// Adds a new instance, returns its index.
+	unsigned add(const Instance&);
+
+	/// Changes the instance with the given index.
+	void instance(unsigned, const Instance&);
+
+	/// Removes the instance with the given index by moving the last
+	/// instance into its place, i.e. changes the index of the
+	/// last instance.
+	void remove(unsigned);
+
+	/// Replaces all instances.
+	void instances(Span<const Instance>);
+
+	/// Records commands to fill or stroke all instances.
+	/// Undefined behaviour if the DrawMode does not support it.
+	void fill(vk::CommandBuffer) const;
+	void stroke(vk::CommandBuffer) const;
+
+	const auto& instances() const { return instances_; }
+	const auto& instance(unsigned i) const { return instances_.at(i); }
+	const auto& polygon() const { return polygon_; }
+	const auto& drawMode() const { return drawMode_; }
+
+	/// Usually only automatically called from context when needed.
+	/// Uploads the draw commands and changed instances.
+	/// Returns whether a command buffer rerecord is needed.
+	bool updateDevice();
+
+protected:
+	void dirty(unsigned begin, unsigned end);
+
+protected:
+	Polygon polygon_;
+	DrawMode drawMode_;
+	std::vector<Instance> instances_;
+
+	// draw commands (fill, aa fill, stroke), then the instance data
+	vpp::SubBuffer buf_;
+	bool commandsDirty_ {};
+	unsigned dirtyBegin_ {}; // range of changed instances
+	unsigned dirtyEnd_ {};
+};
+
+} // namespace rvg
@@ -0,0 +1,103 @@
+// Copyright (c) 2019 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <rvg/fwd.hpp>
+#include <rvg/paint.hpp>
+#include <rvg/state.hpp>
+#include <rvg/shapes.hpp>
+
+#include <nytl/nonCopyable.hpp>
+#include <nytl/rect.hpp>
+#include <vpp/handles.hpp>
+#include <vpp/image.hpp>
+
+namespace rvg {
+
+/// Caches the rendering of a Scene in an offscreen image.
+/// The image is only rendered again when the scene changes or an object
+/// used by it was updated, drawing the layer is then just a single
+/// textured quad (using a texturePaintRGBA paint).
+/// The layer covers the given bounds in the coordinate space of the
+/// scene items without transform, everything outside of it is clipped.
+/// Items with a transform are drawn with it relative to the layer,
+/// i.e. it maps to the normalized [-1, 1] space of the layer image.
+/// The image is rendered by the Context after updating all other device
+/// objects in updateDevice and submitted in stageUpload.
+/// The scene must stay valid as long as the layer exists.
+/// With ContextSettings::stencilFill, layers have a stencil attachment,
+/// i.e. they can contain stencil fills (see FillRule).
+class Layer : public nytl::NonMovable {
+public:
+	/// The format of layer images. Colors are stored with
+	/// premultiplied alpha.
+	static constexpr auto format = vk::Format::r8g8b8a8Srgb;
+
+public:
+	/// - bounds: the area of the scene stored in the layer.
+	/// - clear: the color the layer is cleared with before rendering
+	///   the scene, transparent by default.
+	Layer(Context&, Scene& content, const Rect2f& bounds,
+		const Color& clear = {0, 0, 0, 0});
+	~Layer();
+
+	/// Sets the transform (and size of the viewport in pixels) the layer
+	/// is drawn with. The resolution of the image then follows the scale
+	/// of the transform, so that the layer stays sharp when magnified.
+	/// Without a transform, the image has one pixel per unit of the
+	/// bounds. The image is recreated when the needed resolution exceeds
+	/// its size or drops below half of it.
+	void follow(const Transform*, Vec2f viewportSize);
+
+	/// Changes the area of the scene stored in the layer.
+	void bounds(const Rect2f&);
+
+	/// Forces the layer to be rendered again in the next updateDevice.
+	void invalidate() { dirty_ = true; }
+
+	/// Draws the layer with the currently bound transform and scissor.
+	/// Binds its own paint.
+	void draw(vk::CommandBuffer) const;
+
+	Context& context() const { return *context_; }
+	const auto& bounds() const { return bounds_; }
+	const auto& paint() const { return paint_; }
+	const auto& image() const { return image_; }
+	const auto& size() const { return size_; }
+	vk::CommandBuffer commandBuffer() const { return cmdBuf_; }
+
+	/// Called by the Context in updateDevice, renders the layer
+	/// if needed.
+	void updateDevice();
+
+protected:
+	Vec2ui neededSize() const;
+	void resize(Vec2ui size);
+	void render();
+
+protected:
+	Context* context_ {};
+	Scene* content_ {};
+	Rect2f bounds_ {};
+	Color clear_ {};
+
+	const Transform* follow_ {};
+	Vec2f viewportSize_ {};
+
+	Vec2ui size_ {};
+	vpp::ViewableImage image_;
+	vpp::ViewableImage stencil_; // ContextSettings::stencilFill
+	vpp::Framebuffer fb_;
+	vpp::CommandBuffer cmdBuf_;
+
+	Transform transform_; // bounds -> layer image
+	Paint paint_;
+	RectShape quad_;
+
+	unsigned version_ {};
+	bool dirty_ {true};
+};
+
+} // namespace rvg
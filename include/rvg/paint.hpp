@@ -7,6 +7,7 @@
 #include <rvg/fwd.hpp>
 #include <rvg/deviceObject.hpp>
 #include <rvg/stateChange.hpp>
+#include <rvg/uniformArena.hpp>
 
 #include <nytl/vec.hpp>
 #include <nytl/mat.hpp>
@@ -202,13 +203,21 @@ PaintData linearGradient(Vec2f start, Vec2f end,
 	const Color& startColor, const Color& endColor);
 PaintData radialGradient(Vec2f center, float innerRadius, float outerRadius,
 	const Color& innerColor, const Color& outerColor);
-PaintData texturePaintRGBA(const nytl::Mat4f& transform, vk::ImageView);
+
+// premultiplied: whether the texture stores colors with premultiplied
+// alpha, e.g. the image of a Layer.
+PaintData texturePaintRGBA(const nytl::Mat4f& transform, vk::ImageView,
+	bool premultiplied = false);
 PaintData texturePaintA(const nytl::Mat4f& transform, vk::ImageView);
 PaintData pointColorPaint();
 
 /// Defines how shapes are drawn.
 /// For a more fine-grained control see PaintBinding and PaintBuffer.
 class Paint : public DeviceObject {
+public:
+	static constexpr auto uboSize =
+		sizeof(nytl::Mat4f) + sizeof(Vec4f) * 3 + sizeof(std::uint32_t);
+
 public:
 	Paint() = default;
 	Paint(Context&, const PaintData& data, bool deviceLocal = true);
@@ -223,19 +232,23 @@ public:
 	void paint(const PaintData& data) { *change() = data; }
 	const auto& paint() const { return paint_; }
 
-	const auto& ubo() const { return ubo_; }
-	const auto& ds() const { return ds_; }
+	/// The uniform buffer range and the descriptor set (which must be
+	/// bound with dsOffset() as dynamic offset) of this paint.
+	auto ubo() const { return slot_.span(); }
+	vk::DescriptorSet ds() const;
+	auto dsOffset() const { return slot_.offset(); }
 
 	void update();
 	bool updateDevice();
 
 protected:
 	void upload();
+	void updateDs();
 
 protected:
 	PaintData paint_ {};
-	vpp::SubBuffer ubo_;
-	vpp::TrDs ds_;
+	UniformSlot slot_;
+	vpp::TrDs ds_; // only for paints with texture, see updateDs
 	vk::ImageView oldView_ {};
 };
 
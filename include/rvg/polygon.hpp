@@ -8,12 +8,62 @@
 #include <rvg/deviceObject.hpp>
 
 #include <nytl/vec.hpp>
+#include <nytl/rect.hpp>
 #include <nytl/matOps.hpp>
 #include <vpp/trackedDescriptor.hpp>
 #include <vpp/sharedBuffer.hpp>
+#include <array>
+#include <cstdint>
 
 namespace rvg {
 
+/// How the inside of a filled polygon is determined.
+enum class FillRule {
+	/// The polygon is assumed to be convex, filled as triangle fan.
+	convex,
+	/// Stencil-then-cover fills that work for all polygons.
+	/// Need ContextSettings::stencilFill, don't support antialiasing
+	/// and point colors. Draw two primitives instead of one.
+	nonZero,
+	evenOdd,
+	/// Triangulated on the cpu in every update (ear clipping), drawn
+	/// as indexed triangle list. Works for all simple polygons and
+	/// supports holes (see DrawMode::holes), antialiasing and point
+	/// colors without needing a stencil attachment. Can't be instanced.
+	triangulated,
+};
+
+/// How the stroke of a polygon is generated.
+enum class StrokeType {
+	/// Baked into a triangle strip with miter joins (on the cpu or with
+	/// DrawMode::computeStroke on the gpu).
+	strip,
+	/// Only the segment endpoints are uploaded, each segment is expanded
+	/// into a quad in the vertex shader. Meant for thin lines like plots:
+	/// segments are not joined, wide strokes have notches at corners.
+	/// The width can be changed without update, see Polygon::strokeWidth.
+	/// Doesn't support point colors, the compact vertex format and
+	/// instancing.
+	lines,
+	/// Like lines but every two points are an independent segment,
+	/// e.g. for grids. DrawMode::loop has no effect.
+	lineList,
+};
+
+/// How the ends of open strokes look.
+enum class LineCap {
+	butt, /// ends at the points
+	round, /// half circle around the points
+	square, /// extended by half the stroke width
+};
+
+/// How the segments of strokes are connected.
+enum class LineJoin {
+	miter, /// see DrawMode::miterLimit
+	round,
+	bevel,
+};
+
 /// Specifies in which way a polygon can be drawn.
 struct DrawMode {
 	/// Whether polygon/shape can be filled.
@@ -67,16 +117,78 @@ struct DrawMode {
 	/// If this is false, hostVisible memory will be used.
 	bool deviceLocal {};
 
-	// TODO: use in implementation
-	/// Pre-transform that is applied while baking the primitive.
+	/// Whether to bake the stroke and antialiased fill vertices directly
+	/// into the mapped (or, for deviceLocal, staging) memory in
+	/// updateDevice instead of keeping them in host memory between update
+	/// and updateDevice. Only the passed points are kept then, which saves
+	/// memory and a copy per update. Has no effect for vertices with point
+	/// colors and antialiased triangulated fills, they are still baked in
+	/// update.
+	bool bakeDirect {};
+
+	/// Whether the polygon may use the compact vertex format, see
+	/// ContextSettings::compactPrecision. Must be false for polygons
+	/// that are drawn instanced, InstancedShape takes care of that.
+	bool compact {true};
+
+	/// Whether to expand the stroke on the gpu with a compute shader
+	/// recorded into the upload work instead of baking it on the cpu.
+	/// Only the points are uploaded then, which is much faster for
+	/// large polylines. Produces the same vertices as the cpu path,
+	/// except for runs of more than 16 duplicated points which collapse
+	/// to zero width (see stroke.comp).
+	/// Has no effect for strokes with point colors or when the upload
+	/// queue family (see ContextSettings::uploadQueueFamily) doesn't
+	/// support compute, the cpu path is used then. Strokes expanded on
+	/// the gpu never use the compact vertex format.
+	bool computeStroke {};
+
+	/// How the stroke is generated. Changing from or to a strip
+	/// will always trigger a rerecord.
+	StrokeType strokeType {StrokeType::strip};
+
+	/// Stroke style, only for StrokeType::strip. Strokes that don't use
+	/// the defaults (butt caps, miter joins with a limit of 4, no dashes)
+	/// are always baked on the cpu in update and don't support point
+	/// colors. Round caps and joins are flattened with
+	/// ContextSettings::curveTolerance.
+	LineCap cap {LineCap::butt};
+	LineJoin join {LineJoin::miter};
+
+	/// Miter joins are shortened to this multiple of half the stroke width.
+	float miterLimit {4.f};
+
+	/// Alternating lengths of dashes and gaps, an odd number of lengths
+	/// is repeated once. Empty for solid strokes. Evaluated per fragment
+	/// from the distance along the stroke, i.e. a dashed stroke is
+	/// still a single draw, the dashes have butt ends. At most maxDashes
+	/// lengths (after repeating) are used, negative lengths are treated
+	/// as zero and a pattern without length draws a solid stroke (both
+	/// with a warning). Needs ContextSettings::antiAliasing.
+	/// Changing between solid and dashed will always trigger a rerecord.
+	std::vector<float> dash {};
+	float dashOffset {}; /// distance into the dash pattern at the start
+	static constexpr auto maxDashes = 8u;
+
+	/// Pre-transform that is applied to the points while baking.
 	/// Comparison to the post-transform state via rvg::Transform:
-	/// - Every time the pre-transform changes the polygon has to be
-	///   rebaked/updated. More expensive
+	/// - Changing the pre-transform needs an update, but see
+	///   Polygon::transform for the cheap path.
 	/// - Doing scaling via the post transform has serious problems:
 	///   anti aliasing might break and for shapes (that use this
 	///   pre transform as well) curves might not be correctly tesselated.
-	/// TODO(v0.2)
-	// nytl::Mat3f transform = nytl::identity<3, float>();
+	/// The stroke width, fringe and dash lengths are not transformed.
+	nytl::Mat3f transform = nytl::identity<3, float>();
+
+	/// How the polygon is filled. Changing this will always trigger
+	/// a rerecord.
+	FillRule fillRule {FillRule::convex};
+
+	/// Only for FillRule::triangulated: the indices of the points at
+	/// which holes start (sorted). Each hole ends where the next one
+	/// starts, the outline ends at the first hole. Holes are not
+	/// supported with antialiased fills, strokes ignore them.
+	std::vector<unsigned> holes {};
 };
 
 enum class DrawType {
@@ -97,6 +209,11 @@ public:
 	/// Automatically registers this object for the next updateDevice call.
 	void update(Span<const Vec2f> points, const DrawMode&);
 
+	/// Like update but takes ownership of the points. When the polygon
+	/// is filled without antialiasing or point colors, the points are
+	/// used directly as fill vertices instead of being copied.
+	void update(std::vector<Vec2f>&& points, const DrawMode&);
+
 	/// Changes the disable state of this polygon.
 	/// Cheap way to hide/unhide the polygon, can be called at any
 	/// time and will never trigger a rerecord.
@@ -104,6 +221,27 @@ public:
 	void disable(bool, DrawType = DrawType::strokeFill);
 	bool disabled(DrawType = DrawType::strokeFill) const;
 
+	/// Returns the bounds of everything this polygon draws (including
+	/// stroke width and antialiasing) for the last update.
+	const Rect2f& bounds() const { return bounds_; }
+
+	/// Changes the stroke width (see DrawMode::stroke) without rebaking.
+	/// Only valid for the StrokeType::lines and lineList, only the
+	/// header of the draw is uploaded then. Will never trigger a rerecord.
+	/// Automatically registers this object for the next updateDevice call.
+	void strokeWidth(float);
+
+	/// Changes the pre-transform (see DrawMode::transform) without
+	/// rebaking by transforming the baked vertices. Only possible when
+	/// the change is a translation, rotation or uniform scale that moves
+	/// the stroke and antialiasing offsets by less than
+	/// ContextSettings::curveTolerance. Returns false otherwise, update
+	/// must be called with the new transform then.
+	/// Will never trigger a rerecord.
+	/// Automatically registers this object for the next updateDevice call.
+	bool transform(const nytl::Mat3f&);
+	const nytl::Mat3f& transform() const { return transform_; }
+
 	/// Records commands to fill this polygon into the given DrawInstance.
 	/// Undefined behaviour if it was updated without fill support in
 	/// the DrawMode.
@@ -114,6 +252,36 @@ public:
 	/// the DrawMode.
 	void stroke(vk::CommandBuffer) const;
 
+	/// Returns the indirect draw commands used for filling (two with
+	/// antialiasing) or stroking. Changes when a rerecord is triggered.
+	/// The indexed draw command of triangulated fills
+	/// (vk::DrawIndexedIndirectCommand) takes the space of two commands.
+	std::vector<IndirectCommand> commands(DrawType) const;
+	unsigned commandCount(DrawType type) const {
+		return type == DrawType::fill ?
+			1u + flags_.aaFill + (fillRule_ != FillRule::convex) : 1u; }
+
+	/// Like fill/stroke but uses the draw commands tightly packed at the
+	/// given offset in the given buffer instead of the own ones.
+	/// They must hold copies of the commands returned by commands() or
+	/// commands with a vertexCount of zero (e.g. for culling).
+	void fill(vk::CommandBuffer, vk::Buffer indirect,
+		vk::DeviceSize offset) const;
+	void stroke(vk::CommandBuffer, vk::Buffer indirect,
+		vk::DeviceSize offset) const;
+
+	/// Like the indirect fill/stroke above but draws with the instanced
+	/// pipelines (see ContextSettings::instancing). The per-instance
+	/// data must be bound to vertex buffer binding 3. Used by InstancedShape.
+	void fillInstanced(vk::CommandBuffer, vk::Buffer indirect,
+		vk::DeviceSize offset) const;
+	void strokeInstanced(vk::CommandBuffer, vk::Buffer indirect,
+		vk::DeviceSize offset) const;
+
+	/// Returns the vertex counts of the commands returned by commands()
+	/// as they will be written in the next updateDevice call.
+	std::vector<std::uint32_t> vertexCounts(DrawType) const;
+
 	/// Usually only automatically called from context when needed.
 	/// Uploads data to the device. Must not be called while a command
 	/// buffer drawing the Polygon is executing.
@@ -126,6 +294,14 @@ protected:
 		std::vector<Vec4u8> color;
 		vpp::SubBuffer pBuf;
 		vpp::SubBuffer cBuf;
+		std::size_t baked {}; // vertex count when baked in updateDevice
+		bool compact {}; // vertices in compact format, frame after command
+
+		std::size_t vertexCount() const { return points.size() + baked; }
+		std::size_t vertexOffset() const { // DrawIndirectCommand, frame
+			return 4 * sizeof(std::uint32_t) + compact * 4 * sizeof(float); }
+		std::size_t vertexSize() const {
+			return compact ? 2 * sizeof(std::int16_t) : sizeof(Vec2f); }
 	};
 
 	struct Stroke : public Draw {
@@ -134,18 +310,36 @@ protected:
 	};
 
 	// - internal utility -
-	bool upload(Draw&, bool disable, bool color);
-	bool upload(Stroke&, bool disable, bool color, bool aa, float* mult);
+	bool format(Draw&, bool compact);
+	bool upload(Draw&, bool disable, bool color, bool compact);
+	bool upload(Stroke&, bool disable, bool color, bool aa,
+		Span<const float> header, bool compact);
+	bool uploadIndices();
+	bool uploadBakedStroke();
+	bool uploadComputeStroke();
+	bool uploadLines();
+	bool uploadBakedFill();
 
 	void updateStroke(Span<const Vec2f>, const DrawMode&);
 	void updateFill(Span<const Vec2f>, const DrawMode&);
 
-	void stroke(vk::CommandBuffer, const Stroke&, bool aa, bool color,
-		vk::DescriptorSet, unsigned aaOff) const;
+	// aaType: the fill.frag type for the aa coords, zero without
+	void stroke(vk::CommandBuffer, const Stroke&, std::uint32_t aaType,
+		bool color, vk::DescriptorSet, unsigned aaOff, IndirectCommand = {},
+		bool instanced = false) const;
+	void fill(vk::CommandBuffer, IndirectCommand, bool instanced = false) const;
+	void strokeLines(vk::CommandBuffer, IndirectCommand) const;
 
 	bool checkResize(vpp::SubBuffer&, vk::DeviceSize needed,
 		vk::BufferUsageFlags);
 
+	// The stroke uniform in front of the aa coords (see fill.frag).
+	// Only dashed strokes use (and bind) more than the aa multiplier.
+	using StrokeHeader = std::array<float, 4 + DrawMode::maxDashes>;
+	StrokeHeader strokeHeader() const;
+	unsigned strokeHeaderSize() const;
+	std::uint32_t strokeAAType() const;
+
 protected:
 	struct {
 		bool fill : 1;
@@ -157,13 +351,36 @@ protected:
 		bool aaFill : 1;
 		bool aaStroke : 1;
 		bool deviceLocal : 1;
+		bool compact : 1;
+		bool computeStroke : 1;
+		bool lines : 1;
+		bool dash : 1;
 	} flags_ {};
 
+	Rect2f bounds_ {};
+	float pad_ {}; // by how much the bounds are larger than the points
+	nytl::Mat3f transform_ = nytl::identity<3, float>();
+	float bakedOffset_ {}; // max offset of baked vertices from the points
+	FillRule fillRule_ {FillRule::convex};
+
 	Draw fill_;
+	Draw cover_; // bounds quad for stencil fills
+	std::vector<std::uint32_t> indices_; // triangulated fills
+	vpp::SubBuffer iBuf_; // indexed draw command, indices
 	Stroke fillAA_;
 	Stroke stroke_;
 	vpp::TrDs strokeDs_;
 	float strokeMult_ {};
+
+	// DrawMode::bakeDirect/computeStroke, the points without closing point
+	std::vector<Vec2f> source_;
+	vpp::SubBuffer strokeSrc_; // computeStroke, the points, hostVisible
+	vpp::TrDs strokeCompDs_;
+	float strokeWidth_ {};
+	bool strokeLoop_ {};
+	bool linesDirty_ {}; // StrokeType::lines, segments not uploaded yet
+	std::vector<float> dash_; // DrawMode::dash, even number, <= maxDashes
+	float dashOffset_ {};
 };
 
 } // namespace rvg
@@ -0,0 +1,206 @@
+// Copyright (c) 2019 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <rvg/fwd.hpp>
+#include <rvg/shapes.hpp>
+
+#include <vpp/vk.hpp>
+#include <vpp/sharedBuffer.hpp>
+#include <vpp/trackedDescriptor.hpp>
+#include <nytl/rect.hpp>
+#include <nytl/span.hpp>
+#include <optional>
+#include <vector>
+
+namespace rvg {
+
+/// Retained list of draw commands together with the state they use.
+/// Records them in the order they were added (painter's order) but
+/// moves items with the same state next to each other where this is not
+/// visible, i.e. when they are known not to overlap. While recording, only
+/// the state that actually changes between items is bound.
+/// The scene does not own any of the referenced objects, they must stay
+/// valid (and must not be moved) as long as they are part of the scene.
+/// Adding, removing or changing items triggers a rerecord.
+/// Can also compute which regions of the framebuffer changed, allowing
+/// to only redraw those, see damage().
+class Scene {
+public:
+	/// The state an item is drawn with.
+	/// The transform and scissor may be null, the context defaults
+	/// are used then. The paint must always be set.
+	struct State {
+		const Paint* paint {};
+		const Transform* transform {};
+		const Scissor* scissor {};
+	};
+
+	using ItemID = unsigned;
+
+	/// How items outside of the viewport are skipped.
+	enum class Culling {
+		none,
+		cpu, /// not recorded, changes in visibility need a rerecord
+		gpu, /// draw commands zeroed by a compute shader, see recordCull
+	};
+
+public:
+	Scene() = default;
+	Scene(Context&);
+
+	/// Adds a fill/stroke/text draw to the end of the scene.
+	/// - bounds: Rect in local coordinates (i.e. before the transform)
+	///   that contains everything drawn by the item (including strokes and
+	///   antialiasing) as long as a command buffer recording this scene
+	///   is used. Items without bounds are never reordered. Items are
+	///   only reordered past items with the same transform.
+	ItemID fill(const Polygon&, const State&, std::optional<Rect2f> bounds = {});
+	ItemID stroke(const Polygon&, const State&, std::optional<Rect2f> bounds = {});
+	ItemID draw(const Text&, const State&, std::optional<Rect2f> bounds = {});
+
+	ItemID fill(const RectShape& s, const State& st, std::optional<Rect2f> b = {}) {
+		return fill(s.polygon(), st, b); }
+	ItemID stroke(const RectShape& s, const State& st, std::optional<Rect2f> b = {}) {
+		return stroke(s.polygon(), st, b); }
+	ItemID fill(const CircleShape& s, const State& st, std::optional<Rect2f> b = {}) {
+		return fill(s.polygon(), st, b); }
+	ItemID stroke(const CircleShape& s, const State& st, std::optional<Rect2f> b = {}) {
+		return stroke(s.polygon(), st, b); }
+	ItemID fill(const PathShape& s, const State& st, std::optional<Rect2f> b = {}) {
+		return fill(s.polygon(), st, b); }
+	ItemID stroke(const PathShape& s, const State& st, std::optional<Rect2f> b = {}) {
+		return stroke(s.polygon(), st, b); }
+
+	/// Changes the state or bounds of the given item.
+	void state(ItemID, const State&);
+	void bounds(ItemID, std::optional<Rect2f>);
+
+	/// Removes the given item. Returns false if it does not exist.
+	bool remove(ItemID);
+	void clear();
+
+	/// Records the scene into the given command buffer.
+	/// Will call Context::bindDefaults. Binds its own state, i.e. the
+	/// state bound before is not restored.
+	/// - base: transform used for items without transform instead of
+	///   the identity transform, e.g. the one of a Layer.
+	void record(vk::CommandBuffer, const Transform* base = nullptr);
+
+	/// Like record but only draws the items touching the given regions,
+	/// each with the dynamic scissor set to the region.
+	/// The render pass must preserve the previous content (loadOp load)
+	/// and the context needs ContextSettings::dynamicScissor. The
+	/// scissor is not restored afterwards.
+	/// The regions have to be cleared before drawing into them since
+	/// translucent and antialiased items would blend over their previous
+	/// output otherwise. When clear is given, they are cleared with it
+	/// (color attachment 0 of the subpass), otherwise the caller must
+	/// clear them (e.g. with vkCmdClearAttachments) before.
+	void record(vk::CommandBuffer, nytl::Span<const vk::Rect2D> regions,
+		std::optional<vk::ClearColorValue> clear = {});
+
+	/// Returns the regions (in framebuffer coordinates of the given
+	/// viewport) that changed since the last call, due to
+	/// changed items or changed objects used by them (see
+	/// Context::updatedObjects). Must therefore be called once after
+	/// every Context::updateDevice. The first call damages all items.
+	/// The bounds given for items (or the bounds of the drawn objects
+	/// if there are none) are used. Overlapping regions are merged and
+	/// the number of regions limited (by merging), so they can directly
+	/// be used e.g. for VK_KHR_incremental_present.
+	/// When presenting images that don't have the previous frame's content
+	/// (e.g. multiple swapchain images), the damage of the last frames
+	/// that the image missed has to be combined.
+	std::vector<vk::Rect2D> damage(const vk::Viewport&);
+
+	/// Sets the culling method. Items are culled by their bounds (or the
+	/// bounds of their objects, see damage) against the viewport.
+	/// Items without transform are assumed to use the identity, i.e.
+	/// culling can't be used when recording with a base transform.
+	/// Triggers a rerecord.
+	void culling(Culling);
+	Culling culling() const { return culling_; }
+
+	/// Must be called every frame before Context::updateDevice when
+	/// culling is used, i.e. after objects and transforms were changed.
+	/// With Culling::cpu computes which items are visible and triggers
+	/// a rerecord if that changed. With Culling::gpu writes the item
+	/// data for the compute shader, triggering a rerecord only if the
+	/// buffers had to be reallocated.
+	/// Returns whether a rerecord was triggered.
+	bool updateCulling();
+
+	/// Only for Culling::gpu: records the copy of all draw commands and
+	/// the culling compute shader into the given command buffer.
+	/// Must be recorded outside of a render pass before the command
+	/// buffer (or submission) executing the recorded scene.
+	void recordCull(vk::CommandBuffer);
+
+	/// Returns whether any object used by an item was updated in the
+	/// last Context::updateDevice call.
+	bool updated() const;
+
+	/// Increased every time an item is added, removed or changed.
+	unsigned version() const { return version_; }
+
+	std::size_t size() const { return items_.size(); }
+	Context& context() const { return *context_; }
+
+protected:
+	enum class Type {
+		fill,
+		stroke,
+		text,
+	};
+
+	struct Item {
+		ItemID id;
+		Type type;
+		const void* object; // Polygon or Text
+		State state;
+		std::optional<Rect2f> bounds;
+
+		// framebuffer area drawn at the last damage call, none when
+		// outside the viewport
+		std::optional<Rect2f> drawn {};
+		bool damaged {}; // whether it was part of a damage call
+		bool dirty {true};
+
+		bool visible {true}; // Culling::cpu
+		unsigned command {}; // Culling::gpu, first draw command
+	};
+
+	ItemID add(Type, const void*, const State&, std::optional<Rect2f>);
+	Item* find(ItemID);
+	void sort();
+	void recordItem(vk::CommandBuffer, const Item&);
+	std::optional<Rect2f> drawRect(const Item&, const vk::Viewport&) const;
+	std::optional<Rect2f> localBounds(const Item&) const;
+	bool visible(const Item&) const;
+	std::vector<IndirectCommand> commands(const Item&) const;
+
+	Context* context_ {};
+	std::vector<Item> items_;
+	std::vector<const Item*> order_; // recording order
+	std::vector<Rect2f> damage_; // pending, e.g. from removed items
+	ItemID nextID_ {1u};
+	unsigned version_ {};
+	const Transform* base_ {}; // while recording
+
+	Culling culling_ {Culling::none};
+	vpp::SubBuffer cullItems_; // hostVisible, gpu culling input
+	vpp::SubBuffer cullCommands_; // draw commands, culled in place
+	vpp::TrDs cullDs_;
+
+	// what is currently bound while recording
+	struct {
+		const Paint* paint;
+		const Transform* transform;
+		const Scissor* scissor;
+	} bound_ {};
+};
+
+} // namespace rvg
@@ -14,6 +14,9 @@
 #include <vpp/descriptor.hpp>
 #include <vpp/sharedBuffer.hpp>
 
+#include <variant>
+#include <vector>
+
 namespace rvg {
 
 /// Shape manually specified by its outlining points.
@@ -38,6 +41,11 @@ public:
 	const auto& polygon() const { return polygon_; }
 	void update();
 
+	/// Changes the pre-transform (see DrawMode::transform). Only
+	/// transforms the baked vertices when possible (see
+	/// Polygon::transform), updates the shape otherwise.
+	void transform(const nytl::Mat3f&);
+
 protected:
 	struct State {
 		std::vector<Vec2f> points;
@@ -71,6 +79,18 @@ public:
 	const auto& polygon() const { return polygon_; }
 	Rect2f bounds() const { return {position(), size()}; }
 
+	/// Sets the scale of the shape on screen in pixels per unit, e.g.
+	/// the scale of the transform it is drawn with. Curves are flattened
+	/// with ContextSettings::curveTolerance at this scale. Only tessellates
+	/// the shape again when the scale crosses a power of two.
+	void scale(float);
+	float scale() const { return scale_; }
+
+	/// Changes the pre-transform, see Shape::transform. Curves are
+	/// flattened at the scale times the scale of the pre-transform,
+	/// so changing its level of detail updates the shape as well.
+	void transform(const nytl::Mat3f&);
+
 	void update();
 
 protected:
@@ -79,11 +99,9 @@ protected:
 		Vec2f size {};
 		DrawMode drawMode {};
 		std::array<float, 4> rounding {};
-
-		/// TODO(v0.2): does not work correctly atm
-		nytl::Mat3f transform = nytl::identity<3, float>();
 	} state_;
 
+	float scale_ {1.f};
 	Polygon polygon_;
 };
 
@@ -91,7 +109,7 @@ protected:
 class CircleShape {
 public:
 	/// When this is passed, will automatically choose the number
-	/// of points in the circle polygon.
+	/// of points in the circle polygon from its radius and scale.
 	static constexpr unsigned defaultPointCount = 0u;
 
 public:
@@ -117,6 +135,19 @@ public:
 	const auto& pointCount() const { return state_.pointCount; }
 	const auto& startAngle() const { return state_.startAngle; }
 	const auto& polygon() const { return polygon_; }
+
+	/// Sets the scale of the shape on screen in pixels per unit, e.g.
+	/// the scale of the transform it is drawn with. Curves are flattened
+	/// with ContextSettings::curveTolerance at this scale. Only tessellates
+	/// the shape again when the scale crosses a power of two.
+	void scale(float);
+	float scale() const { return scale_; }
+
+	/// Changes the pre-transform, see Shape::transform. Curves are
+	/// flattened at the scale times the scale of the pre-transform,
+	/// so changing its level of detail updates the shape as well.
+	void transform(const nytl::Mat3f&);
+
 	void update();
 
 protected:
@@ -126,11 +157,109 @@ protected:
 		DrawMode drawMode {};
 		unsigned pointCount {defaultPointCount};
 		float startAngle {0.f};
+	} state_;
+
+	float scale_ {1.f};
+	Polygon polygon_;
+};
+
+/// Shape built from lines, bezier curves and arcs.
+/// Curves are flattened in update with ContextSettings::curveTolerance
+/// at the given scale, directly into the points used by the polygon.
+/// Can consist of multiple subpaths (started with moveTo). They are
+/// filled as one polygon, which needs a FillRule other than convex:
+/// with FillRule::triangulated, the first subpath is the outline and
+/// all others are holes in it. Stencil fills (nonZero, evenOdd) close
+/// every subpath and fill them together by their rule, i.e. they also
+/// work for disjoint outlines. Strokes only support a single subpath,
+/// others would be connected by the stroke.
+/// Point colors (DrawMode::color) are not supported.
+class PathShape {
+public:
+	/// Starts a new subpath at the given point.
+	struct Move {
+		Vec2f to;
+	};
+
+	struct Line {
+		Vec2f to;
+	};
+
+	struct Quad {
+		Vec2f control;
+		Vec2f to;
+	};
+
+	struct Cubic {
+		Vec2f control1;
+		Vec2f control2;
+		Vec2f to;
+	};
+
+	/// Elliptical arc to the given point, like the svg arc command.
+	struct Arc {
+		Vec2f radius;
+		float rotation {}; /// of the ellipse's x axis, in radians
+		bool largeArc {}; /// whether the longer of the possible arcs is used
+		bool sweep {}; /// whether the arc is drawn in positive angle direction
+		Vec2f to;
+	};
+
+	using Command = std::variant<Move, Line, Quad, Cubic, Arc>;
+
+public:
+	PathShape() = default;
+	PathShape(Context& ctx) : polygon_(ctx) {}
+	PathShape(Context&, const DrawMode&);
 
-		/// TODO(v0.2): does not work correctly atm
-		nytl::Mat3f transform = nytl::identity<3, float>();
+	auto change() { return StateChange {*this, state_}; }
+
+	/// Changes the path. Only records the command, update (or change)
+	/// has to be called for the polygon to be updated.
+	/// The first moveTo sets the start of the path, all following ones
+	/// start a new subpath. close adds a line to the start of the
+	/// current subpath. clear discards all commands.
+	void moveTo(Vec2f);
+	void lineTo(Vec2f);
+	void quadTo(Vec2f control, Vec2f to);
+	void cubicTo(Vec2f control1, Vec2f control2, Vec2f to);
+	void arcTo(Vec2f radius, float rotation, bool largeArc, bool sweep,
+		Vec2f to);
+	void close();
+	void clear();
+
+	void fill(vk::CommandBuffer cb) const { polygon_.fill(cb); }
+	void stroke(vk::CommandBuffer cb) const { polygon_.stroke(cb); }
+
+	auto& context() const { return polygon_.context(); }
+	void disable(bool d, DrawType t = DrawType::strokeFill);
+	bool disabled(DrawType t = DrawType::strokeFill) const;
+
+	const auto& start() const { return state_.start; }
+	const auto& commands() const { return state_.commands; }
+	const auto& drawMode() const { return state_.drawMode; }
+	const auto& polygon() const { return polygon_; }
+	Rect2f bounds() const { return polygon_.bounds(); }
+
+	/// Sets the scale of the shape on screen in pixels per unit, see
+	/// RectShape::scale.
+	void scale(float);
+	float scale() const { return scale_; }
+
+	/// Changes the pre-transform, see RectShape::transform.
+	void transform(const nytl::Mat3f&);
+
+	void update();
+
+protected:
+	struct {
+		Vec2f start {};
+		std::vector<Command> commands {};
+		DrawMode drawMode {};
 	} state_;
 
+	float scale_ {1.f};
+	unsigned pointCount_ {}; // of the last update
 	Polygon polygon_;
 };
 
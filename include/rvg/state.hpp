@@ -7,12 +7,11 @@
 #include <rvg/fwd.hpp>
 #include <rvg/deviceObject.hpp>
 #include <rvg/stateChange.hpp>
+#include <rvg/uniformArena.hpp>
 
 #include <nytl/rect.hpp>
 #include <nytl/mat.hpp>
 
-#include <vpp/trackedDescriptor.hpp>
-#include <vpp/sharedBuffer.hpp>
 
 namespace rvg {
 
@@ -23,6 +22,9 @@ namespace rvg {
 /// but more expensive to update - or otherwise on hostVisibile memory which
 /// should be used for frequently updating transforms.
 class Transform : public DeviceObject {
+public:
+	static constexpr auto uboSize = sizeof(Mat4f);
+
 public:
 	Transform() = default;
 	Transform(Context& ctx, bool deviceLocal = true); // uses identity matrix
@@ -31,22 +33,31 @@ public:
 	/// Binds the transform in the given command buffer.
 	/// All following stroke/fill calls are affected by this transform object,
 	/// until another transform is bound.
+	/// With ContextSettings::pushState, this will record the matrix
+	/// as push constant instead.
 	void bind(vk::CommandBuffer) const;
 
 	auto change() { return StateChange {*this, matrix_}; }
 	auto& matrix() const { return matrix_; }
+
+	/// Signals that the matrix was recorded into a command buffer,
+	/// i.e. that changing it requires a rerecord.
+	void markRecorded() const { recorded_ = true; }
 	void matrix(const Mat4f& matrix) { *change() = matrix; }
 
-	auto& ubo() const { return ubo_; }
-	auto& ds() const { return ds_; }
+	/// The uniform buffer range and the descriptor set (which must be
+	/// bound with dsOffset() as dynamic offset) of this transform.
+	auto ubo() const { return slot_.span(); }
+	auto ds() const { return slot_.ds(); }
+	auto dsOffset() const { return slot_.offset(); }
 
 	void update();
 	bool updateDevice();
 
 protected:
 	Mat4f matrix_;
-	vpp::SubBuffer ubo_;
-	vpp::TrDs ds_;
+	UniformSlot slot_; // not used with push state
+	mutable bool recorded_ {}; // whether recorded since update
 };
 
 /// Limits the area in which can be drawn.
@@ -58,6 +69,7 @@ protected:
 class Scissor : public DeviceObject {
 public:
 	static constexpr Rect2f reset = {{-1e6, -1e6}, {2e6, 2e6}};
+	static constexpr auto uboSize = sizeof(Vec2f) * 2;
 
 public:
 	Scissor() = default;
@@ -66,21 +78,40 @@ public:
 	/// Binds the scissor in the given DrawInstance.
 	/// All following stroke/fill calls are affected by this scissor object,
 	/// until another scissor is bound.
+	/// With ContextSettings::pushState, this will record the rect
+	/// as push constant instead.
 	void bind(vk::CommandBuffer) const;
 
+	/// Like bind but tries to apply the scissor via the dynamic hardware
+	/// scissor of the command buffer. Only possible if the context was
+	/// created with ContextSettings::dynamicScissor and the given
+	/// transform (which should be the one used for drawing) is axis-aligned.
+	/// The hardware scissor is computed from the current rect and
+	/// transform, so changing either of them will trigger a rerecord.
+	/// Since it is applied in framebuffer space, binding another transform
+	/// afterwards does not affect the scissor.
+	/// Falls back to bind(vk::CommandBuffer) otherwise. Returns whether
+	/// the hardware scissor was used.
+	/// The viewport must be the one set in the command buffer.
+	bool bind(vk::CommandBuffer, const Transform&, const vk::Viewport&) const;
+
 	auto change() { return StateChange {*this, rect_}; }
 	void rect(const Rect2f& rect) { *change() = rect; }
 	auto& rect() const { return rect_; }
 
-	auto& ubo() const { return ubo_; }
-	auto& ds() const { return ds_; }
+	/// The uniform buffer range and the descriptor set (which must be
+	/// bound with dsOffset() as dynamic offset) of this scissor.
+	auto ubo() const { return slot_.span(); }
+	auto ds() const { return slot_.ds(); }
+	auto dsOffset() const { return slot_.offset(); }
+
 	void update();
 	bool updateDevice();
 
 protected:
 	Rect2f rect_ = reset;
-	vpp::SubBuffer ubo_;
-	vpp::TrDs ds_;
+	UniformSlot slot_; // not used with push state
+	mutable bool recorded_ {}; // whether recorded since update
 };
 
 } // namespace rvg
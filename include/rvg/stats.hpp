@@ -0,0 +1,105 @@
+// Copyright (c) 2019 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <rvg/fwd.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace rvg {
+
+/// The types of device objects, in the order of Context::DevRes.
+enum class ObjectType {
+	polygon,
+	text,
+	paint,
+	texture,
+	transform,
+	scissor,
+	fontAtlas,
+	instancedShape,
+	count
+};
+
+/// Why a rerecord was triggered.
+enum class RerecordReason {
+	user, /// Context::rerecord was called
+	realloc, /// a buffer had to be reallocated
+	drawMode, /// a change that requires other draw commands or pipelines
+	descriptor, /// a descriptor set changed (e.g. a new texture)
+	recorded, /// data recorded into command buffers changed (push constants)
+	other, /// the object requested it in updateDevice
+};
+
+/// GPU time of all profiling regions with the same label.
+struct GpuRegionTime {
+	std::string label;
+	std::chrono::duration<double, std::milli> time {};
+	unsigned count {}; /// how many regions contributed
+};
+
+struct RerecordCause {
+	/// The object that triggered it or nullptr for RerecordReason::user
+	/// and reallocated shared resources of the context.
+	/// Only meant for identification, the object might have been
+	/// moved or destroyed since then.
+	const DeviceObject* object {};
+	RerecordReason reason {};
+};
+
+/// Counters for the work done by a Context in one frame.
+/// A frame ends with Context::stageUpload.
+struct FrameStats {
+	using Clock = std::chrono::steady_clock;
+	using Duration = Clock::duration;
+
+	/// Number of dirty objects updated in Context::updateDevice,
+	/// indexed by ObjectType.
+	std::array<unsigned, unsigned(ObjectType::count)> updated {};
+
+	std::size_t hostBytes {}; /// written to hostVisible memory
+	std::size_t stagedBytes {}; /// written to staging buffers
+	unsigned uploadCmdBufs {}; /// secondary upload command buffers
+	unsigned stagingBuffers {};
+	unsigned reallocations {}; /// vertex/index buffers reallocated
+
+	std::vector<RerecordCause> rerecords;
+
+	unsigned atlasUploads {}; /// font atlas texture uploads
+	unsigned glyphsRasterized {};
+
+	/// CPU time spent in the different phases.
+	struct {
+		Duration bake {}; /// Polygon::update, Text::update
+		Duration updateDevice {}; /// Context::updateDevice without flushing
+		Duration flush {}; /// flushing non-coherent memory
+		Duration stageUpload {};
+	} time;
+
+	/// Only with ContextSettings::gpuProfiling: the GPU times of the regions
+	/// (see Context::beginRegion) and uploads executed in the previous
+	/// frame. Resolved without waiting, i.e. regions whose results
+	/// were not yet available are missing.
+	std::vector<GpuRegionTime> gpu;
+
+	unsigned updatedCount(ObjectType type) const {
+		return updated[unsigned(type)];
+	}
+};
+
+/// Optional callbacks for external tracing tools.
+/// Called at the beginning and end of each of the zones measured
+/// in FrameStats::time. Zones might be nested.
+struct TraceHooks {
+	void (*begin)(void* data, const char* zone) {};
+	void (*end)(void* data, const char* zone) {};
+	void* data {};
+};
+
+} // namespace rvg
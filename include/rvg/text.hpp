@@ -36,6 +36,17 @@ public:
 	/// scissor, paint).
 	void draw(vk::CommandBuffer) const;
 
+	/// Returns the indexed indirect draw command used for drawing
+	/// (vk::DrawIndexedIndirectCommand, takes the space of two
+	/// vk::DrawIndirectCommand). Changes when a rerecord is triggered.
+	IndirectCommand command() const;
+
+	/// Like draw but uses the draw command at the given offset in the
+	/// given buffer. Must be a copy of command() or have an indexCount of
+	/// zero (e.g. for culling).
+	void draw(vk::CommandBuffer, vk::Buffer indirect,
+		vk::DeviceSize offset) const;
+
 	auto change() { return StateChange {*this, state_}; }
 	bool disable(bool);
 	bool disabled() const { return disable_; }
@@ -56,6 +67,11 @@ public:
 	/// Returns the (local) bounds of the full text
 	Rect2f bounds() const;
 
+	/// Returns the bounds of the drawn glyph quads, in the coordinate
+	/// space the text is drawn in (i.e. including position).
+	/// Computed in update.
+	const Rect2f& drawBounds() const { return drawBounds_; }
+
 	/// Returns the bounds of the ith char in local coordinates.
 	Rect2f ithBounds(unsigned n) const;
 
@@ -81,6 +97,7 @@ protected:
 	bool disable_ {};
 	bool deviceLocal_ {false};
 
+	Rect2f drawBounds_ {};
 	std::vector<Vec2f> posCache_;
 	std::vector<Vec2f> uvCache_;
 	vpp::SubBuffer posBuf_;
@@ -0,0 +1,100 @@
+// Copyright (c) 2019 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <rvg/fwd.hpp>
+#include <vpp/trackedDescriptor.hpp>
+#include <vpp/sharedBuffer.hpp>
+#include <nytl/nonCopyable.hpp>
+
+#include <deque>
+#include <vector>
+#include <cstdint>
+
+namespace rvg {
+
+class UniformArena;
+
+/// Fixed-size range in a UniformArena.
+/// Returns itself to the arena on destruction.
+class UniformSlot {
+public:
+	UniformSlot() = default;
+	~UniformSlot();
+
+	UniformSlot(UniformSlot&& rhs) noexcept;
+	UniformSlot& operator=(UniformSlot&& rhs) noexcept;
+
+	bool valid() const { return arena_; }
+
+	/// The buffer range of this slot.
+	vpp::BufferSpan span() const;
+
+	/// The descriptor set of the block this slot was allocated from.
+	/// Binding 0 is the dynamic uniform buffer, must be bound with offset().
+	vk::DescriptorSet ds() const;
+
+	/// The dynamic offset of this slot in the descriptor.
+	std::uint32_t offset() const;
+
+	/// The buffer of the block this slot was allocated from.
+	/// The descriptor range in ds() starts at its offset.
+	const vpp::SubBuffer& blockBuffer() const;
+
+protected:
+	friend class UniformArena;
+	UniformArena* arena_ {};
+	unsigned block_ {};
+	unsigned slot_ {};
+};
+
+/// Suballocates small uniform buffers of a fixed size from larger blocks.
+/// Every block has one descriptor set with a dynamic uniform buffer at
+/// binding 0 so that objects allocated from the same block don't need
+/// separate descriptor sets, they only bind the block's set with
+/// their own dynamic offset.
+/// Used by Context for all Transform, Scissor and Paint objects.
+class UniformArena : public nytl::NonMovable {
+public:
+	/// The number of slots in each block.
+	static constexpr auto blockSlots = 256u;
+
+public:
+	UniformArena() = default;
+
+	/// - layout: The descriptor set layout for the block descriptors.
+	///   Binding 0 must be a dynamic uniform buffer.
+	/// - size: The size of one slot (i.e. of the uniform data).
+	/// - deviceLocal: Whether to allocate the blocks on deviceLocal memory.
+	/// - image: If not empty, binding 1 of the block descriptors
+	///   is written as combined image sampler with this image view.
+	void init(Context&, const vpp::TrDsLayout& layout, vk::DeviceSize size,
+		bool deviceLocal, vk::ImageView image = {});
+
+	UniformSlot allocate();
+	void free(UniformSlot&) noexcept;
+
+	auto size() const { return size_; }
+	auto stride() const { return stride_; }
+	bool deviceLocal() const { return deviceLocal_; }
+
+protected:
+	friend class UniformSlot;
+	struct Block {
+		vpp::SubBuffer buffer;
+		vpp::TrDs ds;
+		std::vector<unsigned> free;
+	};
+
+	Context* context_ {};
+	const vpp::TrDsLayout* layout_ {};
+	vk::ImageView image_ {};
+	vk::DeviceSize size_ {};
+	vk::DeviceSize stride_ {};
+	bool deviceLocal_ {};
+	std::deque<Block> blocks_; // deque for reference stability
+};
+
+} // namespace rvg
@@ -0,0 +1,460 @@
+// Copyright (c) 2019 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include "bake.hpp"
+#include <nytl/vecOps.hpp>
+#include <dlg/dlg.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+		(defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define RVG_BAKE_SSE
+	#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	#define RVG_BAKE_NEON
+	#include <arm_neon.h>
+#endif
+
+namespace rvg {
+namespace {
+
+// The miter joins are limited to miterLimit times the half width.
+// For unit normals n0, n1 the join offset is m / dot(m, n1) with
+// m = n0 + n1, its length is sqrt(2 / dot(m, n1)).
+constexpr auto miterLimit = 4.f;
+constexpr auto minJoinDot = 2.f / (miterLimit * miterLimit);
+
+// Two points or vectors (x0, y0, x1, y1).
+#if defined(RVG_BAKE_SSE)
+
+struct F4 {
+	__m128 v;
+
+	static F4 load(const float* p) { return {_mm_loadu_ps(p)}; }
+	static F4 splat(float a) { return {_mm_set1_ps(a)}; }
+	static F4 set(float a, float b, float c, float d) {
+		return {_mm_setr_ps(a, b, c, d)}; }
+	void store(float* p) const { _mm_storeu_ps(p, v); }
+};
+
+F4 operator+(F4 a, F4 b) { return {_mm_add_ps(a.v, b.v)}; }
+F4 operator-(F4 a, F4 b) { return {_mm_sub_ps(a.v, b.v)}; }
+F4 operator*(F4 a, F4 b) { return {_mm_mul_ps(a.v, b.v)}; }
+F4 operator/(F4 a, F4 b) { return {_mm_div_ps(a.v, b.v)}; }
+F4 max4(F4 a, F4 b) { return {_mm_max_ps(a.v, b.v)}; }
+F4 sqrt4(F4 a) { return {_mm_sqrt_ps(a.v)}; }
+
+// (a1, a0, a3, a2)
+F4 swapPairs(F4 a) {
+	return {_mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(2, 3, 0, 1))}; }
+
+// (a0, a1, b0, b1) and (a2, a3, b2, b3)
+F4 lowHalves(F4 a, F4 b) { return {_mm_movelh_ps(a.v, b.v)}; }
+F4 highHalves(F4 a, F4 b) { return {_mm_movehl_ps(b.v, a.v)}; }
+
+// 1 where a > 0, 0 otherwise
+F4 positive(F4 a) {
+	auto mask = _mm_cmpgt_ps(a.v, _mm_setzero_ps());
+	return {_mm_and_ps(mask, _mm_set1_ps(1.f))};
+}
+
+#elif defined(RVG_BAKE_NEON)
+
+struct F4 {
+	float32x4_t v;
+
+	static F4 load(const float* p) { return {vld1q_f32(p)}; }
+	static F4 splat(float a) { return {vdupq_n_f32(a)}; }
+	static F4 set(float a, float b, float c, float d) {
+		const float data[4] = {a, b, c, d};
+		return {vld1q_f32(data)};
+	}
+	void store(float* p) const { vst1q_f32(p, v); }
+};
+
+F4 operator+(F4 a, F4 b) { return {vaddq_f32(a.v, b.v)}; }
+F4 operator-(F4 a, F4 b) { return {vsubq_f32(a.v, b.v)}; }
+F4 operator*(F4 a, F4 b) { return {vmulq_f32(a.v, b.v)}; }
+F4 operator/(F4 a, F4 b) { return {vdivq_f32(a.v, b.v)}; }
+F4 max4(F4 a, F4 b) { return {vmaxq_f32(a.v, b.v)}; }
+F4 sqrt4(F4 a) { return {vsqrtq_f32(a.v)}; }
+F4 swapPairs(F4 a) { return {vrev64q_f32(a.v)}; }
+
+F4 lowHalves(F4 a, F4 b) {
+	return {vcombine_f32(vget_low_f32(a.v), vget_low_f32(b.v))}; }
+F4 highHalves(F4 a, F4 b) {
+	return {vcombine_f32(vget_high_f32(a.v), vget_high_f32(b.v))}; }
+
+F4 positive(F4 a) {
+	auto mask = vcgtq_f32(a.v, vdupq_n_f32(0.f));
+	auto one = vreinterpretq_u32_f32(vdupq_n_f32(1.f));
+	return {vreinterpretq_f32_u32(vandq_u32(mask, one))};
+}
+
+#else // scalar
+
+struct F4 {
+	float v[4];
+
+	static F4 load(const float* p) { return {{p[0], p[1], p[2], p[3]}}; }
+	static F4 splat(float a) { return {{a, a, a, a}}; }
+	static F4 set(float a, float b, float c, float d) {
+		return {{a, b, c, d}}; }
+	void store(float* p) const {
+		p[0] = v[0]; p[1] = v[1]; p[2] = v[2]; p[3] = v[3]; }
+};
+
+template<typename F>
+F4 apply(F4 a, F4 b, F&& f) {
+	return {{f(a.v[0], b.v[0]), f(a.v[1], b.v[1]),
+		f(a.v[2], b.v[2]), f(a.v[3], b.v[3])}};
+}
+
+F4 operator+(F4 a, F4 b) { return apply(a, b, [](float x, float y){ return x + y; }); }
+F4 operator-(F4 a, F4 b) { return apply(a, b, [](float x, float y){ return x - y; }); }
+F4 operator*(F4 a, F4 b) { return apply(a, b, [](float x, float y){ return x * y; }); }
+F4 operator/(F4 a, F4 b) { return apply(a, b, [](float x, float y){ return x / y; }); }
+F4 max4(F4 a, F4 b) { return apply(a, b, [](float x, float y){ return x > y ? x : y; }); }
+F4 sqrt4(F4 a) { return apply(a, a, [](float x, float){ return std::sqrt(x); }); }
+F4 positive(F4 a) { return apply(a, a, [](float x, float){ return x > 0.f ? 1.f : 0.f; }); }
+F4 swapPairs(F4 a) { return {{a.v[1], a.v[0], a.v[3], a.v[2]}}; }
+F4 lowHalves(F4 a, F4 b) { return {{a.v[0], a.v[1], b.v[0], b.v[1]}}; }
+F4 highHalves(F4 a, F4 b) { return {{a.v[2], a.v[3], b.v[2], b.v[3]}}; }
+
+#endif
+
+F4 pairSum(F4 a) {
+	return a + swapPairs(a);
+}
+
+// Vec2f arrays as tightly packed floats
+const float* floats(const Vec2f* points) {
+	return reinterpret_cast<const float*>(points);
+}
+
+float* floats(Vec2f* points) {
+	return reinterpret_cast<float*>(points);
+}
+
+// Normals (rotated left) of the segments between the points, the last
+// one is the closing segment for loops. Normals of segments with
+// zero length are copied from the previous (or next) segment.
+void segmentNormals(Span<const Vec2f> points, bool loop,
+		std::vector<Vec2f>& normals) {
+	auto n = points.size();
+	normals.resize(n - 1 + loop);
+
+	auto* p = floats(points.data());
+	auto* out = floats(normals.data());
+	auto sign = F4::set(-1.f, 1.f, -1.f, 1.f);
+	auto one = F4::splat(1.f);
+	auto tiny = F4::splat(1e-30f);
+	auto degenerate = F4::splat(0.f);
+
+	auto k = std::size_t(0);
+	for(; k + 2 < n; k += 2) {
+		auto d = F4::load(p + 2 * k + 2) - F4::load(p + 2 * k);
+		auto len2 = pairSum(d * d);
+		auto valid = positive(len2);
+		auto inv = one / sqrt4(max4(len2, tiny));
+		(swapPairs(d) * sign * inv * valid).store(out + 2 * k);
+		degenerate = degenerate + (one - valid);
+	}
+
+	auto segment = [&](Vec2f a, Vec2f b, Vec2f& normal) {
+		auto d = b - a;
+		auto len2 = d.x * d.x + d.y * d.y;
+		normal = len2 > 0.f ?
+			(1.f / std::sqrt(len2)) * Vec2f {-d.y, d.x} :
+			Vec2f {0.f, 0.f};
+		return len2 > 0.f;
+	};
+
+	auto valid = true;
+	for(; k + 1 < n; ++k) {
+		valid &= segment(points[k], points[k + 1], normals[k]);
+	}
+
+	if(loop) {
+		valid &= segment(points[n - 1], points[0], normals[n - 1]);
+	}
+
+	float counts[4];
+	degenerate.store(counts);
+	if(valid && counts[0] + counts[2] == 0.f) {
+		return;
+	}
+
+	// fix zero length segments
+	auto zero = [](Vec2f v) { return v.x == 0.f && v.y == 0.f; };
+	auto first = std::size_t(0);
+	while(first < normals.size() && zero(normals[first])) {
+		++first;
+	}
+
+	if(first == normals.size()) {
+		return; // all points are the same
+	}
+
+	for(auto i = std::size_t(0); i < normals.size(); ++i) {
+		if(zero(normals[i])) {
+			normals[i] = i < first ? normals[first] : normals[i - 1];
+		}
+	}
+}
+
+// Join offset for the given normals, scaled to a half width of 1.
+Vec2f join(Vec2f n0, Vec2f n1) {
+	auto m = n0 + n1;
+	auto d = std::max(m.x * n1.x + m.y * n1.y, minJoinDot);
+	return (1.f / d) * m;
+}
+
+// Calls the writer for the join offsets (for a half width of 1) of
+// all points, for two points at once where possible.
+// The writer must have a method pair(index, points, offsets) for two
+// points with F4 data and one(index, point, offset).
+template<typename W>
+void joins(Span<const Vec2f> points, bool loop,
+		const std::vector<Vec2f>& normals, W& writer) {
+	auto n = points.size();
+	auto last = n - 1;
+
+	// first point
+	writer.one(0, points[0], loop ?
+		join(normals[last], normals[0]) :
+		normals[0]);
+
+	// inner points, point i joins segments i - 1 and i
+	// For open strokes the last point has no segment i.
+	auto end = loop ? n : last;
+	auto* p = floats(points.data());
+	auto* nrm = floats(normals.data());
+	auto minDot = F4::splat(minJoinDot);
+
+	auto i = std::size_t(1);
+	for(; i + 1 < end; i += 2) {
+		auto n0 = F4::load(nrm + 2 * (i - 1));
+		auto n1 = F4::load(nrm + 2 * i);
+		auto m = n0 + n1;
+		auto d = max4(pairSum(m * n1), minDot);
+		writer.pair(i, F4::load(p + 2 * i), m / d);
+	}
+
+	for(; i < end; ++i) {
+		writer.one(i, points[i], join(normals[i - 1], normals[i]));
+	}
+
+	if(!loop && n > 1) {
+		writer.one(last, points[last], normals[last - 1]);
+	}
+}
+
+// scratch memory for the normals
+thread_local std::vector<Vec2f> normalsCache;
+
+constexpr auto snormMax = 32767.f;
+
+// Rounds the given value (already scaled) to the nearest snorm16 value.
+std::int16_t snorm(float v) {
+	return std::int16_t(std::lround(std::clamp(v, -snormMax, snormMax)));
+}
+
+} // anon namespace
+
+std::size_t strokeVertexCount(std::size_t points, bool loop) {
+	return points < 2 ? 0u : 2 * points + 2 * loop;
+}
+
+void bakeStroke(Span<const Vec2f> points, float width, bool loop,
+		Span<Vec2f> out, Span<Vec2f> aa) {
+	auto count = strokeVertexCount(points.size(), loop);
+	dlg_assert(out.size() == count);
+	dlg_assert(aa.empty() || aa.size() == count);
+	if(count == 0) {
+		return;
+	}
+
+	struct {
+		float* out;
+		float* aa;
+		float hw;
+
+		void pair(std::size_t i, F4 p, F4 off) {
+			auto scaled = off * F4::splat(hw);
+			auto a = p + scaled;
+			auto b = p - scaled;
+			lowHalves(a, b).store(out + 4 * i);
+			highHalves(a, b).store(out + 4 * i + 4);
+			if(aa) {
+				auto coords = F4::set(1.f, -1.f, 1.f, 1.f);
+				coords.store(aa + 4 * i);
+				coords.store(aa + 4 * i + 4);
+			}
+		}
+
+		void one(std::size_t i, Vec2f p, Vec2f off) {
+			auto a = p + hw * off;
+			auto b = p - hw * off;
+			const float data[4] = {a.x, a.y, b.x, b.y};
+			std::copy(data, data + 4, out + 4 * i);
+			if(aa) {
+				const float coords[4] = {1.f, -1.f, 1.f, 1.f};
+				std::copy(coords, coords + 4, aa + 4 * i);
+			}
+		}
+	} writer {floats(out.data()), aa.empty() ? nullptr : floats(aa.data()), 0.5f * width};
+
+	segmentNormals(points, loop, normalsCache);
+	joins(points, loop, normalsCache, writer);
+
+	if(loop) {
+		auto n = points.size();
+		out[2 * n] = out[0];
+		out[2 * n + 1] = out[1];
+		if(!aa.empty()) {
+			aa[2 * n] = aa[0];
+			aa[2 * n + 1] = aa[1];
+		}
+	}
+}
+
+std::size_t fillAAVertexCount(std::size_t points) {
+	return points < 2 ? 0u : points;
+}
+
+std::size_t fringeVertexCount(std::size_t points) {
+	return strokeVertexCount(points, true);
+}
+
+void bakeFillAA(Span<const Vec2f> points, float fringe, Span<Vec2f> fill,
+		Span<Vec2f> fringeOut, Span<Vec2f> aa) {
+	dlg_assert(fill.size() == fillAAVertexCount(points.size()));
+	dlg_assert(fringeOut.size() == fringeVertexCount(points.size()));
+	dlg_assert(aa.size() == fringeOut.size());
+	if(fill.empty()) {
+		return;
+	}
+
+	// the normals point to the left, i.e. outwards for clockwise
+	// polygons (in a y-up coordinate system)
+	auto area = 0.f;
+	for(auto i = 0u; i < points.size(); ++i) {
+		auto& a = points[i];
+		auto& b = points[(i + 1) % points.size()];
+		area += a.x * b.y - b.x * a.y;
+	}
+
+	struct {
+		float* fill;
+		float* fringe;
+		float* aa;
+		float hf;
+
+		void pair(std::size_t i, F4 p, F4 off) {
+			auto scaled = off * F4::splat(hf);
+			auto outer = p + scaled;
+			auto inner = p - scaled;
+			inner.store(fill + 2 * i);
+			lowHalves(outer, inner).store(fringe + 4 * i);
+			highHalves(outer, inner).store(fringe + 4 * i + 4);
+
+			auto coords = F4::set(1.f, 1.f, 1.f, 0.f);
+			coords.store(aa + 4 * i);
+			coords.store(aa + 4 * i + 4);
+		}
+
+		void one(std::size_t i, Vec2f p, Vec2f off) {
+			auto outer = p + hf * off;
+			auto inner = p - hf * off;
+			fill[2 * i] = inner.x;
+			fill[2 * i + 1] = inner.y;
+
+			const float data[4] = {outer.x, outer.y, inner.x, inner.y};
+			std::copy(data, data + 4, fringe + 4 * i);
+
+			const float coords[4] = {1.f, 1.f, 1.f, 0.f};
+			std::copy(coords, coords + 4, aa + 4 * i);
+		}
+	} writer {floats(fill.data()), floats(fringeOut.data()), floats(aa.data()),
+		(area > 0.f ? -0.5f : 0.5f) * fringe};
+
+	segmentNormals(points, true, normalsCache);
+	joins(points, true, normalsCache, writer);
+
+	auto n = points.size();
+	fringeOut[2 * n] = fringeOut[0];
+	fringeOut[2 * n + 1] = fringeOut[1];
+	aa[2 * n] = aa[0];
+	aa[2 * n + 1] = aa[1];
+}
+
+void transformPoints(Span<const Vec2f> points, const Affine2& m,
+		Span<Vec2f> out) {
+	dlg_assert(out.size() == points.size());
+
+	// (x, y) * (m0, m4) + (y, x) * (m1, m3) + (m2, m5)
+	auto diag = F4::set(m[0], m[4], m[0], m[4]);
+	auto cross = F4::set(m[1], m[3], m[1], m[3]);
+	auto off = F4::set(m[2], m[5], m[2], m[5]);
+	auto* src = floats(points.data());
+	auto* dst = floats(out.data());
+
+	auto i = std::size_t(0u);
+	for(; i + 1 < points.size(); i += 2) {
+		auto p = F4::load(src + 2 * i);
+		(p * diag + swapPairs(p) * cross + off).store(dst + 2 * i);
+	}
+
+	if(i < points.size()) {
+		auto p = points[i];
+		out[i] = {m[0] * p.x + m[1] * p.y + m[2], m[3] * p.x + m[4] * p.y + m[5]};
+	}
+}
+
+CompactFrame compactFrame(Span<const Vec2f> points) {
+	if(points.empty()) {
+		return {};
+	}
+
+	auto min = points[0];
+	auto max = points[0];
+	for(auto p : points) {
+		min = {std::min(min.x, p.x), std::min(min.y, p.y)};
+		max = {std::max(max.x, p.x), std::max(max.y, p.y)};
+	}
+
+	// no zero extent, the shader multiplies by it
+	auto half = 0.5f * (max - min);
+	half = {std::max(half.x, 1e-6f), std::max(half.y, 1e-6f)};
+	return {0.5f * (min + max), half};
+}
+
+float compactError(const CompactFrame& frame) {
+	auto extent = std::max(frame.halfExtent.x, frame.halfExtent.y);
+	return 0.5f * extent / snormMax;
+}
+
+void packCompact(Span<const Vec2f> points, const CompactFrame& frame,
+		Span<CompactVec> out) {
+	dlg_assert(out.size() == points.size());
+	auto scale = Vec2f {snormMax / frame.halfExtent.x,
+		snormMax / frame.halfExtent.y};
+	for(auto i = 0u; i < points.size(); ++i) {
+		auto rel = points[i] - frame.center;
+		out[i] = {snorm(rel.x * scale.x), snorm(rel.y * scale.y)};
+	}
+}
+
+void packSnorm(Span<const Vec2f> values, Span<CompactVec> out) {
+	dlg_assert(out.size() == values.size());
+	for(auto i = 0u; i < values.size(); ++i) {
+		auto v = values[i];
+		out[i] = {snorm(v.x * snormMax), snorm(v.y * snormMax)};
+	}
+}
+
+} // namespace rvg
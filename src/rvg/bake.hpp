@@ -0,0 +1,69 @@
+// Copyright (c) 2019 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <rvg/fwd.hpp>
+#include <nytl/vec.hpp>
+#include <nytl/span.hpp>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace rvg {
+
+// Bulk versions of ktc::bakeStroke and ktc::bakeFillAA for polygons
+// without point colors. They write into pre-sized arrays instead of
+// calling a handler per vertex and process two points at once with
+// SSE2 or NEON where available (scalar otherwise).
+// Joins are miter joins, limited to 4 times the half width.
+
+// Number of vertices bakeStroke writes for the given number of points.
+std::size_t strokeVertexCount(std::size_t points, bool loop);
+
+// Writes a triangle strip of the given width along the points into out.
+// When aa is not empty, also writes the edge antialiasing coordinates
+// (see fill.frag) of every vertex into it.
+void bakeStroke(Span<const Vec2f> points, float width, bool loop,
+	Span<Vec2f> out, Span<Vec2f> aa = {});
+
+// Number of fill and fringe vertices bakeFillAA writes.
+std::size_t fillAAVertexCount(std::size_t points);
+std::size_t fringeVertexCount(std::size_t points);
+
+// Insets the polygon outline by half the fringe into fill and writes
+// the fringe strip from the outline outset by half the fringe to the
+// fill outline. The aa coordinates fade out over the fringe.
+void bakeFillAA(Span<const Vec2f> points, float fringe, Span<Vec2f> fill,
+	Span<Vec2f> fringeOut, Span<Vec2f> aa);
+
+// Affine 2D transform, the first two rows of a row-major 3x3 matrix.
+using Affine2 = std::array<float, 6>;
+
+// Transforms the given points into out, which may be the same span.
+// Used for the pre-transform, see DrawMode::transform.
+void transformPoints(Span<const Vec2f> points, const Affine2&,
+	Span<Vec2f> out);
+
+// Compact vertex format, see ContextSettings::compactPrecision.
+// Positions are stored as snorm16 values relative to the center and
+// half extent of the bounds of all vertices of a draw.
+using CompactVec = nytl::Vec2<std::int16_t>;
+struct CompactFrame {
+	Vec2f center;
+	Vec2f halfExtent;
+};
+
+// Returns the frame of the given positions. The largest position
+// error of the compact format is half a snorm16 step of the half extent.
+CompactFrame compactFrame(Span<const Vec2f> points);
+float compactError(const CompactFrame&);
+
+// Converts the given positions (relative to the frame) or values in
+// [-1, 1] (e.g. aa coordinates) to snorm16.
+void packCompact(Span<const Vec2f> points, const CompactFrame&,
+	Span<CompactVec> out);
+void packSnorm(Span<const Vec2f> values, Span<CompactVec> out);
+
+} // namespace rvg
@@ -7,9 +7,11 @@
 #include <rvg/text.hpp>
 #include <rvg/polygon.hpp>
 #include <rvg/shapes.hpp>
+#include <rvg/instanced.hpp>
 #include <rvg/state.hpp>
 #include <rvg/stateChange.hpp>
 #include <rvg/deviceObject.hpp>
+#include <rvg/layer.hpp>
 #include <rvg/util.hpp>
 
 #include <katachi/path.hpp>
@@ -25,6 +27,8 @@
 #include <nytl/vecOps.hpp>
 #include <cstring>
 #include <array>
+#include <algorithm>
+#include <optional>
 
 #include <shaders/fill.vert.frag_scissor.h>
 #include <shaders/fill.frag.frag_scissor.h>
@@ -33,7 +37,66 @@
 #include <shaders/fill.frag.frag_scissor.edge_aa.h>
 #include <shaders/fill.frag.plane_scissor.edge_aa.h>
 
+#include <shaders/fill.vert.frag_scissor.push.h>
+#include <shaders/fill.frag.frag_scissor.push.h>
+#include <shaders/fill.vert.plane_scissor.push.h>
+#include <shaders/fill.frag.plane_scissor.push.h>
+#include <shaders/fill.frag.frag_scissor.edge_aa.push.h>
+#include <shaders/fill.frag.plane_scissor.edge_aa.push.h>
+
+#include <shaders/fill.vert.no_scissor.h>
+#include <shaders/fill.vert.no_scissor.push.h>
+
+#include <shaders/fill.vert.frag_scissor.instanced.h>
+#include <shaders/fill.vert.plane_scissor.instanced.h>
+#include <shaders/fill.vert.no_scissor.instanced.h>
+#include <shaders/fill.vert.frag_scissor.instanced.push.h>
+#include <shaders/fill.vert.plane_scissor.instanced.push.h>
+#include <shaders/fill.vert.no_scissor.instanced.push.h>
+
+#include <shaders/fill.vert.frag_scissor.compact.h>
+#include <shaders/fill.vert.plane_scissor.compact.h>
+#include <shaders/fill.vert.no_scissor.compact.h>
+#include <shaders/fill.vert.frag_scissor.compact.push.h>
+#include <shaders/fill.vert.plane_scissor.compact.push.h>
+#include <shaders/fill.vert.no_scissor.compact.push.h>
+
+#include <shaders/fill.vert.frag_scissor.lines.h>
+#include <shaders/fill.vert.plane_scissor.lines.h>
+#include <shaders/fill.vert.no_scissor.lines.h>
+#include <shaders/fill.vert.frag_scissor.lines.push.h>
+#include <shaders/fill.vert.plane_scissor.lines.push.h>
+#include <shaders/fill.vert.no_scissor.lines.push.h>
+
+#include <shaders/cull.comp.h>
+#include <shaders/stroke.comp.h>
+
 namespace rvg {
+namespace {
+
+// The first format with a stencil component (preferably without depth)
+// that can be used as attachment, undefined if there is none.
+vk::Format findStencilFormat(const vpp::Device& dev) {
+	constexpr vk::Format formats[] = {
+		vk::Format::s8Uint,
+		vk::Format::d24UnormS8Uint,
+		vk::Format::d32SfloatS8Uint,
+		vk::Format::d16UnormS8Uint,
+	};
+
+	for(auto format : formats) {
+		auto props = vk::getPhysicalDeviceFormatProperties(
+			dev.vkPhysicalDevice(), format);
+		if(props.optimalTilingFeatures &
+				vk::FormatFeatureBits::depthStencilAttachment) {
+			return format;
+		}
+	}
+
+	return vk::Format::undefined;
+}
+
+} // anon namespace
 
 // Context
 Context::Context(vpp::Device& dev, const ContextSettings& settings) :
@@ -60,13 +123,15 @@ Context::Context(vpp::Device& dev, const ContextSettings& settings) :
 	auto& fontSampler = texSampler_;
 
 	// layouts
+	// transform, paint and scissor uniforms are allocated from arenas
+	// and therefore use dynamic uniform buffers, see UniformArena
 	auto transformDSB = std::array {
-		vpp::descriptorBinding(vk::DescriptorType::uniformBuffer,
+		vpp::descriptorBinding(vk::DescriptorType::uniformBufferDynamic,
 			vk::ShaderStageBits::vertex),
 	};
 
 	auto paintDSB = std::array {
-		vpp::descriptorBinding(vk::DescriptorType::uniformBuffer,
+		vpp::descriptorBinding(vk::DescriptorType::uniformBufferDynamic,
 			vk::ShaderStageBits::vertex | vk::ShaderStageBits::fragment),
 		vpp::descriptorBinding(vk::DescriptorType::combinedImageSampler,
 			vk::ShaderStageBits::fragment, &texSampler_.vkHandle()),
@@ -77,13 +142,9 @@ Context::Context(vpp::Device& dev, const ContextSettings& settings) :
 			vk::ShaderStageBits::fragment, &fontSampler.vkHandle()),
 	};
 
-	auto clipDistance = settings.clipDistanceEnable;
-	auto scissorStage = clipDistance ?
-		vk::ShaderStageBits::vertex :
-		vk::ShaderStageBits::fragment;
-
 	auto scissorDSB = std::array {
-		vpp::descriptorBinding(vk::DescriptorType::uniformBuffer, scissorStage),
+		vpp::descriptorBinding(vk::DescriptorType::uniformBufferDynamic,
+			scissorStage()),
 	};
 
 	dsLayoutTransform_.init(dev, transformDSB);
@@ -107,37 +168,211 @@ Context::Context(vpp::Device& dev, const ContextSettings& settings) :
 		layouts.push_back(dsLayoutStrokeAA_);
 	}
 
-	pipeLayout_ = {dev, layouts, {{
-		{vk::ShaderStageBits::fragment, 0, 4}
-	}}};
+	// only one range per stage is allowed, the scissor belongs to the
+	// fragment range (type and scissor) or the vertex range (scissor
+	// and transform), depending on scissorStage
+	std::vector<vk::PushConstantRange> pushRanges;
+	if(!settings.pushState) {
+		pushRanges.push_back({vk::ShaderStageBits::fragment,
+			pushTypeOffset, 4});
+	} else if(scissorStage() == vk::ShaderStageBits::fragment) {
+		pushRanges.push_back({vk::ShaderStageBits::fragment,
+			pushTypeOffset, pushTransformOffset - pushTypeOffset});
+		pushRanges.push_back({vk::ShaderStageBits::vertex,
+			pushTransformOffset, pushStateEnd - pushTransformOffset});
+	} else {
+		pushRanges.push_back({vk::ShaderStageBits::fragment,
+			pushTypeOffset, 4});
+		pushRanges.push_back({vk::ShaderStageBits::vertex,
+			pushScissorOffset, pushStateEnd - pushScissorOffset});
+	}
+
+	pipeLayout_ = {dev, layouts, pushRanges};
+
+	// pipelines
+	pipes_ = createPipes(settings.renderPass, settings.subpass,
+		settings.samples, true, false, settings.stencilFill);
+	if(settings.dynamicScissor) {
+		noScissorPipes_ = createPipes(settings.renderPass, settings.subpass,
+			settings.samples, false, false, settings.stencilFill);
+	}
+
+	// sync stuff
+	auto& renderQueue = device().queueSubmitter().queue();
+	renderFamily_ = renderQueue.family();
+	uploadFamily_ = renderFamily_;
+	auto uploadFlags = renderQueue.properties().queueFlags;
+	if(settings.uploadQueueFamily &&
+			*settings.uploadQueueFamily != renderFamily_) {
+		auto* queue = device().queue(*settings.uploadQueueFamily);
+		if(queue) {
+			uploadFamily_ = queue->family();
+			uploadFlags = queue->properties().queueFlags;
+			uploadSubmitter_.emplace(*queue);
+			transferSemaphore_ = {device()};
+			acquireCmdBuf_ = device().commandAllocator().get(renderFamily_,
+				vk::CommandPoolCreateBits::resetCommandBuffer);
+		} else {
+			dlg_warn("Device has no queue for upload family {}, "
+				"uploading on the rendering queue", *settings.uploadQueueFamily);
+		}
+	}
+
+	uploadCompute_ = bool(uploadFlags & vk::QueueBits::compute);
+
+	// profiling
+	if(settings.gpuProfiling) {
+		auto& limits = device().properties().limits;
+		if(!limits.timestampComputeAndGraphics) {
+			dlg_warn("Device does not support timestamps, GPU profiling "
+				"is disabled");
+		} else {
+			profiling_ = true;
+			auto pairs = settings.maxProfilingRegions + 1;
+
+			vk::QueryPoolCreateInfo qpi;
+			qpi.queryType = vk::QueryType::timestamp;
+			qpi.queryCount = 2 * pairs;
+			queryPool_ = {device(), qpi};
+
+			queryLabels_.resize(pairs);
+			queryLabels_[uploadQuery] = "rvg::upload";
+			for(auto i = pairs; i-- > 1;) {
+				freeQueries_.push_back(i);
+			}
+		}
+	}
+
+	uploadSemaphore_ = {device()};
+	uploadCmdBuf_ = device().commandAllocator().get(uploadFamily_,
+		vk::CommandPoolCreateBits::resetCommandBuffer);
 
-	// pipeline
+	// dummies
+	constexpr std::uint8_t bytes[] = {0xFF, 0xFF, 0xFF, 0xFF};
+	auto ptr = reinterpret_cast<const std::byte*>(bytes);
+	emptyImage_ = {*this, {1u, 1u}, {ptr, ptr + 4u}, TextureType::rgba32};
+
+	dummyTex_ = {dsAllocator(), dsLayoutFontAtlas_};
+	vpp::DescriptorSetUpdate update(dummyTex_);
+	auto layout = vk::ImageLayout::shaderReadOnlyOptimal;
+	update.imageSampler({{{}, emptyImage_.vkImageView(), layout}});
+
+	for(auto deviceLocal : {false, true}) {
+		transformArena(deviceLocal).init(*this, dsLayoutTransform_,
+			Transform::uboSize, deviceLocal);
+		scissorArena(deviceLocal).init(*this, dsLayoutScissor_,
+			Scissor::uboSize, deviceLocal);
+		paintArena(deviceLocal).init(*this, dsLayoutPaint_,
+			Paint::uboSize, deviceLocal, emptyImage_.vkImageView());
+	}
+
+	identityTransform_ = {*this};
+	pointColorPaint_ = {*this, ::rvg::pointColorPaint()};
+	defaultScissor_ = {*this, Scissor::reset};
+	defaultAtlas_ = std::make_unique<FontAtlas>(*this);
+
+	if(settings.antiAliasing) {
+		defaultStrokeAABuf_ = {bufferAllocator(), 12 * sizeof(float),
+			vk::BufferUsageBits::uniformBuffer, device().hostMemoryTypes()};
+		auto ptr = mapped(defaultStrokeAABuf_).data();
+		write(ptr, 1.f);
+
+		defaultStrokeAA_ = {dsAllocator(), dsLayoutStrokeAA_};
+		auto& b = defaultStrokeAABuf_;
+		vpp::DescriptorSetUpdate update(defaultStrokeAA_);
+		update.uniform({{b.buffer(), b.offset(), sizeof(float)}});
+	}
+}
+
+Context::Pipelines Context::createPipes(vk::RenderPass rp, unsigned subpass,
+		vk::SampleCountBits samples, bool shaderScissor,
+		bool premultiplied, bool stencil) const {
+	auto& dev = device();
+
+	// shaders
 	using ShaderData = nytl::Span<const std::uint32_t>;
-	auto vertData = ShaderData(fill_vert_frag_scissor_data);
-	auto fragData = ShaderData(fill_frag_frag_scissor_data);
+	auto aa = settings().antiAliasing;
+	auto push = settings().pushState;
+	auto plane = settings().clipDistanceEnable;
+
+	ShaderData vertData;
+	ShaderData instVertData;
+	ShaderData compactVertData;
+	ShaderData lineVertData;
+	ShaderData fragData;
+	if(!shaderScissor) {
+		vertData = push ?
+			ShaderData(fill_vert_no_scissor_push_data) :
+			ShaderData(fill_vert_no_scissor_data);
+		instVertData = push ?
+			ShaderData(fill_vert_no_scissor_instanced_push_data) :
+			ShaderData(fill_vert_no_scissor_instanced_data);
+		compactVertData = push ?
+			ShaderData(fill_vert_no_scissor_compact_push_data) :
+			ShaderData(fill_vert_no_scissor_compact_data);
+		lineVertData = push ?
+			ShaderData(fill_vert_no_scissor_lines_push_data) :
+			ShaderData(fill_vert_no_scissor_lines_data);
+	} else if(plane) {
+		vertData = push ?
+			ShaderData(fill_vert_plane_scissor_push_data) :
+			ShaderData(fill_vert_plane_scissor_data);
+		instVertData = push ?
+			ShaderData(fill_vert_plane_scissor_instanced_push_data) :
+			ShaderData(fill_vert_plane_scissor_instanced_data);
+		compactVertData = push ?
+			ShaderData(fill_vert_plane_scissor_compact_push_data) :
+			ShaderData(fill_vert_plane_scissor_compact_data);
+		lineVertData = push ?
+			ShaderData(fill_vert_plane_scissor_lines_push_data) :
+			ShaderData(fill_vert_plane_scissor_lines_data);
+	} else {
+		vertData = push ?
+			ShaderData(fill_vert_frag_scissor_push_data) :
+			ShaderData(fill_vert_frag_scissor_data);
+		instVertData = push ?
+			ShaderData(fill_vert_frag_scissor_instanced_push_data) :
+			ShaderData(fill_vert_frag_scissor_instanced_data);
+		compactVertData = push ?
+			ShaderData(fill_vert_frag_scissor_compact_push_data) :
+			ShaderData(fill_vert_frag_scissor_compact_data);
+		lineVertData = push ?
+			ShaderData(fill_vert_frag_scissor_lines_push_data) :
+			ShaderData(fill_vert_frag_scissor_lines_data);
+	}
 
-	if(clipDistance) {
-		vertData = fill_vert_plane_scissor_data;
-		if(settings.antiAliasing) {
-			fragData = fill_frag_plane_scissor_edge_aa_data;
+	// the fragment shaders for plane scissor don't do any scissoring
+	if(!shaderScissor || plane) {
+		if(push) {
+			fragData = aa ?
+				ShaderData(fill_frag_plane_scissor_edge_aa_push_data) :
+				ShaderData(fill_frag_plane_scissor_push_data);
+		} else {
+			fragData = aa ?
+				ShaderData(fill_frag_plane_scissor_edge_aa_data) :
+				ShaderData(fill_frag_plane_scissor_data);
+		}
+	} else {
+		if(push) {
+			fragData = aa ?
+				ShaderData(fill_frag_frag_scissor_edge_aa_push_data) :
+				ShaderData(fill_frag_frag_scissor_push_data);
 		} else {
-			fragData = fill_frag_plane_scissor_data;
+			fragData = aa ?
+				ShaderData(fill_frag_frag_scissor_edge_aa_data) :
+				ShaderData(fill_frag_frag_scissor_data);
 		}
-	} else if(settings.antiAliasing) {
-		fragData = fill_frag_frag_scissor_edge_aa_data;
 	}
 
 	auto fillVertex = vpp::ShaderModule(dev, vertData);
 	auto fillFragment = vpp::ShaderModule(dev, fragData);
 
-	auto samples = settings.samples == vk::SampleCountBits {} ?
-		vk::SampleCountBits::e1 : settings.samples;
-	vpp::GraphicsPipelineInfo fanPipeInfo(settings.renderPass, pipeLayout_, {{{
+	samples = samples == vk::SampleCountBits {} ?
+		vk::SampleCountBits::e1 : samples;
+	vpp::GraphicsPipelineInfo fanPipeInfo(rp, pipeLayout_, {{{
 		{fillVertex, vk::ShaderStageBits::vertex},
 		{fillFragment, vk::ShaderStageBits::fragment}
-	}}}, settings.subpass, samples);
-
-
+	}}}, subpass, samples);
 	fanPipeInfo.flags(vk::PipelineCreateBits::allowDerivatives);
 
 	// vertex attribs: vec2 pos, vec2 uv, vec4u8 color
@@ -176,48 +411,546 @@ Context::Context(vpp::Device& dev, const ContextSettings& settings) :
 
 	fanPipeInfo.assembly.topology = vk::PrimitiveTopology::triangleFan;
 
+	// Store premultiplied colors, i.e. blend the alpha so that the result
+	// can be composited later on. Used for layers.
+	vk::PipelineColorBlendAttachmentState blend;
+	if(premultiplied) {
+		blend.blendEnable = true;
+		blend.colorBlendOp = vk::BlendOp::add;
+		blend.srcColorBlendFactor = vk::BlendFactor::srcAlpha;
+		blend.dstColorBlendFactor = vk::BlendFactor::oneMinusSrcAlpha;
+		blend.alphaBlendOp = vk::BlendOp::add;
+		blend.srcAlphaBlendFactor = vk::BlendFactor::one;
+		blend.dstAlphaBlendFactor = vk::BlendFactor::oneMinusSrcAlpha;
+		blend.colorWriteMask =
+			vk::ColorComponentBits::r |
+			vk::ColorComponentBits::g |
+			vk::ColorComponentBits::b |
+			vk::ColorComponentBits::a;
+
+		fanPipeInfo.blend.attachmentCount = 1u;
+		fanPipeInfo.blend.pAttachments = &blend;
+	}
+
 	// stripPipe
 	auto stripPipeInfo = fanPipeInfo;
 	stripPipeInfo.base(0);
 	stripPipeInfo.assembly.topology = vk::PrimitiveTopology::triangleStrip;
 
-	auto pipes = vk::createGraphicsPipelines(dev, settings.pipelineCache,
-		{{fanPipeInfo.info(), stripPipeInfo.info()}});
-	fanPipe_ = {dev, pipes[0]};
-	stripPipe_ = {dev, pipes[1]};
+	// listPipe, for triangulated fills (indexed)
+	auto listPipeInfo = fanPipeInfo;
+	listPipeInfo.base(0);
+	listPipeInfo.assembly.topology = vk::PrimitiveTopology::triangleList;
+
+	// linesPipe, see StrokeType::lines
+	// per instance the segment (start, end) and, with a stride of zero,
+	// the header of the draw (vec4, x: half width)
+	std::array<vk::VertexInputAttributeDescription, 3> lineAttribs = {};
+	lineAttribs[0].format = vk::Format::r32g32Sfloat;
+	lineAttribs[1].format = vk::Format::r32g32Sfloat;
+	lineAttribs[1].location = 3;
+	lineAttribs[1].offset = sizeof(float) * 2;
+	lineAttribs[2].format = vk::Format::r32g32b32a32Sfloat;
+	lineAttribs[2].location = 4;
+	lineAttribs[2].binding = 1;
+
+	std::array<vk::VertexInputBindingDescription, 2> lineBindings = {};
+	lineBindings[0].inputRate = vk::VertexInputRate::instance;
+	lineBindings[0].stride = sizeof(float) * 4;
+	lineBindings[1].inputRate = vk::VertexInputRate::instance;
+	lineBindings[1].stride = 0u;
+	lineBindings[1].binding = 1;
+
+	vpp::ShaderModule lineVertex(dev, lineVertData);
+	vpp::GraphicsPipelineInfo linesPipeInfo(rp, pipeLayout_, {{{
+		{lineVertex, vk::ShaderStageBits::vertex},
+		{fillFragment, vk::ShaderStageBits::fragment}
+	}}}, subpass, samples);
+	linesPipeInfo.base(0);
+	linesPipeInfo.blend = fanPipeInfo.blend;
+	linesPipeInfo.vertex = fanPipeInfo.vertex;
+	linesPipeInfo.vertex.pVertexAttributeDescriptions = lineAttribs.data();
+	linesPipeInfo.vertex.vertexAttributeDescriptionCount = lineAttribs.size();
+	linesPipeInfo.vertex.pVertexBindingDescriptions = lineBindings.data();
+	linesPipeInfo.vertex.vertexBindingDescriptionCount = lineBindings.size();
+	linesPipeInfo.assembly.topology = vk::PrimitiveTopology::triangleStrip;
+
+	std::vector<vk::GraphicsPipelineCreateInfo> infos = {
+		fanPipeInfo.info(),
+		stripPipeInfo.info(),
+		listPipeInfo.info(),
+		linesPipeInfo.info()
+	};
 
-	// sync stuff
-	auto family = device().queueSubmitter().queue().family();
-	uploadSemaphore_ = {device()};
-	uploadCmdBuf_ = device().commandAllocator().get(family,
-		vk::CommandPoolCreateBits::resetCommandBuffer);
+	// instanced variants, see InstancedShape
+	// additional per-instance binding: vec4 (offset, scale, angle)
+	// and vec4u8 color
+	std::array<vk::VertexInputAttributeDescription, 5> instAttribs = {};
+	std::copy(vertexAttribs.begin(), vertexAttribs.end(), instAttribs.begin());
+	instAttribs[3].format = vk::Format::r32g32b32a32Sfloat;
+	instAttribs[3].location = 4;
+	instAttribs[3].binding = 3;
+
+	instAttribs[4].format = vk::Format::r8g8b8a8Unorm;
+	instAttribs[4].location = 5;
+	instAttribs[4].binding = 3;
+	instAttribs[4].offset = sizeof(float) * 4;
+
+	std::array<vk::VertexInputBindingDescription, 4> instBindings = {};
+	std::copy(vertexBindings.begin(), vertexBindings.end(),
+		instBindings.begin());
+	instBindings[3].inputRate = vk::VertexInputRate::instance;
+	instBindings[3].stride = sizeof(float) * 4 + sizeof(u8) * 4;
+	instBindings[3].binding = 3;
+
+	std::optional<vpp::ShaderModule> instVertex;
+	std::optional<vpp::GraphicsPipelineInfo> fanInstInfo;
+	std::optional<vpp::GraphicsPipelineInfo> stripInstInfo;
+	if(settings().instancing) {
+		instVertex.emplace(dev, instVertData);
+		fanInstInfo.emplace(rp, pipeLayout_, vpp::ShaderProgram {{{
+			{*instVertex, vk::ShaderStageBits::vertex},
+			{fillFragment, vk::ShaderStageBits::fragment}
+		}}}, subpass, samples);
+		fanInstInfo->base(0);
+		fanInstInfo->blend = fanPipeInfo.blend;
+		fanInstInfo->assembly = fanPipeInfo.assembly;
+		fanInstInfo->vertex = fanPipeInfo.vertex;
+		fanInstInfo->vertex.pVertexAttributeDescriptions = instAttribs.data();
+		fanInstInfo->vertex.vertexAttributeDescriptionCount = instAttribs.size();
+		fanInstInfo->vertex.pVertexBindingDescriptions = instBindings.data();
+		fanInstInfo->vertex.vertexBindingDescriptionCount = instBindings.size();
+
+		stripInstInfo = *fanInstInfo;
+		stripInstInfo->assembly.topology = vk::PrimitiveTopology::triangleStrip;
+
+		infos.push_back(fanInstInfo->info());
+		infos.push_back(stripInstInfo->info());
+	}
 
-	// dummies
-	constexpr std::uint8_t bytes[] = {0xFF, 0xFF, 0xFF, 0xFF};
-	auto ptr = reinterpret_cast<const std::byte*>(bytes);
-	emptyImage_ = {*this, {1u, 1u}, {ptr, ptr + 4u}, TextureType::rgba32};
+	// compact variants, see ContextSettings::compactPrecision
+	// snorm16 positions and aa coords, the bounds of the draw (vec4:
+	// center, half extent) as per-instance attribute from its header
+	auto compactAttribs = std::array<vk::VertexInputAttributeDescription, 4> {
+		vertexAttribs[0], vertexAttribs[1], vertexAttribs[2], {}};
+	compactAttribs[0].format = vk::Format::r16g16Snorm;
+	compactAttribs[1].format = vk::Format::r16g16Snorm;
+	compactAttribs[3].format = vk::Format::r32g32b32a32Sfloat;
+	compactAttribs[3].location = 3;
+	compactAttribs[3].binding = 3;
+
+	auto compactBindings = std::array<vk::VertexInputBindingDescription, 4> {
+		vertexBindings[0], vertexBindings[1], vertexBindings[2], {}};
+	compactBindings[0].stride = sizeof(std::int16_t) * 2;
+	compactBindings[1].stride = sizeof(std::int16_t) * 2;
+	compactBindings[3].inputRate = vk::VertexInputRate::instance;
+	compactBindings[3].stride = sizeof(float) * 4;
+	compactBindings[3].binding = 3;
+
+	auto compact = settings().compactPrecision > 0.f;
+	std::optional<vpp::ShaderModule> compactVertex;
+	std::optional<vpp::GraphicsPipelineInfo> fanCompactInfo;
+	std::optional<vpp::GraphicsPipelineInfo> stripCompactInfo;
+	std::optional<vpp::GraphicsPipelineInfo> listCompactInfo;
+	if(compact) {
+		compactVertex.emplace(dev, compactVertData);
+		fanCompactInfo.emplace(rp, pipeLayout_, vpp::ShaderProgram {{{
+			{*compactVertex, vk::ShaderStageBits::vertex},
+			{fillFragment, vk::ShaderStageBits::fragment}
+		}}}, subpass, samples);
+		fanCompactInfo->base(0);
+		fanCompactInfo->blend = fanPipeInfo.blend;
+		fanCompactInfo->assembly = fanPipeInfo.assembly;
+		fanCompactInfo->vertex = fanPipeInfo.vertex;
+		auto& vertex = fanCompactInfo->vertex;
+		vertex.pVertexAttributeDescriptions = compactAttribs.data();
+		vertex.vertexAttributeDescriptionCount = compactAttribs.size();
+		vertex.pVertexBindingDescriptions = compactBindings.data();
+		vertex.vertexBindingDescriptionCount = compactBindings.size();
+
+		stripCompactInfo = *fanCompactInfo;
+		stripCompactInfo->assembly.topology =
+			vk::PrimitiveTopology::triangleStrip;
+		listCompactInfo = *fanCompactInfo;
+		listCompactInfo->assembly.topology =
+			vk::PrimitiveTopology::triangleList;
+
+		infos.push_back(fanCompactInfo->info());
+		infos.push_back(stripCompactInfo->info());
+		infos.push_back(listCompactInfo->info());
+	}
 
-	dummyTex_ = {dsAllocator(), dsLayoutFontAtlas_};
-	vpp::DescriptorSetUpdate update(dummyTex_);
-	auto layout = vk::ImageLayout::shaderReadOnlyOptimal;
-	update.imageSampler({{{}, emptyImage_.vkImageView(), layout}});
+	// stencil-then-cover fills, see FillRule
+	// The stencil pipelines write the winding number (nonZero) or
+	// its parity (evenOdd) of the polygon fan into the stencil buffer,
+	// the cover pipeline then draws where it is not zero and resets it.
+	auto stencilInfo = fanPipeInfo;
+	auto evenOddInfo = fanPipeInfo;
+	auto coverInfo = fanPipeInfo;
+	vk::PipelineColorBlendAttachmentState noColor {};
+	if(stencil) {
+		auto stencilOp = [](vk::StencilOp pass, vk::CompareOp compare) {
+			vk::StencilOpState op {};
+			op.failOp = vk::StencilOp::keep;
+			op.passOp = pass;
+			op.depthFailOp = vk::StencilOp::keep;
+			op.compareOp = compare;
+			op.compareMask = 0xFFu;
+			op.writeMask = 0xFFu;
+			return op;
+		};
 
-	identityTransform_ = {*this};
-	pointColorPaint_ = {*this, ::rvg::pointColorPaint()};
-	defaultScissor_ = {*this, Scissor::reset};
-	defaultAtlas_ = std::make_unique<FontAtlas>(*this);
+		noColor.colorWriteMask = {};
+		stencilInfo.base(0);
+		stencilInfo.blend.attachmentCount = 1u;
+		stencilInfo.blend.pAttachments = &noColor;
+		stencilInfo.rasterization.cullMode = vk::CullModeBits::none;
+		stencilInfo.depthStencil.stencilTestEnable = true;
+		stencilInfo.depthStencil.front = stencilOp(
+			vk::StencilOp::incrementAndWrap, vk::CompareOp::always);
+		stencilInfo.depthStencil.back = stencilOp(
+			vk::StencilOp::decrementAndWrap, vk::CompareOp::always);
+
+		evenOddInfo = stencilInfo;
+		evenOddInfo.depthStencil.front = stencilOp(
+			vk::StencilOp::invert, vk::CompareOp::always);
+		evenOddInfo.depthStencil.back = evenOddInfo.depthStencil.front;
+
+		// fail only happens where the value is already zero
+		coverInfo.base(0);
+		coverInfo.depthStencil.stencilTestEnable = true;
+		coverInfo.depthStencil.front = stencilOp(
+			vk::StencilOp::zero, vk::CompareOp::notEqual);
+		coverInfo.depthStencil.back = coverInfo.depthStencil.front;
+
+		infos.push_back(stencilInfo.info());
+		infos.push_back(evenOddInfo.info());
+		infos.push_back(coverInfo.info());
+	}
 
-	if(settings.antiAliasing) {
-		defaultStrokeAABuf_ = {bufferAllocator(), 12 * sizeof(float),
-			vk::BufferUsageBits::uniformBuffer, device().hostMemoryTypes()};
-		auto map = defaultStrokeAABuf_.memoryMap();
-		auto ptr = map.ptr();
-		write(ptr, 1.f);
+	auto pipes = vk::createGraphicsPipelines(dev, settings().pipelineCache,
+		infos);
+
+	Pipelines ret;
+	auto id = 0u;
+	ret.fan = {dev, pipes[id++]};
+	ret.strip = {dev, pipes[id++]};
+	ret.list = {dev, pipes[id++]};
+	ret.lines = {dev, pipes[id++]};
+	if(settings().instancing) {
+		ret.fanInstanced = {dev, pipes[id++]};
+		ret.stripInstanced = {dev, pipes[id++]};
+	}
 
-		defaultStrokeAA_ = {dsAllocator(), dsLayoutStrokeAA_};
-		auto& b = defaultStrokeAABuf_;
-		vpp::DescriptorSetUpdate update(defaultStrokeAA_);
-		update.uniform({{b.buffer(), b.offset(), sizeof(float)}});
+	if(compact) {
+		ret.fanCompact = {dev, pipes[id++]};
+		ret.stripCompact = {dev, pipes[id++]};
+		ret.listCompact = {dev, pipes[id++]};
+	}
+
+	if(stencil) {
+		ret.stencilNonZero = {dev, pipes[id++]};
+		ret.stencilEvenOdd = {dev, pipes[id++]};
+		ret.cover = {dev, pipes[id++]};
+	}
+
+	return ret;
+}
+
+
+const Context::Pipelines& Context::pipes(vk::CommandBuffer cb) const {
+	auto it = recordStates_.find(cb);
+	if(it != recordStates_.end() && it->second.layer) {
+		dlg_assert(layerRenderPass_);
+		return layerPipes_;
+	}
+
+	if(it != recordStates_.end() && it->second.hwScissor) {
+		dlg_assert(settings().dynamicScissor);
+		return noScissorPipes_;
+	}
+
+	return pipes_;
+}
+
+Context::RecordState& Context::recordState(vk::CommandBuffer cb) {
+	return recordStates_[cb];
+}
+
+const vpp::RenderPass& Context::layerRenderPass() {
+	if(layerRenderPass_) {
+		return layerRenderPass_;
+	}
+
+	vk::AttachmentDescription attachment;
+	attachment.format = Layer::format;
+	attachment.samples = vk::SampleCountBits::e1;
+	attachment.loadOp = vk::AttachmentLoadOp::clear;
+	attachment.storeOp = vk::AttachmentStoreOp::store;
+	attachment.stencilLoadOp = vk::AttachmentLoadOp::dontCare;
+	attachment.stencilStoreOp = vk::AttachmentStoreOp::dontCare;
+	attachment.initialLayout = vk::ImageLayout::undefined;
+	attachment.finalLayout = vk::ImageLayout::shaderReadOnlyOptimal;
+
+	vk::AttachmentReference colorReference;
+	colorReference.attachment = 0;
+	colorReference.layout = vk::ImageLayout::colorAttachmentOptimal;
+
+	vk::SubpassDescription subpass;
+	subpass.pipelineBindPoint = vk::PipelineBindPoint::graphics;
+	subpass.colorAttachmentCount = 1;
+	subpass.pColorAttachments = &colorReference;
+
+	// the layer image is sampled afterwards
+	std::array<vk::SubpassDependency, 2> dependencies;
+	dependencies[0].srcSubpass = 0u;
+	dependencies[0].dstSubpass = vk::subpassExternal;
+	dependencies[0].srcStageMask = vk::PipelineStageBits::colorAttachmentOutput;
+	dependencies[0].srcAccessMask = vk::AccessBits::colorAttachmentWrite;
+	dependencies[0].dstStageMask = vk::PipelineStageBits::fragmentShader;
+	dependencies[0].dstAccessMask = vk::AccessBits::shaderRead;
+
+	std::array<vk::AttachmentDescription, 2> attachments = {attachment};
+	vk::AttachmentReference stencilReference;
+	auto stencil = settings().stencilFill;
+	if(stencil) {
+		// stencil fills, see FillRule. Not kept between renders
+		layerStencilFormat_ = findStencilFormat(device());
+		dlg_assertm(layerStencilFormat_ != vk::Format::undefined,
+			"No supported stencil format for layers");
+
+		auto& sa = attachments[1];
+		sa.format = layerStencilFormat_;
+		sa.samples = vk::SampleCountBits::e1;
+		sa.loadOp = vk::AttachmentLoadOp::clear;
+		sa.storeOp = vk::AttachmentStoreOp::dontCare;
+		sa.stencilLoadOp = vk::AttachmentLoadOp::clear;
+		sa.stencilStoreOp = vk::AttachmentStoreOp::dontCare;
+		sa.initialLayout = vk::ImageLayout::undefined;
+		sa.finalLayout = vk::ImageLayout::depthStencilAttachmentOptimal;
+
+		stencilReference.attachment = 1;
+		stencilReference.layout = vk::ImageLayout::depthStencilAttachmentOptimal;
+		subpass.pDepthStencilAttachment = &stencilReference;
+
+		// the clear must wait for the previous render of the layer
+		auto tests = vk::PipelineStageBits::earlyFragmentTests |
+			vk::PipelineStageBits::lateFragmentTests;
+		dependencies[1].srcSubpass = vk::subpassExternal;
+		dependencies[1].dstSubpass = 0u;
+		dependencies[1].srcStageMask = tests;
+		dependencies[1].srcAccessMask =
+			vk::AccessBits::depthStencilAttachmentWrite;
+		dependencies[1].dstStageMask = tests;
+		dependencies[1].dstAccessMask =
+			vk::AccessBits::depthStencilAttachmentWrite;
+	}
+
+	vk::RenderPassCreateInfo info;
+	info.attachmentCount = 1u + stencil;
+	info.pAttachments = attachments.data();
+	info.subpassCount = 1;
+	info.pSubpasses = &subpass;
+	info.dependencyCount = 1u + stencil;
+	info.pDependencies = dependencies.data();
+
+	layerRenderPass_ = {device(), info};
+	layerPipes_ = createPipes(layerRenderPass_, 0u,
+		vk::SampleCountBits::e1, true, true, stencil);
+	return layerRenderPass_;
+}
+
+const Context::ComputePipeline& Context::cullPipeline() {
+	if(cullPipeline_) {
+		return *cullPipeline_;
+	}
+
+	auto& dev = device();
+	cullPipeline_ = std::make_unique<ComputePipeline>();
+	auto& cull = *cullPipeline_;
+
+	auto bindings = std::array {
+		vpp::descriptorBinding(vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute),
+		vpp::descriptorBinding(vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute),
+	};
+
+	cull.dsLayout.init(dev, bindings);
+	cull.layout = {dev, {{cull.dsLayout.vkHandle()}},
+		{{{vk::ShaderStageBits::compute, 0, 4}}}};
+
+	auto module = vpp::ShaderModule(dev, cull_comp_data);
+	vk::ComputePipelineCreateInfo info;
+	info.layout = cull.layout;
+	info.stage.stage = vk::ShaderStageBits::compute;
+	info.stage.module = module;
+	info.stage.pName = "main";
+
+	auto pipes = vk::createComputePipelines(dev, settings().pipelineCache,
+		{{info}});
+	cull.pipe = {dev, pipes[0]};
+	return cull;
+}
+
+const Context::ComputePipeline& Context::strokePipeline() {
+	if(strokePipeline_) {
+		return *strokePipeline_;
+	}
+
+	auto& dev = device();
+	strokePipeline_ = std::make_unique<ComputePipeline>();
+	auto& stroke = *strokePipeline_;
+
+	auto bindings = std::array {
+		vpp::descriptorBinding(vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute),
+		vpp::descriptorBinding(vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute),
+		vpp::descriptorBinding(vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute),
+	};
+
+	stroke.dsLayout.init(dev, bindings);
+	stroke.layout = {dev, {{stroke.dsLayout.vkHandle()}},
+		{{{vk::ShaderStageBits::compute, 0, 6 * 4}}}};
+
+	auto module = vpp::ShaderModule(dev, stroke_comp_data);
+	vk::ComputePipelineCreateInfo info;
+	info.layout = stroke.layout;
+	info.stage.stage = vk::ShaderStageBits::compute;
+	info.stage.module = module;
+	info.stage.pName = "main";
+
+	auto pipes = vk::createComputePipelines(dev, settings().pipelineCache,
+		{{info}});
+	stroke.pipe = {dev, pipes[0]};
+	return stroke;
+}
+
+void Context::registerLayer(Layer& layer) {
+	layers_.push_back(&layer);
+}
+
+void Context::unregisterLayer(Layer& layer) noexcept {
+	layers_.erase(std::remove(layers_.begin(), layers_.end(), &layer),
+		layers_.end());
+
+	// don't submit its command buffer anymore
+	auto cb = layer.commandBuffer();
+	auto& draws = currentFrame_.layerDraws;
+	draws.erase(std::remove(draws.begin(), draws.end(), cb), draws.end());
+
+	auto it = recordStates_.find(cb);
+	if(it != recordStates_.end()) {
+		for(auto query : it->second.queries) {
+			queryLabels_[query].clear();
+			freeQueries_.push_back(query);
+		}
+
+		recordStates_.erase(it);
+	}
+}
+
+void Context::addLayerDraw(vk::CommandBuffer cb) {
+	auto& draws = currentFrame_.layerDraws;
+	if(std::find(draws.begin(), draws.end(), cb) == draws.end()) {
+		draws.push_back(cb);
+	}
+}
+
+void Context::trackState(vk::CommandBuffer cb, bool track) {
+	auto& state = recordState(cb);
+	state.track = track;
+	state.pipeline = {};
+	state.type = 0xFFFFFFFFu;
+	state.vertexBuffers = {};
+	state.vertexOffsets = {};
+	state.descriptors = {};
+	state.dynamicOffsets = {};
+}
+
+void Context::bindPipeline(vk::CommandBuffer cb, vk::Pipeline pipe) {
+	auto it = recordStates_.find(cb);
+	if(it != recordStates_.end() && it->second.track) {
+		if(it->second.pipeline == pipe) {
+			return;
+		}
+
+		it->second.pipeline = pipe;
+	}
+
+	vk::cmdBindPipeline(cb, vk::PipelineBindPoint::graphics, pipe);
+}
+
+void Context::pushType(vk::CommandBuffer cb, std::uint32_t type) {
+	auto it = recordStates_.find(cb);
+	if(it != recordStates_.end() && it->second.track) {
+		if(it->second.type == type) {
+			return;
+		}
+
+		it->second.type = type;
+	}
+
+	vk::cmdPushConstants(cb, pipeLayout(), vk::ShaderStageBits::fragment,
+		pushTypeOffset, 4, &type);
+}
+
+void Context::bindVertexBuffers(vk::CommandBuffer cb, unsigned first,
+		nytl::Span<const vk::Buffer> bufs,
+		nytl::Span<const vk::DeviceSize> offsets) {
+	dlg_assert(bufs.size() == offsets.size());
+	dlg_assert(first + bufs.size() <= 4);
+
+	auto it = recordStates_.find(cb);
+	if(it != recordStates_.end() && it->second.track) {
+		// only bind the range of bindings that changed
+		auto& state = it->second;
+		auto begin = bufs.size();
+		auto end = std::size_t(0u);
+		for(auto i = 0u; i < bufs.size(); ++i) {
+			if(state.vertexBuffers[first + i] != bufs[i] ||
+					state.vertexOffsets[first + i] != offsets[i]) {
+				begin = std::min<std::size_t>(begin, i);
+				end = i + 1;
+				state.vertexBuffers[first + i] = bufs[i];
+				state.vertexOffsets[first + i] = offsets[i];
+			}
+		}
+
+		if(begin >= end) {
+			return;
+		}
+
+		first += begin;
+		bufs = {bufs.data() + begin, end - begin};
+		offsets = {offsets.data() + begin, end - begin};
+	}
+
+	vk::cmdBindVertexBuffers(cb, first, bufs, offsets);
+}
+
+void Context::bindDescriptorSet(vk::CommandBuffer cb, unsigned set,
+		vk::DescriptorSet ds, std::optional<std::uint32_t> dynamicOffset) {
+	auto it = recordStates_.find(cb);
+	if(it != recordStates_.end() && it->second.track) {
+		auto& state = it->second;
+		auto offset = dynamicOffset.value_or(0u);
+		if(state.descriptors[set] == ds && state.dynamicOffsets[set] == offset) {
+			return;
+		}
+
+		state.descriptors[set] = ds;
+		state.dynamicOffsets[set] = offset;
+	}
+
+	if(dynamicOffset) {
+		vk::cmdBindDescriptorSets(cb, vk::PipelineBindPoint::graphics,
+			pipeLayout(), set, {{ds}}, {{*dynamicOffset}});
+	} else {
+		vk::cmdBindDescriptorSets(cb, vk::PipelineBindPoint::graphics,
+			pipeLayout(), set, {{ds}}, {});
 	}
 }
 
@@ -233,7 +966,53 @@ vpp::DeviceMemoryAllocator& Context::devMemAllocator() const {
 	return device().devMemAllocator();
 }
 
+vk::ShaderStageFlags Context::scissorStage() const {
+	return settings().clipDistanceEnable ?
+		vk::ShaderStageBits::vertex :
+		vk::ShaderStageBits::fragment;
+}
+
+void Context::pushTransform(vk::CommandBuffer cb, const nytl::Mat3f& m) const {
+	dlg_assertm(settings().pushState, "Context has no push state");
+	std::array<float, 8> rows = {
+		m[0][0], m[0][1], m[0][2], 0.f,
+		m[1][0], m[1][1], m[1][2], 0.f,
+	};
+
+	vk::cmdPushConstants(cb, pipeLayout(), vk::ShaderStageBits::vertex,
+		pushTransformOffset, sizeof(rows), rows.data());
+}
+
+void Context::pushTransform(vk::CommandBuffer cb, const nytl::Mat4f& m) const {
+	// we only need the 2D affine part, z is always 0
+	auto m3 = nytl::identity<3, float>();
+	m3[0] = {m[0][0], m[0][1], m[0][3]};
+	m3[1] = {m[1][0], m[1][1], m[1][3]};
+	pushTransform(cb, m3);
+}
+
+void Context::pushScissor(vk::CommandBuffer cb, const nytl::Rect2f& r) const {
+	dlg_assertm(settings().pushState, "Context has no push state");
+	std::array<float, 4> data = {
+		r.position.x, r.position.y,
+		r.size.x, r.size.y,
+	};
+
+	vk::cmdPushConstants(cb, pipeLayout(), scissorStage(),
+		pushScissorOffset, sizeof(data), data.data());
+}
+
 void Context::bindDefaults(vk::CommandBuffer cmdb) {
+	auto& state = recordStates_[cmdb];
+	dlg_assertm(state.openRegions.empty(), "Unterminated profiling region");
+	for(auto query : state.queries) {
+		queryLabels_[query].clear();
+		freeQueries_.push_back(query);
+	}
+
+	auto layer = state.layer;
+	state = {};
+	state.layer = layer;
 	identityTransform_.bind(cmdb);
 	defaultScissor_.bind(cmdb);
 
@@ -247,21 +1026,121 @@ void Context::bindDefaults(vk::CommandBuffer cmdb) {
 }
 
 bool Context::updateDevice() {
+	static_assert(std::variant_size_v<DevRes> == unsigned(ObjectType::count));
+	auto zone = TraceZone(*this, "rvg::Context::updateDevice",
+		stats_.time.updateDevice);
+
 	auto visitor = [&](auto* obj) {
 		dlg_assert(obj);
 		return obj->updateDevice();
 	};
 
-	for(auto& ud : updateDevice_) {
-		rerecord_ |= std::visit(visitor, ud);
+	auto objVisitor = [&](auto* obj) {
+		return static_cast<const DeviceObject*>(obj);
+	};
+
+	auto process = [&]{
+		auto updates = std::move(updateDevice_);
+		updateDevice_ = {};
+		for(auto& ud : updates) {
+			updated_.insert(std::visit(objVisitor, ud));
+			auto causes = stats_.rerecords.size();
+			auto rerecord = std::visit(visitor, ud);
+			++stats_.updated[ud.index()];
+
+			// the object did not report a more specific reason
+			if(rerecord && stats_.rerecords.size() == causes) {
+				stats_.rerecords.push_back({std::visit(objVisitor, ud),
+					RerecordReason::other});
+			}
+
+			rerecord_ |= rerecord;
+		}
+	};
+
+	updated_.clear();
+	process();
+
+	// Layers depend on the updated objects. They might update their
+	// own objects (e.g. the paint on resize) which are then processed.
+	for(auto* layer : layers_) {
+		layer->updateDevice();
+	}
+
+	process();
+	zone.end();
+
+	{
+		auto zone = TraceZone(*this, "rvg::Context::flushMapped",
+			stats_.time.flush);
+		flushMapped();
 	}
 
-	updateDevice_.clear();
 	auto ret = rerecord_;
 	rerecord_ = false;
 	return ret;
 }
 
+unsigned Context::indexCount(IndexPattern pattern, unsigned vertexCount) {
+	switch(pattern) {
+		case IndexPattern::quads:
+			return 6 * (vertexCount / 4);
+		case IndexPattern::strip:
+			return vertexCount < 3 ? 0u : 3 * (vertexCount - 2);
+	}
+
+	return 0u;
+}
+
+vpp::BufferSpan Context::sharedIndices(IndexPattern pattern,
+		unsigned vertexCount) {
+	auto& buf = sharedIndices_[unsigned(pattern)];
+	auto& vertices = sharedIndexVertices_[unsigned(pattern)];
+	if(vertices < vertexCount || !buf.size()) {
+		// multiple of 4 for quads
+		vertices = std::max(2 * vertexCount, 1024u);
+		vertices = (vertices + 3u) & ~3u;
+
+		std::vector<std::uint32_t> indices;
+		indices.reserve(indexCount(pattern, vertices));
+		if(pattern == IndexPattern::quads) {
+			for(auto i = 0u; i + 3 < vertices; i += 4) {
+				auto quad = {i, i + 1, i + 2, i + 2, i + 1, i + 3};
+				indices.insert(indices.end(), quad);
+			}
+		} else {
+			// flip every second triangle, like the strip topology
+			for(auto i = 0u; i + 2 < vertices; ++i) {
+				auto odd = i % 2;
+				auto tri = {i + odd, i + 1 - odd, i + 2};
+				indices.insert(indices.end(), tri);
+			}
+		}
+
+		auto size = indices.size() * sizeof(indices[0]);
+		buf = {bufferAllocator(), size, vk::BufferUsageBits::indexBuffer,
+			device().hostMemoryTypes(), 4u};
+		writeMapped(*this, buf, nytl::span(indices.data(), indices.size()));
+
+		++stats_.reallocations;
+		rerecord_ = true;
+		stats_.rerecords.push_back({nullptr, RerecordReason::realloc});
+	}
+
+	auto size = indexCount(pattern, vertexCount) * sizeof(std::uint32_t);
+	return {buf.buffer(), size, buf.offset()};
+}
+
+void Context::rerecord() {
+	rerecord_ = true;
+	stats_.rerecords.push_back({nullptr, RerecordReason::user});
+}
+
+void Context::rerecord(const DeviceObject& obj, RerecordReason reason) {
+	rerecord_ = true;
+	stats_.rerecords.push_back({&obj, reason});
+}
+
 std::pair<bool, vk::Semaphore> Context::upload(bool submit) {
 	auto rerecord = updateDevice();
 	auto seph = stageUpload(submit);
@@ -269,26 +1148,112 @@ std::pair<bool, vk::Semaphore> Context::upload(bool submit) {
 }
 
 vk::Semaphore Context::stageUpload(bool submit) {
+	auto zone = TraceZone(*this, "rvg::Context::stageUpload",
+		stats_.time.stageUpload);
+
+	// The previous frame has completed (see the stageUpload requirements)
+	// so all its queries are available.
+	if(profiling_ && queriesReset_) {
+		resolveQueries();
+	}
+
 	vk::Semaphore ret {};
-	if(!currentFrame_.cmdBufs.empty()) {
+	auto& layerDraws = currentFrame_.layerDraws;
+	if(!currentFrame_.cmdBufs.empty() || profiling_ || !layerDraws.empty()) {
+		// the queries can only be reset outside of a render pass so
+		// we do it in the primary buffer executing before rendering
+		auto profileUpload = profiling_ && !uploadSubmitter_;
+
 		// we currently record secondary buffers and then unify
 		// them here as one since we might need the ordering
 		// guarantees. Not really sure though (can currently
 		// only think of Texture and that might be solveable
 		// in a different way). Investigate/profile.
 		vk::beginCommandBuffer(uploadCmdBuf_, {});
+		if(profileUpload) {
+			resetQueries(uploadCmdBuf_);
+			vk::cmdWriteTimestamp(uploadCmdBuf_,
+				vk::PipelineStageBits::topOfPipe, queryPool_, 2 * uploadQuery);
+		}
+
 		for(auto& buf : currentFrame_.cmdBufs) {
 			vk::cmdExecuteCommands(uploadCmdBuf_, {{buf.second.vkHandle()}});
 		}
+
+		if(profileUpload) {
+			vk::cmdWriteTimestamp(uploadCmdBuf_,
+				vk::PipelineStageBits::bottomOfPipe, queryPool_,
+				2 * uploadQuery + 1);
+		}
 		vk::endCommandBuffer(uploadCmdBuf_);
 
+		// Layers are rendered on the rendering queue after the uploads
+		// (and ownership acquisitions), they insert the needed barriers.
 		auto& qs = device().queueSubmitter();
+		submitCmdBufs_.clear();
+		submitCmdBufs_.push_back(uploadSubmitter_ ?
+			acquireCmdBuf_.vkHandle() : uploadCmdBuf_.vkHandle());
+		submitCmdBufs_.insert(submitCmdBufs_.end(),
+			layerDraws.begin(), layerDraws.end());
+
 		vk::SubmitInfo info;
 		info.commandBufferCount = 1;
 		info.pCommandBuffers = &uploadCmdBuf_.vkHandle();
 		info.pSignalSemaphores = &uploadSemaphore_.vkHandle();
 		info.signalSemaphoreCount = 1u;
-		qs.add(info);
+
+		if(uploadSubmitter_) {
+			// The upload work runs on the upload queue, the rendering
+			// queue then acquires ownership of all written resources.
+			// We always submit the upload work here since the semaphore
+			// it signals must be submitted before the waiting acquire
+			// submission.
+			info.pSignalSemaphores = &transferSemaphore_.vkHandle();
+			uploadSubmitter_->add(info);
+			uploadSubmitter_->submit();
+
+			std::vector<vk::BufferMemoryBarrier> bufBarriers;
+			std::vector<vk::ImageMemoryBarrier> imgBarriers;
+			bufBarriers.reserve(currentFrame_.bufAcquires.size());
+			imgBarriers.reserve(currentFrame_.imgAcquires.size());
+			for(auto& acquire : currentFrame_.bufAcquires) {
+				bufBarriers.push_back(acquire.second);
+			}
+
+			for(auto& acquire : currentFrame_.imgAcquires) {
+				imgBarriers.push_back(acquire.second);
+			}
+
+			vk::beginCommandBuffer(acquireCmdBuf_, {});
+			if(profiling_) {
+				resetQueries(acquireCmdBuf_);
+			}
+
+			vk::cmdPipelineBarrier(acquireCmdBuf_,
+				vk::PipelineStageBits::topOfPipe,
+				vk::PipelineStageBits::allCommands,
+				{}, {}, bufBarriers, imgBarriers);
+			vk::endCommandBuffer(acquireCmdBuf_);
+
+			// must stay valid until the submission is done
+			static const vk::PipelineStageFlags acquireStage =
+				vk::PipelineStageBits::allCommands;
+
+			vk::SubmitInfo acquire;
+			acquire.commandBufferCount = submitCmdBufs_.size();
+			acquire.pCommandBuffers = submitCmdBufs_.data();
+			acquire.waitSemaphoreCount = 1u;
+			acquire.pWaitSemaphores = &transferSemaphore_.vkHandle();
+			acquire.pWaitDstStageMask = &acquireStage;
+			acquire.pSignalSemaphores = &uploadSemaphore_.vkHandle();
+			acquire.signalSemaphoreCount = 1u;
+			qs.add(acquire);
+		} else {
+			info.commandBufferCount = submitCmdBufs_.size();
+			info.pCommandBuffers = submitCmdBufs_.data();
+			qs.add(info);
+		}
+
 		ret = uploadSemaphore_;
 
 		if(submit) {
@@ -297,14 +1262,94 @@ vk::Semaphore Context::stageUpload(bool submit) {
 	}
 
 	oldFrame_ = std::move(currentFrame_);
+
+	zone.end();
+	lastStats_ = std::move(stats_);
+	stats_ = {};
+
 	return ret;
 }
 
+void Context::beginRegion(vk::CommandBuffer cb, std::string_view label) {
+	if(!profiling_) {
+		return;
+	}
+
+	auto& state = recordState(cb);
+	if(freeQueries_.empty()) {
+		dlg_warn("Too many profiling regions, see "
+			"ContextSettings::maxProfilingRegions");
+		state.openRegions.push_back(unsigned(-1));
+		return;
+	}
+
+	auto query = freeQueries_.back();
+	freeQueries_.pop_back();
+	queryLabels_[query] = label;
+	state.queries.push_back(query);
+	state.openRegions.push_back(query);
+
+	vk::cmdWriteTimestamp(cb, vk::PipelineStageBits::topOfPipe,
+		queryPool_, 2 * query);
+}
+
+void Context::endRegion(vk::CommandBuffer cb) {
+	if(!profiling_) {
+		return;
+	}
+
+	auto& state = recordState(cb);
+	dlg_assertm(!state.openRegions.empty(), "No profiling region to end");
+	auto query = state.openRegions.back();
+	state.openRegions.pop_back();
+	if(query == unsigned(-1)) {
+		return;
+	}
+
+	vk::cmdWriteTimestamp(cb, vk::PipelineStageBits::bottomOfPipe,
+		queryPool_, 2 * query + 1);
+}
+
+void Context::resetQueries(vk::CommandBuffer cb) {
+	vk::cmdResetQueryPool(cb, queryPool_, 0, 2 * queryLabels_.size());
+	queriesReset_ = true;
+}
+
+void Context::resolveQueries() {
+	// value and availability for each query
+	std::vector<std::uint64_t> data(4 * queryLabels_.size());
+	auto flags = vk::QueryResultBits::e64 |
+		vk::QueryResultBits::withAvailability;
+	vk::getQueryPoolResults(device(), queryPool_, 0, 2 * queryLabels_.size(),
+		data.size() * sizeof(data[0]), data.data(), 2 * sizeof(data[0]),
+		flags);
+
+	auto period = device().properties().limits.timestampPeriod;
+	auto& gpu = stats_.gpu;
+	for(auto i = 0u; i < queryLabels_.size(); ++i) {
+		auto& label = queryLabels_[i];
+		auto* res = &data[4 * i];
+		if(label.empty() || !res[1] || !res[3] || res[2] < res[0]) {
+			continue;
+		}
+
+		auto ns = double(res[2] - res[0]) * period;
+		auto it = std::find_if(gpu.begin(), gpu.end(),
+			[&](auto& region) { return region.label == label; });
+		if(it == gpu.end()) {
+			gpu.push_back({label, {}, 0u});
+			it = gpu.end() - 1;
+		}
+
+		it->time += std::chrono::duration<double, std::nano>(ns);
+		++it->count;
+	}
+}
+
 vpp::CommandBuffer Context::uploadCmdBuf() {
-	auto family = device().queueSubmitter().queue().family();
 	auto flags = vk::CommandPoolCreateBits::resetCommandBuffer |
 			vk::CommandPoolCreateBits::transient;
-	auto cmd = device().commandAllocator().get(family, flags,
+	auto cmd = device().commandAllocator().get(uploadFamily_, flags,
 		vk::CommandBufferLevel::secondary);
 
 	vk::CommandBufferInheritanceInfo inherit;
@@ -318,15 +1363,135 @@ vpp::CommandBuffer Context::uploadCmdBuf() {
 
 void Context::addStage(vpp::SubBuffer&& buf) {
 	if(buf.size()) {
+		++stats_.stagingBuffers;
 		currentFrame_.stages.emplace_back(std::move(buf));
 	}
 }
 
 void Context::addCommandBuffer(DevRes obj, vpp::CommandBuffer&& buf) {
 	vk::endCommandBuffer(buf);
+	++stats_.uploadCmdBufs;
 	currentFrame_.cmdBufs.emplace_back(obj, std::move(buf));
 }
 
+void Context::finishUpload(DevRes obj, vk::CommandBuffer cb,
+		const vpp::BufferSpan& span, vk::PipelineStageFlags srcStage,
+		vk::AccessFlags srcAccess) {
+	if(!uploadSubmitter_) {
+		// the semaphore signaled by the upload submission is enough
+		return;
+	}
+
+	vk::BufferMemoryBarrier barrier;
+	barrier.buffer = span.buffer();
+	barrier.offset = span.offset();
+	barrier.size = span.size();
+	barrier.srcQueueFamilyIndex = uploadFamily_;
+	barrier.dstQueueFamilyIndex = renderFamily_;
+	barrier.srcAccessMask = srcAccess;
+	vk::cmdPipelineBarrier(cb, srcStage,
+		vk::PipelineStageBits::bottomOfPipe, {}, {}, {{barrier}}, {});
+
+	barrier.srcAccessMask = {};
+	barrier.dstAccessMask = vk::AccessBits::memoryRead;
+	currentFrame_.bufAcquires.emplace_back(obj, barrier);
+}
+
+void Context::finishUpload(DevRes obj, vk::CommandBuffer cb,
+		vk::ImageMemoryBarrier barrier) {
+	if(!uploadSubmitter_) {
+		vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::transfer,
+			vk::PipelineStageBits::allGraphics, {}, {}, {}, {{barrier}});
+		return;
+	}
+
+	// release, the layout transition is done (once) by both barriers
+	auto dstAccess = barrier.dstAccessMask;
+	barrier.srcQueueFamilyIndex = uploadFamily_;
+	barrier.dstQueueFamilyIndex = renderFamily_;
+	barrier.dstAccessMask = {};
+	vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::transfer,
+		vk::PipelineStageBits::bottomOfPipe, {}, {}, {}, {{barrier}});
+
+	barrier.srcAccessMask = {};
+	barrier.dstAccessMask = dstAccess;
+	currentFrame_.imgAcquires.emplace_back(obj, barrier);
+}
+
+nytl::Span<std::byte> Context::mapped(const vpp::BufferSpan& span) {
+	// We map the whole memory once per frame. The maps are released in
+	// flushMapped, i.e. they never outlive the buffers written through
+	// them, no matter when the allocators free their memory blocks.
+	auto& buf = span.buffer();
+	auto& mem = buf.memory();
+	auto it = maps_.find(mem.vkHandle());
+	if(it == maps_.end()) {
+		auto map = Map {mem.map({0u, mem.size()}), mem.size()};
+		it = maps_.emplace(mem.vkHandle(), std::move(map)).first;
+	}
+
+	auto offset = buf.memoryOffset() + span.offset();
+	auto& type = device().memoryProperties().memoryTypes[mem.type()];
+	if(!(type.propertyFlags & vk::MemoryPropertyBits::hostCoherent)) {
+		flushRanges_.push_back({mem.vkHandle(), offset, span.size()});
+	}
+
+	auto ptr = it->second.view.ptr() + offset;
+	return {ptr, std::size_t(span.size())};
+}
+
+void Context::flushMapped() {
+	if(flushRanges_.empty()) {
+		maps_.clear();
+		return;
+	}
+
+	// align to nonCoherentAtomSize and merge overlapping ranges
+	auto atom = device().properties().limits.nonCoherentAtomSize;
+	for(auto& range : flushRanges_) {
+		auto end = range.offset + range.size;
+		range.offset = atom * (range.offset / atom);
+		range.size = atom * ((end - range.offset + atom - 1) / atom);
+	}
+
+	std::sort(flushRanges_.begin(), flushRanges_.end(),
+		[](auto& a, auto& b) {
+			return a.memory == b.memory ?
+				a.offset < b.offset :
+				a.memory < b.memory;
+		});
+
+	std::vector<vk::MappedMemoryRange> ranges;
+	ranges.reserve(flushRanges_.size());
+	ranges.push_back(flushRanges_[0]);
+	for(auto i = 1u; i < flushRanges_.size(); ++i) {
+		auto& range = flushRanges_[i];
+		auto& last = ranges.back();
+		if(range.memory == last.memory &&
+				range.offset <= last.offset + last.size) {
+			auto end = std::max(last.offset + last.size,
+				range.offset + range.size);
+			last.size = end - last.offset;
+		} else {
+			ranges.push_back(range);
+		}
+	}
+
+	// rounding up the size must not exceed the memory size
+	for(auto& range : ranges) {
+		auto it = maps_.find(range.memory);
+		dlg_assert(it != maps_.end());
+		if(range.offset + range.size > it->second.size) {
+			range.size = vk::wholeSize;
+		}
+	}
+
+	// the memory must still be mapped while flushing
+	vk::flushMappedMemoryRanges(device(), ranges);
+	flushRanges_.clear();
+	maps_.clear();
+}
+
 void Context::registerUpdateDevice(DevRes obj) {
 	updateDevice_.insert(obj);
 }
@@ -338,9 +1503,15 @@ bool Context::deviceObjectDestroyed(::rvg::DeviceObject& obj) noexcept {
 		return &obj == ud;
 	};
 
-	auto& bufs = currentFrame_.cmdBufs;
-	bufs.erase(std::remove_if(bufs.begin(), bufs.end(),
-		[&](auto& b) { return std::visit(compareVisitor, b.first); }), bufs.end());
+	auto eraseFrom = [&](auto& vec) {
+		vec.erase(std::remove_if(vec.begin(), vec.end(),
+			[&](auto& b) { return std::visit(compareVisitor, b.first); }),
+			vec.end());
+	};
+
+	eraseFrom(currentFrame_.cmdBufs);
+	eraseFrom(currentFrame_.bufAcquires);
+	eraseFrom(currentFrame_.imgAcquires);
 
 	// remove it from updateDevice_ vector
 	auto it = updateDevice_.begin();
@@ -367,16 +1538,22 @@ void Context::deviceObjectMoved(::rvg::DeviceObject& o,
 
 	auto it = updateDevice_.begin();
 
-	// move device object in currentFrame_.cmdBufs
-	for(auto& b : currentFrame_.cmdBufs) {
-		auto updateVisitor = [&](auto* ud) {
-			if(ud == &o) {
-				b.first = static_cast<decltype(ud)>(&n);
-			}
-		};
+	// move device object in currentFrame_.cmdBufs and the acquires
+	auto moveIn = [&](auto& vec) {
+		for(auto& b : vec) {
+			auto updateVisitor = [&](auto* ud) {
+				if(ud == &o) {
+					b.first = static_cast<decltype(ud)>(&n);
+				}
+			};
 
-		std::visit(updateVisitor, b.first);
-	}
+			std::visit(updateVisitor, b.first);
+		}
+	};
+
+	moveIn(currentFrame_.cmdBufs);
+	moveIn(currentFrame_.bufAcquires);
+	moveIn(currentFrame_.imgAcquires);
 
 	// move it in updateDevice_
 	auto visitor = [&](auto* ud) {
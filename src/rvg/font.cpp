@@ -17,6 +17,18 @@
 // TODO: currently fonts cannot be removed from a font atlas.
 
 namespace rvg {
+namespace {
+
+unsigned glyphCount(FONScontext& stash) {
+	auto count = 0u;
+	for(auto i = 0; i < stash.nfonts; ++i) {
+		count += stash.fonts[i]->nglyphs;
+	}
+
+	return count;
+}
+
+} // anon namespace
 
 // FontAtlas
 FontAtlas::FontAtlas(Context& ctx) : DeviceObject(ctx) {
@@ -35,6 +47,12 @@ FontAtlas::~FontAtlas() {
 }
 
 void FontAtlas::validate() {
+	auto count = glyphCount(*ctx_);
+	if(count > glyphCount_) {
+		context().frameStats().glyphsRasterized += count - glyphCount_;
+	}
+	glyphCount_ = count;
+
 	int dirty[4];
 	if(fonsValidateTexture(ctx_, dirty)) {
 		// TODO: use dirty rect, don't update all in updateDevice
@@ -55,6 +73,7 @@ void FontAtlas::expand() {
 	// could use ExpandAtlas. Try it and see if the result is much worse
 	// (since rectpacking cannot be done again)
 	fonsResetAtlas(ctx_, w, h);
+	glyphCount_ = 0u;
 	for(auto& t : texts_) {
 		dlg_assert(t);
 		t->update();
@@ -95,8 +114,10 @@ bool FontAtlas::updateDevice() {
 
 	auto dptr = reinterpret_cast<const std::byte*>(data);
 	auto dsize = fs.x * fs.y;
+	++ctx.frameStats().atlasUploads;
 	if(fs != texture_.size()) {
 		texture_ = {ctx, fs, {dptr, dsize}, rvg::TextureType::a8};
+		ctx.rerecord(*this, RerecordReason::descriptor);
 		rerecord = true;
 
 		vpp::DescriptorSetUpdate update(ds_);
@@ -0,0 +1,184 @@
+// Copyright (c) 2019 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include <rvg/instanced.hpp>
+#include <rvg/context.hpp>
+#include <rvg/util.hpp>
+#include <vpp/vk.hpp>
+#include <dlg/dlg.hpp>
+
+#include <algorithm>
+#include <array>
+
+namespace rvg {
+namespace {
+
+// fill, aa fill, stroke
+constexpr auto commandsSize = 3 * sizeof(vk::DrawIndirectCommand);
+constexpr auto strokeOffset = 2 * sizeof(vk::DrawIndirectCommand);
+
+} // anon namespace
+
+InstancedShape::InstancedShape(Context& ctx, Span<const Vec2f> points,
+		const DrawMode& mode, Span<const Instance> insts) :
+			DeviceObject(ctx), polygon_(ctx) {
+	dlg_assertm(ctx.settings().instancing,
+		"InstancedShape requires ContextSettings::instancing");
+
+	update(points, mode);
+	instances(insts);
+
+	polygon_.updateDevice();
+	updateDevice();
+}
+
+void InstancedShape::update(Span<const Vec2f> points, const DrawMode& mode) {
+	dlg_assert(valid());
+	drawMode_ = mode;
+
+	// the instanced pipelines only support float vertices in strips
+	drawMode_.compact = false;
+	drawMode_.strokeType = StrokeType::strip;
+	polygon_.update(points, drawMode_);
+	commandsDirty_ = true;
+	context().registerUpdateDevice(this);
+}
+
+unsigned InstancedShape::add(const Instance& instance) {
+	dlg_assert(valid());
+	instances_.push_back(instance);
+	auto id = unsigned(instances_.size() - 1);
+	dirty(id, id + 1);
+	commandsDirty_ = true;
+	return id;
+}
+
+void InstancedShape::instance(unsigned i, const Instance& instance) {
+	dlg_assert(valid());
+	instances_.at(i) = instance;
+	dirty(i, i + 1);
+}
+
+void InstancedShape::remove(unsigned i) {
+	dlg_assert(valid());
+	dlg_assert(i < instances_.size());
+	auto last = unsigned(instances_.size() - 1);
+	if(i != last) {
+		instances_[i] = instances_[last];
+		dirty(i, i + 1);
+	}
+
+	instances_.pop_back();
+	commandsDirty_ = true;
+	context().registerUpdateDevice(this);
+}
+
+void InstancedShape::instances(Span<const Instance> insts) {
+	dlg_assert(valid());
+	instances_ = {insts.begin(), insts.end()};
+	dirty(0, instances_.size());
+	commandsDirty_ = true;
+}
+
+void InstancedShape::dirty(unsigned begin, unsigned end) {
+	if(dirtyBegin_ == dirtyEnd_) {
+		dirtyBegin_ = begin;
+		dirtyEnd_ = end;
+	} else {
+		dirtyBegin_ = std::min(dirtyBegin_, begin);
+		dirtyEnd_ = std::max(dirtyEnd_, end);
+	}
+
+	context().registerUpdateDevice(this);
+}
+
+bool InstancedShape::updateDevice() {
+	dlg_assertm(valid(), "InstancedShape must not be in invalid state");
+
+	auto rerecord = false;
+	auto& ctx = context();
+	auto needed = commandsSize + instances_.size() * sizeof(Instance);
+	if(buf_.size() < needed) {
+		auto usage = vk::BufferUsageFlags(vk::BufferUsageBits::vertexBuffer |
+			vk::BufferUsageBits::indirectBuffer);
+		if(drawMode_.deviceLocal) {
+			usage |= vk::BufferUsageBits::transferDst;
+		}
+
+		auto& dev = ctx.device();
+		auto memBits = drawMode_.deviceLocal ?
+			dev.deviceMemoryTypes() :
+			dev.hostMemoryTypes();
+		buf_ = {ctx.bufferAllocator(), needed * 2, usage, memBits, 4u};
+		++ctx.frameStats().reallocations;
+		ctx.rerecord(*this, RerecordReason::realloc);
+		rerecord = true;
+
+		commandsDirty_ = true;
+		dirtyBegin_ = 0u;
+		dirtyEnd_ = instances_.size();
+	}
+
+	// the number of instances is only part of the indirect commands,
+	// changing it never requires a rerecord
+	if(commandsDirty_) {
+		std::array<vk::DrawIndirectCommand, 3> cmds {};
+		auto count = std::uint32_t(instances_.size());
+		if(drawMode_.fill) {
+			auto counts = polygon_.vertexCounts(DrawType::fill);
+			for(auto i = 0u; i < counts.size(); ++i) {
+				cmds[i].vertexCount = counts[i];
+				cmds[i].instanceCount = count;
+			}
+		}
+
+		if(drawMode_.stroke > 0.f) {
+			auto counts = polygon_.vertexCounts(DrawType::stroke);
+			cmds[2].vertexCount = counts[0];
+			cmds[2].instanceCount = count;
+		}
+
+		auto off = buf_.offset();
+		writeBuffer(*this, {buf_.buffer(), commandsSize, off}, cmds);
+		commandsDirty_ = false;
+	}
+
+	if(dirtyEnd_ > dirtyBegin_) {
+		auto off = commandsSize + dirtyBegin_ * sizeof(Instance);
+		auto size = (dirtyEnd_ - dirtyBegin_) * sizeof(Instance);
+		auto data = nytl::span(instances_.data() + dirtyBegin_,
+			dirtyEnd_ - dirtyBegin_);
+		off += buf_.offset();
+		writeBuffer(*this, {buf_.buffer(), size, off}, data);
+	}
+
+	dirtyBegin_ = dirtyEnd_ = 0u;
+	return rerecord;
+}
+
+void InstancedShape::fill(vk::CommandBuffer cb) const {
+	dlg_assertm(drawMode_.fill, "InstancedShape has no fill data");
+	dlg_assert(valid() && buf_.size());
+
+	auto buf = buf_.buffer().vkHandle();
+	vk::Buffer buffers[1] = {buf};
+	vk::DeviceSize offsets[1] = {buf_.offset() + commandsSize};
+	context().bindVertexBuffers(cb, 3, buffers, offsets);
+
+	// the aa fill command directly follows the fill command
+	polygon_.fillInstanced(cb, buf, buf_.offset());
+}
+
+void InstancedShape::stroke(vk::CommandBuffer cb) const {
+	dlg_assertm(drawMode_.stroke > 0.f, "InstancedShape has no stroke data");
+	dlg_assert(valid() && buf_.size());
+
+	auto buf = buf_.buffer().vkHandle();
+	vk::Buffer buffers[1] = {buf};
+	vk::DeviceSize offsets[1] = {buf_.offset() + commandsSize};
+	context().bindVertexBuffers(cb, 3, buffers, offsets);
+	polygon_.strokeInstanced(cb, buf, buf_.offset() + strokeOffset);
+}
+
+} // namespace rvg
@@ -0,0 +1,208 @@
+// Copyright (c) 2019 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include <rvg/layer.hpp>
+#include <rvg/context.hpp>
+#include <rvg/scene.hpp>
+#include <vpp/vk.hpp>
+#include <vpp/commandAllocator.hpp>
+#include <dlg/dlg.hpp>
+
+#include <array>
+#include <algorithm>
+#include <cmath>
+
+namespace rvg {
+namespace {
+
+// Maps the given rect to the [0, 1] (uv) or [-1, 1] (ndc) range.
+Mat4f rectMatrix(const Rect2f& rect, bool ndc) {
+	auto mat = nytl::identity<4, float>();
+	auto scale = ndc ? 2.f : 1.f;
+	auto off = ndc ? -1.f : 0.f;
+	mat[0][0] = scale / rect.size.x;
+	mat[1][1] = scale / rect.size.y;
+	mat[0][3] = -scale * rect.position.x / rect.size.x + off;
+	mat[1][3] = -scale * rect.position.y / rect.size.y + off;
+	return mat;
+}
+
+} // anon namespace
+
+Layer::Layer(Context& ctx, Scene& content, const Rect2f& bounds,
+		const Color& clear) : context_(&ctx), content_(&content),
+			bounds_(bounds), clear_(clear) {
+	dlg_assert(bounds.size.x > 0.f && bounds.size.y > 0.f);
+
+	cmdBuf_ = ctx.device().commandAllocator().get(ctx.renderQueueFamily(),
+		vk::CommandPoolCreateBits::resetCommandBuffer);
+
+	transform_ = {ctx, rectMatrix(bounds, true)};
+	quad_ = {ctx, bounds.position, bounds.size, {true, 0.f}};
+	resize(neededSize());
+
+	ctx.registerLayer(*this);
+}
+
+Layer::~Layer() {
+	if(context_) {
+		context_->unregisterLayer(*this);
+	}
+}
+
+void Layer::follow(const Transform* transform, Vec2f viewportSize) {
+	follow_ = transform;
+	viewportSize_ = viewportSize;
+}
+
+void Layer::bounds(const Rect2f& bounds) {
+	dlg_assert(bounds.size.x > 0.f && bounds.size.y > 0.f);
+	bounds_ = bounds;
+	transform_.matrix(rectMatrix(bounds, true));
+
+	auto qc = quad_.change();
+	qc->position = bounds.position;
+	qc->size = bounds.size;
+
+	// the uv matrix changed
+	resize(size_);
+	dirty_ = true;
+}
+
+Vec2ui Layer::neededSize() const {
+	auto scale = Vec2f {1.f, 1.f};
+	if(follow_) {
+		// pixels per unit along both axes of the layer
+		auto& m = follow_->matrix();
+		auto hw = 0.5f * viewportSize_.x;
+		auto hh = 0.5f * viewportSize_.y;
+		scale.x = std::hypot(m[0][0] * hw, m[1][0] * hh);
+		scale.y = std::hypot(m[0][1] * hw, m[1][1] * hh);
+	}
+
+	auto max = context().device().properties().limits.maxImageDimension2D;
+	auto dim = [&](float size) {
+		auto px = std::ceil(size);
+		return std::uint32_t(std::clamp(px, 1.f, float(max)));
+	};
+
+	return {dim(bounds_.size.x * scale.x), dim(bounds_.size.y * scale.y)};
+}
+
+void Layer::resize(Vec2ui size) {
+	auto& ctx = context();
+	if(size != size_) {
+		size_ = size;
+
+		constexpr auto usage =
+			vk::ImageUsageBits::colorAttachment |
+			vk::ImageUsageBits::sampled;
+		vpp::ViewableImageCreateInfo info(format,
+			vk::ImageAspectBits::color, {size.x, size.y}, usage);
+
+		auto& dev = ctx.device();
+		auto memBits = dev.memoryTypeBits(vk::MemoryPropertyBits::deviceLocal);
+		image_ = {ctx.devMemAllocator(), info, memBits};
+
+		// the render pass decides the stencil format
+		auto& rp = ctx.layerRenderPass();
+		std::array<vk::ImageView, 2> views = {image_.vkImageView()};
+		auto stencil = ctx.settings().stencilFill;
+		if(stencil) {
+			auto sformat = ctx.layerStencilFormat();
+			auto aspect = sformat == vk::Format::s8Uint ?
+				vk::ImageAspectFlags(vk::ImageAspectBits::stencil) :
+				vk::ImageAspectBits::depth | vk::ImageAspectBits::stencil;
+			vpp::ViewableImageCreateInfo sinfo(sformat, aspect,
+				{size.x, size.y}, vk::ImageUsageBits::depthStencilAttachment);
+			stencil_ = {ctx.devMemAllocator(), sinfo, memBits};
+			views[1] = stencil_.vkImageView();
+		}
+
+		vk::FramebufferCreateInfo fbi;
+		fbi.renderPass = rp;
+		fbi.attachmentCount = 1u + stencil;
+		fbi.pAttachments = views.data();
+		fbi.width = size.x;
+		fbi.height = size.y;
+		fbi.layers = 1;
+		fb_ = {dev, fbi};
+		dirty_ = true;
+	}
+
+	auto data = texturePaintRGBA(rectMatrix(bounds_, false),
+		image_.vkImageView(), true);
+	if(!paint_.valid()) {
+		paint_ = {ctx, data};
+	} else {
+		paint_.paint(data);
+	}
+}
+
+void Layer::updateDevice() {
+	// only follow the scale when it changed significantly
+	auto needed = neededSize();
+	if(needed.x > size_.x || needed.y > size_.y ||
+			2 * needed.x < size_.x || 2 * needed.y < size_.y) {
+		resize(needed);
+	}
+
+	if(dirty_ || content_->version() != version_ || content_->updated()) {
+		render();
+	}
+}
+
+void Layer::render() {
+	auto& ctx = context();
+	vk::CommandBuffer cb = cmdBuf_;
+
+	vk::beginCommandBuffer(cb, {});
+
+	// the uploads of this frame are executed before
+	vk::MemoryBarrier barrier;
+	barrier.srcAccessMask = vk::AccessBits::transferWrite;
+	barrier.dstAccessMask =
+		vk::AccessBits::vertexAttributeRead |
+		vk::AccessBits::indexRead |
+		vk::AccessBits::indirectCommandRead |
+		vk::AccessBits::uniformRead |
+		vk::AccessBits::shaderRead;
+	vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::transfer,
+		vk::PipelineStageBits::allGraphics, {}, {{barrier}}, {}, {});
+
+	// premultiplied, linear since the image has an srgb format
+	auto c = toLinear(clear_);
+	std::array<vk::ClearValue, 2> clearValues {};
+	clearValues[0].color = {{c[3] * c[0], c[3] * c[1], c[3] * c[2], c[3]}};
+	clearValues[1].depthStencil = {1.f, 0u}; // ContextSettings::stencilFill
+
+	vk::cmdBeginRenderPass(cb, {
+		ctx.layerRenderPass(),
+		fb_,
+		{0u, 0u, size_.x, size_.y},
+		1u + ctx.settings().stencilFill,
+		clearValues.data()
+	}, {});
+
+	vk::Viewport vp {0.f, 0.f, float(size_.x), float(size_.y), 0.f, 1.f};
+	vk::cmdSetViewport(cb, 0, 1, vp);
+	vk::cmdSetScissor(cb, 0, 1, {0, 0, size_.x, size_.y});
+
+	ctx.recordState(cb).layer = true;
+	content_->record(cb, &transform_);
+
+	vk::cmdEndRenderPass(cb);
+	vk::endCommandBuffer(cb);
+
+	ctx.addLayerDraw(cb);
+	version_ = content_->version();
+	dirty_ = false;
+}
+
+void Layer::draw(vk::CommandBuffer cb) const {
+	paint_.bind(cb);
+	quad_.fill(cb);
+}
+
+} // namespace rvg
@@ -302,11 +302,13 @@ PaintData radialGradient(Vec2f center, float innerRadius, float outerRadius,
 	return ret;
 }
 
-PaintData texturePaintRGBA(const nytl::Mat4f& transform, vk::ImageView iv) {
+PaintData texturePaintRGBA(const nytl::Mat4f& transform, vk::ImageView iv,
+		bool premultiplied) {
 	PaintData ret;
 	ret.texture = iv;
 	ret.data.transform = transform;
 	ret.data.frag.inner = Color::white;
+	ret.data.frag.custom.x = premultiplied;
 	ret.data.frag.type = PaintType::textureRGBA;
 	return ret;
 }
@@ -327,7 +329,6 @@ PaintData pointColorPaint() {
 }
 
 // Paint
-constexpr auto paintUboSize = sizeof(nytl::Mat4f) + sizeof(Vec4f) * 3 + 4;
 Paint::Paint(Context& ctx, const PaintData& xpaint, bool deviceLocal) :
 		DeviceObject(ctx), paint_(xpaint) {
 
@@ -336,31 +337,18 @@ Paint::Paint(Context& ctx, const PaintData& xpaint, bool deviceLocal) :
 	}
 
 	oldView_ = paint_.texture;
-	auto usage = nytl::Flags{vk::BufferUsageBits::uniformBuffer};
-	if(deviceLocal) {
-		usage |= vk::BufferUsageBits::transferDst;
-	}
-	auto memBits = deviceLocal ?
-		context().device().deviceMemoryTypes() :
-		context().device().hostMemoryTypes();
-	ubo_ = {ctx.bufferAllocator(), paintUboSize, usage, memBits, 16u};
-
-	ds_ = {ctx.dsAllocator(), ctx.dsLayoutPaint()};
+	slot_ = ctx.paintArena(deviceLocal).allocate();
 	upload();
-
-	vpp::DescriptorSetUpdate update(ds_);
-	update.uniform({{ubo_.buffer(), ubo_.offset(), ubo_.size()}});
-	update.imageSampler({{{}, paint_.texture,
-		vk::ImageLayout::shaderReadOnlyOptimal}});
+	updateDs();
 }
 
 void Paint::update() {
-	dlg_assert(valid() && ds_ && ubo_.size());
+	dlg_assert(valid() && slot_.valid());
 	context().registerUpdateDevice(this);
 }
 
 void Paint::upload() {
-	dlg_assert(valid() && ubo_.size());
+	dlg_assert(valid() && slot_.valid());
 	struct PaintUbo {
 		nytl::Mat4f transform;
 		nytl::Vec4f inner;
@@ -388,17 +376,43 @@ void Paint::upload() {
 	ubo.custom = paint_.data.frag.custom;
 	ubo.type = unsigned(paint_.data.frag.type);
 
-	writeBuffer(*this, ubo_, ubo);
+	static_assert(sizeof(ubo) == uboSize);
+	writeBuffer(*this, slot_.span(), ubo);
+}
+
+// Paints without texture can use the descriptor set of their arena
+// block (which has the empty image bound), only paints with a
+// texture need their own descriptor set.
+void Paint::updateDs() {
+	auto& ctx = context();
+	if(paint_.texture == ctx.emptyImage().vkImageView()) {
+		ds_ = {};
+		return;
+	}
+
+	if(!ds_) {
+		ds_ = {ctx.dsAllocator(), ctx.dsLayoutPaint()};
+	}
+
+	auto& buf = slot_.blockBuffer();
+	vpp::DescriptorSetUpdate update(ds_);
+	update.uniformDynamic({{buf.buffer(), buf.offset(), uboSize}});
+	update.imageSampler({{{}, paint_.texture,
+		vk::ImageLayout::shaderReadOnlyOptimal}});
+}
+
+vk::DescriptorSet Paint::ds() const {
+	return ds_ ? ds_.vkHandle() : slot_.ds();
 }
 
 void Paint::bind(vk::CommandBuffer cb) const {
-	dlg_assert(valid() && ds_ && ubo_.size());
-	vk::cmdBindDescriptorSets(cb, vk::PipelineBindPoint::graphics,
-		context().pipeLayout(), Context::paintBindSet, {{ds_.vkHandle()}}, {});
+	dlg_assert(valid() && slot_.valid());
+	context().bindDescriptorSet(cb, Context::paintBindSet, ds(),
+		slot_.offset());
 }
 
 bool Paint::updateDevice() {
-	dlg_assert(valid() && ds_ && ubo_.size());
+	dlg_assert(valid() && slot_.valid());
 	auto re = false;
 	if(!paint_.texture) {
 		paint_.texture = context().emptyImage().vkImageView();
@@ -407,10 +421,7 @@ bool Paint::updateDevice() {
 	upload();
 
 	if(oldView_ != paint_.texture) {
-		vpp::DescriptorSetUpdate update(ds_);
-		update.skip(2);
-		update.imageSampler({{{}, paint_.texture,
-			vk::ImageLayout::shaderReadOnlyOptimal}});
+		updateDs();
 		oldView_ = paint_.texture;
 		re = true;
 	}
@@ -532,6 +543,13 @@ void Texture::create() {
 void Texture::upload(nytl::Span<const std::byte> data, vk::ImageLayout layout) {
 	auto cmdBuf = context().uploadCmdBuf();
 
+	// When uploading on a separate queue family, we don't acquire the
+	// image back from the rendering family. This is only valid when
+	// discarding the contents, we overwrite them completely anyways.
+	if(context().uploadQueueFamily() != context().renderQueueFamily()) {
+		layout = vk::ImageLayout::undefined;
+	}
+
 	vk::ImageMemoryBarrier barrier;
 	barrier.image = image_.image();
 	barrier.oldLayout = layout;
@@ -553,9 +571,9 @@ void Texture::upload(nytl::Span<const std::byte> data, vk::ImageLayout layout) {
 	barrier.srcAccessMask = vk::AccessBits::transferWrite;
 	barrier.newLayout = vk::ImageLayout::shaderReadOnlyOptimal;
 	barrier.dstAccessMask = vk::AccessBits::shaderRead;
-	vk::cmdPipelineBarrier(cmdBuf, vk::PipelineStageBits::transfer,
-		vk::PipelineStageBits::allGraphics, {}, {}, {}, {{barrier}});
+	context().finishUpload(this, cmdBuf, barrier);
 
+	context().frameStats().stagedBytes += stage.size();
 	context().addStage(std::move(stage));
 	context().addCommandBuffer(this, std::move(cmdBuf));
 }
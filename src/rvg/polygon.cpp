@@ -5,14 +5,60 @@
 #include <rvg/polygon.hpp>
 #include <rvg/context.hpp>
 #include <rvg/util.hpp>
+#include "triangulate.hpp"
+#include "bake.hpp"
+#include "strokeStyle.hpp"
 #include <katachi/stroke.hpp>
 #include <vpp/vk.hpp>
 #include <vpp/bufferOps.hpp>
 #include <nytl/vecOps.hpp>
 #include <dlg/dlg.hpp>
 #include <optional>
+#include <array>
+#include <cmath>
 
 namespace rvg {
+namespace {
+
+// scratch memory for baking vertices that are then packed
+thread_local std::vector<Vec2f> bakeScratch[3];
+
+// scratch memory for the transformed points, see DrawMode::transform
+thread_local std::vector<Vec2f> transformScratch;
+
+// see fill.frag
+constexpr auto typeStroke = 2u;
+constexpr auto typeDashedStroke = 3u;
+
+// Returns the frame for the compact vertex format if it can be used
+// for the given positions, see ContextSettings::compactPrecision.
+std::optional<CompactFrame> compactFrameFor(const Context& ctx,
+		Span<const Vec2f> points, bool allowed) {
+	auto precision = ctx.settings().compactPrecision;
+	if(!allowed || precision <= 0.f || points.empty()) {
+		return std::nullopt;
+	}
+
+	auto frame = rvg::compactFrame(points);
+	if(compactError(frame) > precision) {
+		return std::nullopt;
+	}
+
+	return frame;
+}
+
+// Whether the given transform has no projective part
+bool affine(const nytl::Mat3f& t) {
+	return t[2][0] == 0.f && t[2][1] == 0.f && t[2][2] == 1.f;
+}
+
+Affine2 affinePart(const nytl::Mat3f& t) {
+	return {t[0][0], t[0][1], t[0][2], t[1][0], t[1][1], t[1][2]};
+}
+
+constexpr auto identityAffine = Affine2 {1.f, 0.f, 0.f, 0.f, 1.f, 0.f};
+
+} // anon namespace
 
 // Polygon
 Polygon::Polygon(Context& ctx) : DeviceObject(ctx) {
@@ -21,21 +67,96 @@ Polygon::Polygon(Context& ctx) : DeviceObject(ctx) {
 void Polygon::updateStroke(Span<const Vec2f> points, const DrawMode& mode) {
 	if(mode.color.stroke != flags_.colorStroke) {
 		flags_.colorStroke = mode.color.stroke;
-		context().rerecord();
+		context().rerecord(*this, RerecordReason::drawMode);
 	}
 
 	if(mode.aaStroke != flags_.aaStroke) {
 		flags_.aaStroke = mode.aaStroke;
-		context().rerecord();
+		context().rerecord(*this, RerecordReason::drawMode);
 	}
 
 	dlg_assertm(!flags_.aaStroke || context().antiAliasing(),
 		"Anti aliasing must be enabled in the context");
 
+	auto lines = mode.strokeType != StrokeType::strip;
+	if(lines != flags_.lines) {
+		flags_.lines = lines;
+		context().rerecord(*this, RerecordReason::drawMode);
+	}
+
+	dlg_assertm(!lines || !mode.color.stroke,
+		"Line strokes don't support point colors");
+
+	// The header has room for maxDashes lengths, odd patterns are
+	// repeated. Invalid patterns are fixed up (with a warning) since
+	// the shader must neither read past the header nor use a zero period
+	std::vector<float> pattern;
+	if(!lines && !mode.dash.empty()) {
+		pattern = mode.dash;
+		if(pattern.size() % 2) {
+			pattern.insert(pattern.end(), mode.dash.begin(), mode.dash.end());
+		}
+
+		if(pattern.size() > DrawMode::maxDashes) {
+			dlg_warn("Polygon: {} dash lengths (after repeating), only the "
+				"first {} are used", pattern.size(), DrawMode::maxDashes);
+			pattern.resize(DrawMode::maxDashes);
+		}
+
+		auto period = 0.f;
+		for(auto& length : pattern) {
+			if(!(length >= 0.f) || !std::isfinite(length)) {
+				dlg_warn("Polygon: invalid dash length {}, using 0", length);
+				length = 0.f;
+			}
+
+			period += length;
+		}
+
+		if(!(period > 0.f) || !std::isfinite(period)) {
+			dlg_warn("Polygon: dash pattern has no length, "
+				"drawing a solid stroke");
+			pattern.clear();
+		}
+	}
+
+	auto styled = !lines && (mode.cap != LineCap::butt ||
+		mode.join != LineJoin::miter || mode.miterLimit != 4.f ||
+		!pattern.empty());
+	dlg_assertm(!styled || !mode.color.stroke,
+		"Stroke styles don't support point colors");
+
+	auto dash = !pattern.empty();
+	if(dash != flags_.dash) {
+		// the uniform in front of the aa coords changes its size,
+		// the buffer is recreated (triggers a rerecord)
+		flags_.dash = dash;
+		stroke_.aaBuf = {};
+	}
+
+	dash_.clear();
+	if(dash) {
+		dlg_assertm(context().antiAliasing(),
+			"Dashes need ContextSettings::antiAliasing");
+		dash_ = std::move(pattern);
+		dashOffset_ = mode.dashOffset;
+	}
+
+	auto compute = mode.computeStroke && !lines && !styled &&
+		!mode.color.stroke && context().uploadCompute();
+	if(compute != flags_.computeStroke) {
+		// the buffers need a different usage, will trigger a rerecord
+		flags_.computeStroke = compute;
+		stroke_.pBuf = {};
+		stroke_.aaBuf = {};
+		strokeSrc_ = {};
+	}
+
 	auto sf = mode.aaStroke ? context().fringe() : 0.f;
 	auto width = mode.stroke + sf;
-	auto loop = mode.loop;
-	if(points.size() > 2 && points.front() == points.back()) {
+	auto list = mode.strokeType == StrokeType::lineList;
+	auto loop = mode.loop && !list;
+	if(!list && points.size() > 2 && points.front() == points.back()) {
 		loop = true;
 		points = points.first(points.size() - 1);
 	}
@@ -58,14 +179,57 @@ void Polygon::updateStroke(Span<const Vec2f> points, const DrawMode& mode) {
 		settings.width += fringe * 0.5f;
 	}
 
-	if(mode.color.stroke) {
+	if(flags_.lines) {
+		// only the segments, expanded in the vertex shader, see uploadLines
+		strokeWidth_ = settings.width;
+		linesDirty_ = true;
+		auto& segments = stroke_.points;
+		if(list) {
+			dlg_assertm(points.size() % 2 == 0,
+				"StrokeType::lineList needs pairs of points");
+			segments.assign(points.begin(), points.end());
+		} else if(points.size() > 1) {
+			segments.reserve(2 * (points.size() - 1 + loop));
+			for(auto i = 1u; i < points.size(); ++i) {
+				segments.push_back(points[i - 1]);
+				segments.push_back(points[i]);
+			}
+
+			if(loop) {
+				segments.push_back(points.back());
+				segments.push_back(points.front());
+			}
+		}
+	} else if(styled) {
+		auto style = StrokeStyle {mode.cap, mode.join, mode.miterLimit,
+			context().settings().curveTolerance, dash};
+		auto aa = (flags_.aaStroke || dash) ? &stroke_.aa : nullptr;
+		bakeStyledStroke(points, settings.width, loop, style,
+			stroke_.points, aa);
+	} else if(mode.color.stroke) {
 		ktc::bakeColoredStroke(points, mode.color.points, settings,
 			vertHandler);
+	} else if(flags_.computeStroke) {
+		// expanded on the gpu, see uploadComputeStroke
+		stroke_.baked = strokeVertexCount(points.size(), loop);
+		strokeWidth_ = settings.width;
+		strokeLoop_ = loop;
+		source_.assign(points.begin(), points.end());
+	} else if(mode.bakeDirect) {
+		// baked into the buffers in updateDevice, see uploadBakedStroke
+		stroke_.baked = strokeVertexCount(points.size(), loop);
+		strokeWidth_ = settings.width;
+		strokeLoop_ = loop;
+		source_.assign(points.begin(), points.end());
 	} else {
-		ktc::bakeStroke(points, settings, vertHandler);
+		// bulk path, writes all vertices at once
+		auto count = strokeVertexCount(points.size(), loop);
+		stroke_.points.resize(count);
+		stroke_.aa.resize(flags_.aaStroke ? count : 0u);
+		bakeStroke(points, settings.width, loop, stroke_.points, stroke_.aa);
 	}
 
-	if(flags_.aaStroke && !strokeDs_) {
+	if((flags_.aaStroke || dash) && !strokeDs_) {
 		auto& layout = context().dsLayoutStrokeAA();
 		strokeDs_ = {context().dsAllocator(), layout};
 	}
@@ -74,14 +238,26 @@ void Polygon::updateStroke(Span<const Vec2f> points, const DrawMode& mode) {
 void Polygon::updateFill(Span<const Vec2f> points, const DrawMode& mode) {
 	if(mode.color.fill != flags_.colorFill) {
 		flags_.colorFill = mode.color.fill;
-		context().rerecord();
+		context().rerecord(*this, RerecordReason::drawMode);
 	}
 
 	if(mode.aaFill != flags_.aaFill) {
 		flags_.aaFill = mode.aaFill;
-		context().rerecord();
+		context().rerecord(*this, RerecordReason::drawMode);
+	}
+
+	if(mode.fillRule != fillRule_) {
+		fillRule_ = mode.fillRule;
+		context().rerecord(*this, RerecordReason::drawMode);
 	}
 
+	auto stencil = fillRule_ == FillRule::nonZero ||
+		fillRule_ == FillRule::evenOdd;
+	dlg_assertm(!stencil || (!mode.aaFill && !mode.color.fill),
+		"Stencil fills don't support antialiasing or point colors");
+	dlg_assertm(mode.holes.empty() || (fillRule_ == FillRule::triangulated &&
+		!mode.aaFill), "Holes need FillRule::triangulated without aaFill");
+
 	if(flags_.aaFill) {
 		dlg_assertm(context().antiAliasing(), "Anti aliasing must be \
 			enabled in the context");
@@ -107,26 +283,79 @@ void Polygon::updateFill(Span<const Vec2f> points, const DrawMode& mode) {
 			ktc::bakeColoredFillAA(points, mode.color.points,
 				context().fringe(), fillHandler, strokeHandler);
 		} else {
-			ktc::bakeFillAA(points, context().fringe(), fillHandler,
-				strokeHandler);
+			// bulk path, the fringe is always a loop
+			if(points.size() > 2 && points.front() == points.back()) {
+				points = points.first(points.size() - 1);
+			}
+
+			// triangulation needs the fill points on the host
+			if(mode.bakeDirect && fillRule_ != FillRule::triangulated) {
+				// baked into the buffers in updateDevice, see uploadBakedFill
+				fill_.baked = fillAAVertexCount(points.size());
+				fillAA_.baked = fringeVertexCount(points.size());
+				source_.assign(points.begin(), points.end());
+				return;
+			}
+
+			fill_.points.resize(fillAAVertexCount(points.size()));
+			fillAA_.points.resize(fringeVertexCount(points.size()));
+			fillAA_.aa.resize(fillAA_.points.size());
+			bakeFillAA(points, context().fringe(), fill_.points,
+				fillAA_.points, fillAA_.aa);
 		}
 	} else {
 		// just copy color and points, no processing needed
-		fill_.points.insert(fill_.points.end(), points.begin(), points.end());
+		if(points.data() != fill_.points.data()) {
+			fill_.points.insert(fill_.points.end(), points.begin(),
+				points.end());
+		}
+
 		if(mode.color.fill) {
 			dlg_assert(unsigned(mode.color.points.size()) == points.size());
 			fill_.color.insert(fill_.color.end(),
 				mode.color.points.begin(), mode.color.points.end());
 		}
 	}
+
+	// kept until the next update, only re-uploaded when disabled
+	if(fillRule_ == FillRule::triangulated) {
+		triangulate(fill_.points, mode.holes, indices_);
+	}
 }
 
 void Polygon::update(Span<const Vec2f> points, const DrawMode& mode) {
 	dlg_assertm(valid(), "Polygon must not be in invalid state");
 	dlg_assertm(mode.stroke >= 0.f, "DrawMode::stroke must not be negative");
+	auto zone = TraceZone(context(), "rvg::Polygon::update",
+		context().frameStats().time.bake);
+
+	// pre-transform, in place for the fill points passed to
+	// update(std::vector<Vec2f>&&)
+	transform_ = mode.transform;
+	if(!affine(mode.transform) ||
+			affinePart(mode.transform) != identityAffine) {
+		auto inPlace = points.data() == fill_.points.data();
+		auto& out = inPlace ? fill_.points : transformScratch;
+		out.resize(points.size());
+		if(affine(mode.transform)) {
+			transformPoints(points, affinePart(mode.transform), out);
+		} else {
+			for(auto i = 0u; i < points.size(); ++i) {
+				out[i] = multPos(mode.transform, points[i]);
+			}
+		}
+
+		points = Span<const Vec2f>(out);
+	}
+
+	// the points might already be the fill points, see
+	// update(std::vector<Vec2f>&&)
+	if(points.empty() || points.data() != fill_.points.data()) {
+		fill_.points.clear();
+	}
 
-	fill_.points.clear();
 	fill_.color.clear();
+	indices_.clear();
 	fillAA_.points.clear();
 	fillAA_.color.clear();
 	fillAA_.aa.clear();
@@ -134,13 +363,24 @@ void Polygon::update(Span<const Vec2f> points, const DrawMode& mode) {
 	stroke_.color.clear();
 	stroke_.aa.clear();
 
+	fill_.baked = fillAA_.baked = stroke_.baked = 0u;
+	if(!mode.bakeDirect) {
+		source_ = {};
+	}
+
 	if(mode.deviceLocal != flags_.deviceLocal) {
 		flags_.deviceLocal = mode.deviceLocal;
-		fill_ = {};
+		fill_.pBuf = {};
+		fill_.cBuf = {};
+		cover_ = {};
+		iBuf_ = {};
 		fillAA_ = {};
 		stroke_ = {};
 	}
 
+	// the format of each draw is chosen in updateDevice
+	flags_.compact = mode.compact && context().settings().compactPrecision > 0.f;
+
 	flags_.fill = mode.fill;
 	if(flags_.fill) {
 		updateFill(points, mode);
@@ -151,9 +391,70 @@ void Polygon::update(Span<const Vec2f> points, const DrawMode& mode) {
 		updateStroke(points, mode);
 	}
 
+	// How far the stroke vertices reach from the points (per axis):
+	// the half width, times the miter limit for miter joins and
+	// sqrt(2) for the corners of square caps. Line quads only reach
+	// the half width. Antialiased fills reach the fringe
+	auto reach = 0.f;
+	if(flags_.stroke) {
+		auto sf = flags_.aaStroke ? 1.5f * context().fringe() : 0.f;
+		reach = 0.5f * (mode.stroke + sf);
+		if(!flags_.lines) {
+			auto limit = mode.join == LineJoin::miter ? mode.miterLimit : 1.f;
+			auto cap = mode.cap == LineCap::square ? std::sqrt(2.f) : 1.f;
+			reach *= std::max(limit, cap);
+		}
+	}
+
+	auto fringe = (flags_.fill && flags_.aaFill) ? context().fringe() : 0.f;
+
+	// the offset of the baked vertices, see transform. Lines and
+	// strokes baked in updateDevice are expanded from the points
+	auto expanded = flags_.lines || stroke_.baked;
+	bakedOffset_ = std::max(expanded ? 0.f : reach, fringe);
+
+	// bounds, padded by the reach of the vertices
+	bounds_ = {};
+	pad_ = 0.f;
+	if(!points.empty()) {
+		auto min = points[0];
+		auto max = points[0];
+		for(auto& p : points) {
+			min = {std::min(min.x, p.x), std::min(min.y, p.y)};
+			max = {std::max(max.x, p.x), std::max(max.y, p.y)};
+		}
+
+		auto pad = std::max(reach, fringe);
+		pad_ = pad;
+		bounds_.position = min - Vec2f {pad, pad};
+		bounds_.size = max - min + Vec2f {2 * pad, 2 * pad};
+	}
+
+	cover_.points.clear();
+	if(flags_.fill && (fillRule_ == FillRule::nonZero ||
+			fillRule_ == FillRule::evenOdd)) {
+		auto& b = bounds_;
+		cover_.points = {
+			b.position,
+			b.position + Vec2f {b.size.x, 0.f},
+			b.position + b.size,
+			b.position + Vec2f {0.f, b.size.y},
+		};
+	}
+
 	context().registerUpdateDevice(this);
 }
 
+void Polygon::update(std::vector<Vec2f>&& points, const DrawMode& mode) {
+	if(!mode.fill || mode.aaFill || mode.color.fill) {
+		update(Span<const Vec2f>(points), mode);
+		return;
+	}
+
+	fill_.points = std::move(points);
+	update(Span<const Vec2f>(fill_.points), mode);
+}
+
 void Polygon::disable(bool disable, DrawType type) {
 	auto re = false;
 	if(type == DrawType::strokeFill || type == DrawType::fill) {
@@ -182,6 +483,133 @@ bool Polygon::disabled(DrawType type) const {
 	return ret;
 }
 
+void Polygon::strokeWidth(float width) {
+	dlg_assertm(flags_.stroke && flags_.lines,
+		"Only line strokes can change their width without update");
+	dlg_assertm(width > 0.f, "The stroke width must be positive");
+
+	// see updateStroke
+	auto prev = strokeWidth_;
+	strokeWidth_ = width;
+	if(flags_.aaStroke) {
+		auto fringe = context().fringe();
+		strokeMult_ = (width * 0.5f + fringe * 0.5f) / fringe;
+		strokeWidth_ += 1.5f * fringe;
+	}
+
+	// the bounds are padded by the half width, see update
+	if(!stroke_.points.empty()) {
+		auto grow = 0.5f * (strokeWidth_ - prev);
+		bounds_.position -= Vec2f {grow, grow};
+		bounds_.size += Vec2f {2 * grow, 2 * grow};
+		pad_ += grow;
+	}
+
+	context().registerUpdateDevice(this);
+}
+
+bool Polygon::transform(const nytl::Mat3f& t) {
+	dlg_assertm(valid(), "Polygon must not be in invalid state");
+	if(!affine(t) || !affine(transform_)) {
+		return false;
+	}
+
+	// the change from the baked transform: t = delta * transform_
+	auto from = affinePart(transform_);
+	auto to = affinePart(t);
+	auto det = from[0] * from[4] - from[1] * from[3];
+	if(det == 0.f) {
+		return false;
+	}
+
+	auto i0 = from[4] / det;
+	auto i1 = -from[1] / det;
+	auto i3 = -from[3] / det;
+	auto i4 = from[0] / det;
+
+	Affine2 delta;
+	delta[0] = to[0] * i0 + to[1] * i3;
+	delta[1] = to[0] * i1 + to[1] * i4;
+	delta[3] = to[3] * i0 + to[4] * i3;
+	delta[4] = to[3] * i1 + to[4] * i4;
+	delta[2] = to[2] - (delta[0] * from[2] + delta[1] * from[5]);
+	delta[5] = to[5] - (delta[3] * from[2] + delta[4] * from[5]);
+
+	// only a similarity keeps the shape of the baked vertices. Their
+	// offsets from the points (stroke width, fringe) are scaled as well
+	// though, which is fine as long as it's not noticeable
+	auto s = std::sqrt(std::abs(delta[0] * delta[4] - delta[1] * delta[3]));
+	auto eps = 1e-4f * s;
+	auto similar = std::abs(delta[0] - delta[4]) <= eps &&
+		std::abs(delta[1] + delta[3]) <= eps;
+	auto tolerance = context().settings().curveTolerance;
+	if(!similar || std::abs(s - 1.f) * bakedOffset_ > tolerance) {
+		return false;
+	}
+
+	for(auto* points : {&fill_.points, &fillAA_.points, &stroke_.points,
+			&cover_.points, &source_}) {
+		transformPoints(*points, delta, *points);
+	}
+
+	// the aa x coords of dashed strokes are the distance along the stroke
+	if(flags_.dash) {
+		for(auto& aa : stroke_.aa) {
+			aa.x *= s;
+		}
+	}
+
+	linesDirty_ = flags_.lines;
+
+	// the bounds of the transformed points, padded again
+	auto pos = bounds_.position + Vec2f {pad_, pad_};
+	auto size = bounds_.size - Vec2f {2 * pad_, 2 * pad_};
+	std::array<Vec2f, 4> corners {pos, pos + Vec2f {size.x, 0.f},
+		pos + size, pos + Vec2f {0.f, size.y}};
+	transformPoints(corners, delta, corners);
+
+	auto min = corners[0];
+	auto max = corners[0];
+	for(auto& p : corners) {
+		min = {std::min(min.x, p.x), std::min(min.y, p.y)};
+		max = {std::max(max.x, p.x), std::max(max.y, p.y)};
+	}
+
+	bounds_.position = min - Vec2f {pad_, pad_};
+	bounds_.size = max - min + Vec2f {2 * pad_, 2 * pad_};
+
+	transform_ = t;
+	context().registerUpdateDevice(this);
+	return true;
+}
+
+Polygon::StrokeHeader Polygon::strokeHeader() const {
+	// mult, dashOffset, dashPeriod, dashCount, dashes
+	StrokeHeader ret {};
+	ret[0] = flags_.aaStroke ? strokeMult_ : 0.f;
+	if(flags_.dash) {
+		ret[1] = dashOffset_;
+		for(auto d : dash_) {
+			ret[2] += d;
+		}
+
+		ret[3] = float(dash_.size());
+		dlg_assert(dash_.size() <= DrawMode::maxDashes);
+		std::copy(dash_.begin(), dash_.end(), ret.begin() + 4);
+	}
+
+	return ret;
+}
+
+unsigned Polygon::strokeHeaderSize() const {
+	// without dashes: mult and padding, the aa coords need vec2 alignment
+	return flags_.dash ? sizeof(StrokeHeader) : 2 * sizeof(float);
+}
+
+std::uint32_t Polygon::strokeAAType() const {
+	return flags_.dash ? typeDashedStroke : flags_.aaStroke ? typeStroke : 0u;
+}
+
 bool Polygon::checkResize(vpp::SubBuffer& buf, vk::DeviceSize needed,
 		vk::BufferUsageFlags usage) {
 	needed = std::max(needed, vk::DeviceSize(16u));
@@ -193,18 +621,41 @@ bool Polygon::checkResize(vpp::SubBuffer& buf, vk::DeviceSize needed,
 		auto memBits = flags_.deviceLocal ?
 			context().device().deviceMemoryTypes() :
 			context().device().hostMemoryTypes();
-		auto align = 8u;
+		auto align = vk::DeviceSize(8u);
+		if(usage & vk::BufferUsageBits::storageBuffer) {
+			auto& limits = context().device().properties().limits;
+			align = std::max(align, limits.minStorageBufferOffsetAlignment);
+		}
+
 		buf = {context().bufferAllocator(), needed * 2, usage, memBits, align};
+		++context().frameStats().reallocations;
+		context().rerecord(*this, RerecordReason::realloc);
 		return true;
 	}
 
 	return false;
 }
 
-bool Polygon::upload(Draw& draw, bool disable, bool color) {
+bool Polygon::format(Draw& draw, bool compact) {
+	if(draw.compact == compact) {
+		return false;
+	}
+
+	draw.compact = compact;
+	context().rerecord(*this, RerecordReason::drawMode);
+	return true;
+}
+
+bool Polygon::upload(Draw& draw, bool disable, bool color, bool compact) {
 	auto rerecord = false;
-	auto pneeded = sizeof(vk::DrawIndirectCommand);
-	pneeded += !disable * (sizeof(draw.points[0]) * draw.points.size());
+	std::optional<CompactFrame> frame;
+	if(!disable) {
+		frame = compactFrameFor(context(), draw.points, compact);
+		rerecord |= format(draw, frame.has_value());
+	}
+
+	auto pneeded = draw.vertexOffset();
+	pneeded += !disable * (draw.vertexSize() * draw.points.size());
 	rerecord |= checkResize(draw.pBuf, pneeded,
 		vk::BufferUsageBits::vertexBuffer |
 		vk::BufferUsageBits::indirectBuffer);
@@ -215,6 +666,12 @@ bool Polygon::upload(Draw& draw, bool disable, bool color) {
 
 	if(disable) {
 		writeBuffer(*this, draw.pBuf, cmd);
+	} else if(frame) {
+		BufferWriter writer(*this, draw.pBuf, pneeded);
+		writer.write(0u, cmd);
+		writer.write(sizeof(cmd), *frame);
+		packCompact(draw.points, *frame, writer.span<CompactVec>(
+			draw.vertexOffset(), draw.points.size()));
 	} else {
 		auto points = nytl::Span<const nytl::Vec2f>(draw.points);
 		writeBuffer(*this, draw.pBuf, cmd, points);
@@ -235,27 +692,30 @@ bool Polygon::upload(Draw& draw, bool disable, bool color) {
 }
 
 bool Polygon::upload(Stroke& stroke, bool disable, bool color, bool aa,
-		float* mult) {
+		Span<const float> header, bool compact) {
 
-	bool rerecord = upload(static_cast<Draw&>(stroke), disable, color);
+	bool rerecord = upload(static_cast<Draw&>(stroke), disable, color,
+		compact);
 	if(aa) {
-		auto needed = stroke.aa.size() * sizeof(stroke.aa[0]);
+		auto needed = stroke.aa.size() * stroke.vertexSize();
 		vk::BufferUsageFlags usage = vk::BufferUsageBits::vertexBuffer |
 			vk::BufferUsageBits::indirectBuffer;
-		if(mult) {
-			needed += 2 * sizeof(float);
-			// needed += sizeof(float);
+		if(!header.empty()) {
+			needed += header.size() * sizeof(float);
 			usage |= vk::BufferUsageBits::uniformBuffer;
 		}
 
 		rerecord |= checkResize(stroke.aaBuf, needed, usage);
 		auto data = nytl::span(stroke.aa.data(), stroke.aa.size());
 
-		if(mult) {
-			// the 0.f is padding since data requires vec2f alignment
-			// and mult is only one float
-			writeBuffer(*this, stroke.aaBuf, *mult, 0.f, data);
-			// writeBuffer(*this, stroke.aaBuf, *mult, data);
+		if(stroke.compact) {
+			BufferWriter writer(*this, stroke.aaBuf, needed);
+			auto off = header.size() * sizeof(float);
+			auto out = writer.span<float>(0u, header.size());
+			std::copy(header.begin(), header.end(), out.begin());
+			packSnorm(data, writer.span<CompactVec>(off, data.size()));
+		} else if(!header.empty()) {
+			writeBuffer(*this, stroke.aaBuf, header, data);
 		} else {
 			writeBuffer(*this, stroke.aaBuf, data);
 		}
@@ -264,23 +724,426 @@ bool Polygon::upload(Stroke& stroke, bool disable, bool color, bool aa,
 	return rerecord;
 }
 
+bool Polygon::uploadIndices() {
+	// the indexed command is copied as two commands by Scene, see commands
+	auto disable = flags_.disableFill;
+	auto needed = sizeof(vk::DrawIndexedIndirectCommand);
+	needed += !disable * (sizeof(indices_[0]) * indices_.size());
+	needed = std::max(needed, 2 * sizeof(vk::DrawIndirectCommand));
+	auto rerecord = checkResize(iBuf_, needed,
+		vk::BufferUsageBits::indexBuffer |
+		vk::BufferUsageBits::indirectBuffer);
+
+	vk::DrawIndexedIndirectCommand cmd {};
+	cmd.indexCount = !disable * indices_.size();
+	cmd.instanceCount = 1;
+
+	if(disable) {
+		writeBuffer(*this, iBuf_, cmd);
+	} else {
+		auto indices = nytl::Span<const std::uint32_t>(indices_);
+		writeBuffer(*this, iBuf_, cmd, indices);
+	}
+
+	return rerecord;
+}
+
+bool Polygon::uploadBakedStroke() {
+	// same layout as upload(Stroke&), the vertices are baked in place.
+	// For the compact format, they are baked into scratch memory first
+	auto count = !flags_.disableStroke * stroke_.baked;
+	auto rerecord = false;
+	auto scratch = count && flags_.compact;
+	std::optional<CompactFrame> frame;
+	auto& points = bakeScratch[0];
+	auto& aaPoints = bakeScratch[1];
+	if(scratch) {
+		points.resize(count);
+		aaPoints.resize(flags_.aaStroke ? count : 0u);
+		auto zone = TraceZone(context(), "rvg::Polygon::bake",
+			context().frameStats().time.bake);
+		bakeStroke(source_, strokeWidth_, strokeLoop_, points, aaPoints);
+		zone.end();
+
+		frame = compactFrameFor(context(), points, true);
+	}
+
+	if(count) {
+		rerecord |= format(stroke_, frame.has_value());
+	}
+
+	auto cmdSize = sizeof(vk::DrawIndirectCommand);
+	auto size = count * stroke_.vertexSize();
+	auto off = stroke_.vertexOffset();
+	rerecord |= checkResize(stroke_.pBuf, off + size,
+		vk::BufferUsageBits::vertexBuffer |
+		vk::BufferUsageBits::indirectBuffer);
+
+	auto multSize = 2 * sizeof(float);
+	if(flags_.aaStroke) {
+		rerecord |= checkResize(stroke_.aaBuf, multSize + size,
+			vk::BufferUsageBits::vertexBuffer |
+			vk::BufferUsageBits::indirectBuffer |
+			vk::BufferUsageBits::uniformBuffer);
+	}
+
+	vk::DrawIndirectCommand cmd {};
+	cmd.vertexCount = count;
+	cmd.instanceCount = 1;
+
+	BufferWriter pos(*this, stroke_.pBuf, off + size);
+	pos.write(0u, cmd);
+
+	std::optional<BufferWriter<Polygon>> aa;
+	if(flags_.aaStroke) {
+		aa.emplace(*this, stroke_.aaBuf, multSize + size);
+		aa->write(0u, strokeMult_);
+		aa->write(sizeof(float), 0.f);
+	}
+
+	if(frame) {
+		pos.write(cmdSize, *frame);
+		packCompact(points, *frame, pos.span<CompactVec>(off, count));
+		if(aa) {
+			packSnorm(aaPoints, aa->span<CompactVec>(multSize, count));
+		}
+	} else if(scratch) {
+		// too large for the compact format
+		auto out = pos.span<Vec2f>(off, count);
+		std::copy(points.begin(), points.end(), out.begin());
+		if(aa) {
+			auto aaOut = aa->span<Vec2f>(multSize, count);
+			std::copy(aaPoints.begin(), aaPoints.end(), aaOut.begin());
+		}
+	} else if(count) {
+		auto aaSpan = aa ? aa->span<Vec2f>(multSize, count) : Span<Vec2f> {};
+		auto zone = TraceZone(context(), "rvg::Polygon::bake",
+			context().frameStats().time.bake);
+		bakeStroke(source_, strokeWidth_, strokeLoop_,
+			pos.span<Vec2f>(off, count), aaSpan);
+	}
+
+	return rerecord;
+}
+
+bool Polygon::uploadBakedFill() {
+	// like uploadBakedStroke, always with aa
+	auto disable = flags_.disableFill;
+	auto fillCount = !disable * fill_.baked;
+	auto fringeCount = !disable * fillAA_.baked;
+	auto rerecord = false;
+	auto scratch = !disable && flags_.compact;
+
+	std::optional<CompactFrame> fillFrame;
+	std::optional<CompactFrame> fringeFrame;
+	auto& inner = bakeScratch[0];
+	auto& fringePoints = bakeScratch[1];
+	auto& aaPoints = bakeScratch[2];
+	if(scratch) {
+		inner.resize(fillCount);
+		fringePoints.resize(fringeCount);
+		aaPoints.resize(fringeCount);
+		auto zone = TraceZone(context(), "rvg::Polygon::bake",
+			context().frameStats().time.bake);
+		bakeFillAA(source_, context().fringe(), inner, fringePoints, aaPoints);
+		zone.end();
+
+		fillFrame = compactFrameFor(context(), inner, true);
+		fringeFrame = compactFrameFor(context(), fringePoints, true);
+	}
+
+	if(!disable) {
+		rerecord |= format(fill_, fillFrame.has_value());
+		rerecord |= format(fillAA_, fringeFrame.has_value());
+	}
+
+	auto cmdSize = sizeof(vk::DrawIndirectCommand);
+	auto usage = vk::BufferUsageBits::vertexBuffer |
+		vk::BufferUsageBits::indirectBuffer;
+	auto fillOff = fill_.vertexOffset();
+	auto fringeOff = fillAA_.vertexOffset();
+	auto fillSize = fillOff + fillCount * fill_.vertexSize();
+	auto fringeSize = fringeOff + fringeCount * fillAA_.vertexSize();
+	auto aaSize = fringeCount * fillAA_.vertexSize();
+
+	rerecord |= checkResize(fill_.pBuf, fillSize, usage);
+	rerecord |= checkResize(fillAA_.pBuf, fringeSize, usage);
+	rerecord |= checkResize(fillAA_.aaBuf, aaSize, usage);
+
+	vk::DrawIndirectCommand cmd {};
+	cmd.instanceCount = 1;
+
+	BufferWriter fill(*this, fill_.pBuf, fillSize);
+	cmd.vertexCount = fillCount;
+	fill.write(0u, cmd);
+
+	BufferWriter fringe(*this, fillAA_.pBuf, fringeSize);
+	cmd.vertexCount = fringeCount;
+	fringe.write(0u, cmd);
+
+	if(disable) {
+		return rerecord;
+	}
+
+	BufferWriter aa(*this, fillAA_.aaBuf, aaSize);
+	if(!scratch) {
+		auto zone = TraceZone(context(), "rvg::Polygon::bake",
+			context().frameStats().time.bake);
+		bakeFillAA(source_, context().fringe(),
+			fill.span<Vec2f>(fillOff, fillCount),
+			fringe.span<Vec2f>(fringeOff, fringeCount),
+			aa.span<Vec2f>(0u, fringeCount));
+		return rerecord;
+	}
+
+	// pack or copy from the scratch memory
+	if(fillFrame) {
+		fill.write(cmdSize, *fillFrame);
+		packCompact(inner, *fillFrame, fill.span<CompactVec>(fillOff, fillCount));
+	} else {
+		auto out = fill.span<Vec2f>(fillOff, fillCount);
+		std::copy(inner.begin(), inner.end(), out.begin());
+	}
+
+	if(fringeFrame) {
+		fringe.write(cmdSize, *fringeFrame);
+		packCompact(fringePoints, *fringeFrame,
+			fringe.span<CompactVec>(fringeOff, fringeCount));
+		packSnorm(aaPoints, aa.span<CompactVec>(0u, fringeCount));
+	} else {
+		auto out = fringe.span<Vec2f>(fringeOff, fringeCount);
+		std::copy(fringePoints.begin(), fringePoints.end(), out.begin());
+		auto aaOut = aa.span<Vec2f>(0u, fringeCount);
+		std::copy(aaPoints.begin(), aaPoints.end(), aaOut.begin());
+	}
+
+	return rerecord;
+}
+
+bool Polygon::uploadComputeStroke() {
+	// the vertices are written by stroke.comp in the upload work.
+	// For deviceLocal buffers, the draw command and stroke multiplier are
+	// written in the same command buffer so that the queue family
+	// ownership is released once, after all writes
+	auto& ctx = context();
+	auto count = !flags_.disableStroke * stroke_.baked;
+	auto rerecord = format(stroke_, false);
+
+	auto usage = vk::BufferUsageBits::vertexBuffer |
+		vk::BufferUsageBits::indirectBuffer |
+		vk::BufferUsageBits::storageBuffer;
+	auto cmdSize = sizeof(vk::DrawIndirectCommand);
+	auto multSize = 2 * sizeof(float);
+	auto size = count * sizeof(Vec2f);
+	rerecord |= checkResize(stroke_.pBuf, cmdSize + size, usage);
+	if(flags_.aaStroke) {
+		rerecord |= checkResize(stroke_.aaBuf, multSize + size,
+			usage | vk::BufferUsageBits::uniformBuffer);
+	}
+
+	vk::DrawIndirectCommand cmd {};
+	cmd.vertexCount = count;
+	cmd.instanceCount = 1;
+	std::array<float, 2> mult {strokeMult_, 0.f};
+	if(!count || !flags_.deviceLocal) {
+		writeBuffer(*this, stroke_.pBuf, cmd);
+		if(flags_.aaStroke) {
+			writeBuffer(*this, stroke_.aaBuf, mult);
+		}
+
+		if(!count) {
+			return rerecord;
+		}
+	}
+
+	// the points, not referenced by any draw, i.e. no rerecord needed.
+	// Only read once by stroke.comp on the upload queue, always
+	// hostVisible so they need no staging copy or ownership transfer
+	auto srcSize = source_.size() * sizeof(Vec2f);
+	if(strokeSrc_.size() < srcSize) {
+		auto& dev = ctx.device();
+		auto srcUsage = vk::BufferUsageBits::storageBuffer;
+		auto align = dev.properties().limits.minStorageBufferOffsetAlignment;
+		strokeSrc_ = {ctx.bufferAllocator(), 2 * srcSize, srcUsage,
+			dev.hostMemoryTypes(), align};
+		++ctx.frameStats().reallocations;
+	}
+
+	writeBuffer(*this, strokeSrc_, nytl::Span<const Vec2f>(source_));
+
+	auto& pipe = ctx.strokePipeline();
+	if(!strokeCompDs_) {
+		strokeCompDs_ = {ctx.dsAllocator(), pipe.dsLayout};
+	}
+
+	// without aa, the vertex buffer is bound as (unused) dummy
+	// applied at the end of the scope, before recording
+	{
+		auto& aa = flags_.aaStroke ? stroke_.aaBuf : stroke_.pBuf;
+		vpp::DescriptorSetUpdate update(strokeCompDs_);
+		update.storage({{strokeSrc_.buffer(), strokeSrc_.offset(),
+			strokeSrc_.size()}});
+		update.storage({{stroke_.pBuf.buffer(), stroke_.pBuf.offset(),
+			stroke_.pBuf.size()}});
+		update.storage({{aa.buffer(), aa.offset(), aa.size()}});
+	}
+
+	struct {
+		std::uint32_t count;
+		std::uint32_t loop;
+		std::uint32_t aa;
+		float halfWidth;
+		std::uint32_t vertexOffset;
+		std::uint32_t aaOffset;
+	} params {
+		std::uint32_t(source_.size()),
+		strokeLoop_,
+		flags_.aaStroke,
+		0.5f * strokeWidth_,
+		std::uint32_t(cmdSize / sizeof(Vec2f)),
+		std::uint32_t(multSize / sizeof(Vec2f)),
+	};
+
+	auto cb = ctx.uploadCmdBuf();
+
+	// the shader doesn't touch the command and multiplier, no barrier
+	// needed between the writes
+	auto stage = nytl::Flags {vk::PipelineStageBits::computeShader};
+	auto access = nytl::Flags {vk::AccessBits::shaderWrite};
+	if(flags_.deviceLocal) {
+		vk::cmdUpdateBuffer(cb, stroke_.pBuf.buffer(), stroke_.pBuf.offset(),
+			sizeof(cmd), &cmd);
+		if(flags_.aaStroke) {
+			vk::cmdUpdateBuffer(cb, stroke_.aaBuf.buffer(),
+				stroke_.aaBuf.offset(), sizeof(mult), mult.data());
+		}
+
+		stage |= vk::PipelineStageBits::transfer;
+		access |= vk::AccessBits::transferWrite;
+		ctx.frameStats().stagedBytes += sizeof(cmd) +
+			flags_.aaStroke * sizeof(mult);
+	}
+
+	constexpr auto groupSize = 64u; // see stroke.comp
+	vk::cmdBindPipeline(cb, vk::PipelineBindPoint::compute, pipe.pipe);
+	vk::cmdBindDescriptorSets(cb, vk::PipelineBindPoint::compute,
+		pipe.layout, 0, {{strokeCompDs_.vkHandle()}}, {});
+	vk::cmdPushConstants(cb, pipe.layout, vk::ShaderStageBits::compute,
+		0, sizeof(params), &params);
+	vk::cmdDispatch(cb, (params.count + groupSize - 1) / groupSize, 1, 1);
+
+	// On a separate upload queue (which might not support graphics
+	// stages), the queue family release makes the writes available.
+	// Otherwise they are made visible to the vertex input directly
+	if(ctx.uploadQueueFamily() == ctx.renderQueueFamily()) {
+		vk::MemoryBarrier barrier;
+		barrier.srcAccessMask = access;
+		barrier.dstAccessMask = vk::AccessBits::vertexAttributeRead |
+			vk::AccessBits::indirectCommandRead |
+			vk::AccessBits::uniformRead;
+		vk::cmdPipelineBarrier(cb, stage,
+			vk::PipelineStageBits::vertexInput |
+			vk::PipelineStageBits::drawIndirect |
+			vk::PipelineStageBits::vertexShader, {}, {{barrier}}, {}, {});
+	}
+
+	auto& p = stroke_.pBuf;
+	ctx.finishUpload(this, cb, {p.buffer(), cmdSize + size, p.offset()},
+		stage, access);
+	if(flags_.aaStroke) {
+		auto& aa = stroke_.aaBuf;
+		ctx.finishUpload(this, cb, {aa.buffer(), multSize + size, aa.offset()},
+			stage, access);
+	}
+
+	ctx.addCommandBuffer(this, std::move(cb));
+	return rerecord;
+}
+
+bool Polygon::uploadLines() {
+	// the draw command (one instance per segment), the header
+	// (vec4, x: half width) and the segments. After a width change only
+	// the first two have to be written
+	auto headerOff = sizeof(vk::DrawIndirectCommand);
+	auto segmentOff = headerOff + 4 * sizeof(float);
+	auto rerecord = format(stroke_, false);
+	auto size = segmentOff + stroke_.points.size() * sizeof(Vec2f);
+	auto realloc = checkResize(stroke_.pBuf, size,
+		vk::BufferUsageBits::vertexBuffer |
+		vk::BufferUsageBits::indirectBuffer);
+	rerecord |= realloc;
+
+	vk::DrawIndirectCommand cmd {};
+	cmd.vertexCount = !flags_.disableStroke * 4u;
+	cmd.instanceCount = stroke_.points.size() / 2;
+	auto header = Vec4f {0.5f * strokeWidth_, 0.f, 0.f, 0.f};
+
+	if(linesDirty_ || realloc) {
+		auto segments = nytl::Span<const Vec2f>(stroke_.points);
+		writeBuffer(*this, stroke_.pBuf, cmd, header, segments);
+		linesDirty_ = false;
+	} else {
+		writeBuffer(*this, stroke_.pBuf, cmd, header);
+	}
+
+	if(flags_.aaStroke) {
+		// same usage as for strips, the buffer is kept when switching
+		rerecord |= checkResize(stroke_.aaBuf, 2 * sizeof(float),
+			vk::BufferUsageBits::vertexBuffer |
+			vk::BufferUsageBits::indirectBuffer |
+			vk::BufferUsageBits::uniformBuffer);
+		writeBuffer(*this, stroke_.aaBuf, strokeMult_, 0.f);
+	}
+
+	return rerecord;
+}
+
 bool Polygon::updateDevice() {
 	dlg_assertm(valid(), "Polygon must not be in invalid state");
 
 	bool rerecord = false;
 
 	if(flags_.fill) {
-		rerecord |= upload(fill_, flags_.disableFill, flags_.colorFill);
-		if(flags_.aaFill) {
-			rerecord |= upload(fillAA_, flags_.disableFill, flags_.colorFill,
-				true, nullptr);
+		// the stencil and cover pipelines have no compact variant
+		auto stencil = fillRule_ == FillRule::nonZero ||
+			fillRule_ == FillRule::evenOdd;
+		auto compact = flags_.compact && !stencil;
+		if(fill_.baked) {
+			rerecord |= uploadBakedFill();
+		} else {
+			rerecord |= upload(fill_, flags_.disableFill, flags_.colorFill,
+				compact);
+			if(flags_.aaFill) {
+				rerecord |= upload(fillAA_, flags_.disableFill,
+					flags_.colorFill, true, {}, compact);
+			}
+		}
+
+		if(fillRule_ == FillRule::triangulated) {
+			rerecord |= uploadIndices();
+		} else if(stencil) {
+			rerecord |= upload(cover_, flags_.disableFill, false, false);
 		}
 	}
 
 	if(flags_.stroke) {
 		auto prev = stroke_.aaBuf.size();
-		rerecord |= upload(stroke_, flags_.disableStroke, flags_.colorStroke,
-			flags_.aaStroke, &strokeMult_);
+		if(flags_.lines) {
+			rerecord |= uploadLines();
+		} else if(flags_.computeStroke) {
+			rerecord |= uploadComputeStroke();
+		} else if(stroke_.baked) {
+			rerecord |= uploadBakedStroke();
+		} else {
+			// the dash pattern is in front of the aa coords, the arc
+			// lengths in them don't fit into the compact format
+			auto header = strokeHeader();
+			auto headerSpan = Span<const float>(header.data(),
+				strokeHeaderSize() / sizeof(float));
+			rerecord |= upload(stroke_, flags_.disableStroke,
+				flags_.colorStroke, flags_.aaStroke || flags_.dash,
+				headerSpan, flags_.compact && !flags_.dash);
+		}
 
 		// check if buffer with our uniform was recreated
 		auto next = stroke_.aaBuf.size();
@@ -291,8 +1154,9 @@ bool Polygon::updateDevice() {
 			}
 
 			auto& b = stroke_.aaBuf;
+			auto range = flags_.dash ? sizeof(StrokeHeader) : sizeof(float);
 			vpp::DescriptorSetUpdate update(strokeDs_);
-			update.uniform({{b.buffer(), b.offset(), sizeof(float)}});
+			update.uniform({{b.buffer(), b.offset(), range}});
 		}
 	}
 
@@ -300,39 +1164,196 @@ bool Polygon::updateDevice() {
 }
 
 void Polygon::fill(vk::CommandBuffer cb) const {
+	fill(cb, {});
+}
+
+void Polygon::fill(vk::CommandBuffer cb, vk::Buffer indirect,
+		vk::DeviceSize offset) const {
+	fill(cb, {indirect, offset});
+}
+
+void Polygon::stroke(vk::CommandBuffer cb, vk::Buffer indirect,
+		vk::DeviceSize offset) const {
+	dlg_assertm(flags_.stroke, "Polygon has no stroke data");
+	dlg_assertm(valid(), "Polygon must not be in an invalid state");
+	if(flags_.lines) {
+		strokeLines(cb, {indirect, offset});
+		return;
+	}
+
+	stroke(cb, stroke_, strokeAAType(), flags_.colorStroke, strokeDs_,
+		strokeHeaderSize(), {indirect, offset});
+}
+
+void Polygon::fillInstanced(vk::CommandBuffer cb, vk::Buffer indirect,
+		vk::DeviceSize offset) const {
+	fill(cb, {indirect, offset}, true);
+}
+
+void Polygon::strokeInstanced(vk::CommandBuffer cb, vk::Buffer indirect,
+		vk::DeviceSize offset) const {
+	dlg_assertm(flags_.stroke, "Polygon has no stroke data");
+	dlg_assertm(valid(), "Polygon must not be in an invalid state");
+	dlg_assertm(!flags_.lines, "Line strokes can't be instanced");
+	stroke(cb, stroke_, strokeAAType(), flags_.colorStroke, strokeDs_,
+		strokeHeaderSize(), {indirect, offset}, true);
+}
+
+std::vector<std::uint32_t> Polygon::vertexCounts(DrawType type) const {
+	dlg_assert(type != DrawType::strokeFill);
+	if(type == DrawType::stroke) {
+		dlg_assertm(flags_.stroke, "Polygon has no stroke data");
+		auto count = !flags_.disableStroke * (flags_.lines ?
+			4u : stroke_.vertexCount());
+		return {std::uint32_t(count)};
+	}
+
+	dlg_assertm(flags_.fill, "Polygon has no fill data");
+	std::vector<std::uint32_t> ret;
+	if(fillRule_ == FillRule::triangulated) {
+		// index count, second half of the indexed command
+		ret.push_back(std::uint32_t(!flags_.disableFill * indices_.size()));
+		ret.push_back(0u);
+	} else {
+		auto count = !flags_.disableFill * fill_.vertexCount();
+		ret.push_back(std::uint32_t(count));
+	}
+
+	if(flags_.aaFill) {
+		auto count = !flags_.disableFill * fillAA_.vertexCount();
+		ret.push_back(std::uint32_t(count));
+	}
+
+	if(fillRule_ == FillRule::nonZero || fillRule_ == FillRule::evenOdd) {
+		auto count = !flags_.disableFill * cover_.points.size();
+		ret.push_back(std::uint32_t(count));
+	}
+
+	return ret;
+}
+
+std::vector<IndirectCommand> Polygon::commands(DrawType type) const {
+	dlg_assert(type != DrawType::strokeFill);
+	if(type == DrawType::stroke) {
+		dlg_assertm(flags_.stroke, "Polygon has no stroke data");
+		auto& b = stroke_.pBuf;
+		return {{b.buffer().vkHandle(), b.offset()}};
+	}
+
+	dlg_assertm(flags_.fill, "Polygon has no fill data");
+	std::vector<IndirectCommand> ret;
+	if(fillRule_ == FillRule::triangulated) {
+		auto buf = iBuf_.buffer().vkHandle();
+		auto size = sizeof(vk::DrawIndirectCommand);
+		ret.push_back({buf, iBuf_.offset()});
+		ret.push_back({buf, iBuf_.offset() + size});
+	} else {
+		ret.push_back({fill_.pBuf.buffer().vkHandle(), fill_.pBuf.offset()});
+	}
+
+	if(flags_.aaFill) {
+		auto& b = fillAA_.pBuf;
+		ret.push_back({b.buffer().vkHandle(), b.offset()});
+	}
+
+	if(fillRule_ == FillRule::nonZero || fillRule_ == FillRule::evenOdd) {
+		auto& b = cover_.pBuf;
+		ret.push_back({b.buffer().vkHandle(), b.offset()});
+	}
+
+	return ret;
+}
+
+void Polygon::fill(vk::CommandBuffer cb, IndirectCommand cmd,
+		bool instanced) const {
 	dlg_assertm(flags_.fill, "Polygon has no fill data");
 	dlg_assertm(valid(), "Polygon must not be in an invalid state");
 
-	// fill
-	vk::cmdBindPipeline(cb, vk::PipelineBindPoint::graphics,
-		context().fanPipe());
+	// fill, for stencil fills only into the stencil buffer
+	auto& ctx = context();
+	auto& pipes = ctx.pipes(cb);
+	auto stencil = fillRule_ == FillRule::nonZero ||
+		fillRule_ == FillRule::evenOdd;
+	auto indexed = fillRule_ == FillRule::triangulated;
+	dlg_assertm(!stencil || !instanced, "Stencil fills can't be instanced");
+	dlg_assertm(!indexed || !instanced,
+		"Triangulated fills can't be instanced");
+	dlg_assertm(!stencil || pipes.cover.vkHandle(),
+		"Stencil fills need ContextSettings::stencilFill");
+	dlg_assertm(!instanced || !flags_.compact,
+		"Instanced polygons can't use the compact format");
+
+	if(fillRule_ == FillRule::nonZero) {
+		ctx.bindPipeline(cb, pipes.stencilNonZero);
+	} else if(fillRule_ == FillRule::evenOdd) {
+		ctx.bindPipeline(cb, pipes.stencilEvenOdd);
+	} else if(indexed) {
+		ctx.bindPipeline(cb, fill_.compact ? pipes.listCompact : pipes.list);
+	} else if(fill_.compact) {
+		ctx.bindPipeline(cb, pipes.fanCompact);
+	} else {
+		ctx.bindPipeline(cb, instanced ? pipes.fanInstanced : pipes.fan);
+	}
 
-	static constexpr auto type = uint32_t(0);
-	vk::cmdPushConstants(cb, context().pipeLayout(),
-		vk::ShaderStageBits::fragment, 0, 4, &type);
+	ctx.pushType(cb, 0u);
 
+	// position, dummy uv and color (or dummy color)
 	auto& b = fill_.pBuf;
-	auto off = b.offset() + sizeof(vk::DrawIndirectCommand);
-	vk::cmdBindVertexBuffers(cb, 0, {{b.buffer().vkHandle()}}, {{off}});
-	vk::cmdBindVertexBuffers(cb, 1, {{b.buffer().vkHandle()}},
-		{{off}}); // dummy uv
-
+	auto off = b.offset() + fill_.vertexOffset();
+	auto cbuf = b.buffer().vkHandle();
+	auto coff = off;
 	if(flags_.colorFill) {
 		auto& c = fill_.cBuf;
 		dlg_assert(c.size());
-		vk::cmdBindVertexBuffers(cb, 2, {{c.buffer().vkHandle()}},
-			{{c.offset()}});
-	} else {
-		vk::cmdBindVertexBuffers(cb, 2, {{b.buffer().vkHandle()}},
-			{{off}}); // dummy color
+		cbuf = c.buffer().vkHandle();
+		coff = c.offset();
+	}
+
+	ctx.bindVertexBuffers(cb, 0, {{b.buffer().vkHandle(),
+		b.buffer().vkHandle(), cbuf}}, {{off, off, coff}});
+	if(fill_.compact) {
+		vk::Buffer frameBuf[1] = {b.buffer().vkHandle()};
+		vk::DeviceSize frameOff[1] = {b.offset() +
+			sizeof(vk::DrawIndirectCommand)};
+		ctx.bindVertexBuffers(cb, 3, frameBuf, frameOff);
 	}
 
-	vk::cmdDrawIndirect(cb, b.buffer(), b.offset(), 1, 0);
+	if(indexed) {
+		auto& i = iBuf_;
+		auto ioff = i.offset() + sizeof(vk::DrawIndexedIndirectCommand);
+		vk::cmdBindIndexBuffer(cb, i.buffer(), ioff, vk::IndexType::uint32);
+		if(cmd.buffer) {
+			vk::cmdDrawIndexedIndirect(cb, cmd.buffer, cmd.offset, 1, 0);
+			cmd.offset += 2 * sizeof(vk::DrawIndirectCommand);
+		} else {
+			vk::cmdDrawIndexedIndirect(cb, i.buffer(), i.offset(), 1, 0);
+		}
+	} else if(cmd.buffer) {
+		vk::cmdDrawIndirect(cb, cmd.buffer, cmd.offset, 1, 0);
+		cmd.offset += sizeof(vk::DrawIndirectCommand);
+	} else {
+		vk::cmdDrawIndirect(cb, b.buffer(), b.offset(), 1, 0);
+	}
 
 	// aa stroke
 	if(flags_.aaFill) {
-		stroke(cb, fillAA_, true, flags_.colorFill,
-			context().defaultStrokeAA(), 0u);
+		stroke(cb, fillAA_, typeStroke, flags_.colorFill,
+			context().defaultStrokeAA(), 0u, cmd, instanced);
+	}
+
+	// cover the bounds where the stencil buffer was written
+	if(stencil) {
+		auto& c = cover_.pBuf;
+		auto buf = c.buffer().vkHandle();
+		auto coff = c.offset() + sizeof(vk::DrawIndirectCommand);
+		ctx.bindPipeline(cb, pipes.cover);
+		ctx.bindVertexBuffers(cb, 0, {{buf, buf, buf}}, {{coff, coff, coff}});
+
+		if(cmd.buffer) {
+			vk::cmdDrawIndirect(cb, cmd.buffer, cmd.offset, 1, 0);
+		} else {
+			vk::cmdDrawIndirect(cb, c.buffer(), c.offset(), 1, 0);
+		}
 	}
 }
 
@@ -340,59 +1361,99 @@ void Polygon::stroke(vk::CommandBuffer cb) const {
 	dlg_assertm(flags_.stroke, "Polygon has no stroke data");
 	dlg_assertm(valid(), "Polygon must not be in an invalid state");
 
-	// 8 offset here: 4 by float and then 4 padding
-	// the following vertex data has needs vec2f alignment
-	stroke(cb, stroke_, flags_.aaStroke, flags_.colorStroke, strokeDs_, 8u);
-	// stroke(cb, stroke_, flags_.aaStroke, flags_.colorStroke, strokeDs_, 4u);
+	if(flags_.lines) {
+		strokeLines(cb, {});
+		return;
+	}
+
+	// the aa coords are after the stroke uniform, see strokeHeader
+	stroke(cb, stroke_, strokeAAType(), flags_.colorStroke, strokeDs_,
+		strokeHeaderSize());
 }
 
-void Polygon::stroke(vk::CommandBuffer cb, const Stroke& stroke, bool aa,
-		bool color, vk::DescriptorSet aaDs, unsigned aaOff) const {
+void Polygon::stroke(vk::CommandBuffer cb, const Stroke& stroke,
+		std::uint32_t aaType, bool color, vk::DescriptorSet aaDs, unsigned aaOff,
+		IndirectCommand cmd, bool instanced) const {
 
 	dlg_assert(stroke.pBuf.size());
 
-	vk::cmdBindPipeline(cb, vk::PipelineBindPoint::graphics,
-		context().stripPipe());
+	auto& ctx = context();
+	auto& pipes = ctx.pipes(cb);
+	if(stroke.compact) {
+		dlg_assertm(!instanced, "Instanced polygons can't use the compact format");
+		ctx.bindPipeline(cb, pipes.stripCompact);
+	} else {
+		ctx.bindPipeline(cb, instanced ? pipes.stripInstanced : pipes.strip);
+	}
 
-	// position and dummy uv buffer
+	// position buffer, also used as dummy for aa uv and color
+	// the compact format additionally reads its frame from binding 3
 	auto& b = stroke.pBuf;
-	auto off = b.offset() + sizeof(vk::DrawIndirectCommand);
-	vk::cmdBindVertexBuffers(cb, 0, {{b.buffer().vkHandle()}}, {{off}});
+	auto off = b.offset() + stroke.vertexOffset();
+	auto frameOff = b.offset() + sizeof(vk::DrawIndirectCommand);
+	auto buf = b.buffer().vkHandle();
+	vk::Buffer buffers[4] = {buf, buf, buf, buf};
+	vk::DeviceSize offsets[4] = {off, off, off, frameOff};
 
 	// aa
-	auto type = uint32_t(0);
-	if(aa) {
-		type = 2u;
+	if(aaType) {
 		auto& a = stroke.aaBuf;
 		dlg_assert(a.size());
 		dlg_assert(aaDs);
 
-		vk::cmdBindVertexBuffers(cb, 1, {{a.buffer().vkHandle()}},
-			{{a.offset() + aaOff}});
-		vk::cmdBindDescriptorSets(cb, vk::PipelineBindPoint::graphics,
-			context().pipeLayout(), Context::aaStrokeBindSet,
-			{{aaDs}}, {});
-	} else {
-		vk::cmdBindVertexBuffers(cb, 1, {{b.buffer().vkHandle()}},
-			{{off}}); // dummy aa uv
+		buffers[1] = a.buffer().vkHandle();
+		offsets[1] = a.offset() + aaOff;
+		ctx.bindDescriptorSet(cb, Context::aaStrokeBindSet, aaDs);
 	}
 
 	// used to determine whether aa alpha blending is used
-	vk::cmdPushConstants(cb, context().pipeLayout(),
-		vk::ShaderStageBits::fragment, 0, 4, &type);
+	ctx.pushType(cb, aaType);
 
 	// color
 	if(color) {
 		auto& c = stroke.cBuf;
 		dlg_assert(c.size());
-		vk::cmdBindVertexBuffers(cb, 2, {{c.buffer().vkHandle()}},
-			{{c.offset()}});
+		buffers[2] = c.buffer().vkHandle();
+		offsets[2] = c.offset();
+	}
+
+	auto count = stroke.compact ? 4u : 3u;
+	ctx.bindVertexBuffers(cb, 0, nytl::Span<const vk::Buffer>(buffers, count),
+		nytl::Span<const vk::DeviceSize>(offsets, count));
+
+	if(cmd.buffer) {
+		vk::cmdDrawIndirect(cb, cmd.buffer, cmd.offset, 1, 0);
 	} else {
-		vk::cmdBindVertexBuffers(cb, 2, {{b.buffer().vkHandle()}},
-			{{off}}); // dummy color
+		vk::cmdDrawIndirect(cb, b.buffer(), b.offset(), 1, 0);
 	}
+}
+
+void Polygon::strokeLines(vk::CommandBuffer cb, IndirectCommand cmd) const {
+	auto& ctx = context();
+	auto& b = stroke_.pBuf;
+	dlg_assert(b.size());
+	ctx.bindPipeline(cb, ctx.pipes(cb).lines);
+
+	// segments and header, both per instance
+	auto buf = b.buffer().vkHandle();
+	auto headerOff = b.offset() + sizeof(vk::DrawIndirectCommand);
+	auto segmentOff = headerOff + 4 * sizeof(float);
+	ctx.bindVertexBuffers(cb, 0, {{buf, buf}}, {{segmentOff, headerOff}});
 
-	vk::cmdDrawIndirect(cb, b.buffer(), b.offset(), 1, 0);
+	// the aa coords are generated in the vertex shader
+	auto type = uint32_t(0);
+	if(flags_.aaStroke) {
+		type = typeStroke;
+		dlg_assert(strokeDs_);
+		ctx.bindDescriptorSet(cb, Context::aaStrokeBindSet, strokeDs_);
+	}
+
+	ctx.pushType(cb, type);
+	if(cmd.buffer) {
+		vk::cmdDrawIndirect(cb, cmd.buffer, cmd.offset, 1, 0);
+	} else {
+		vk::cmdDrawIndirect(cb, b.buffer(), b.offset(), 1, 0);
+	}
 }
 
 } // namespace rvg
@@ -0,0 +1,656 @@
+// Copyright (c) 2019 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include <rvg/scene.hpp>
+#include <rvg/context.hpp>
+#include <rvg/polygon.hpp>
+#include <rvg/text.hpp>
+#include <rvg/state.hpp>
+#include <rvg/paint.hpp>
+#include <rvg/util.hpp>
+#include <vpp/vk.hpp>
+#include <vpp/pipeline.hpp>
+#include <dlg/dlg.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+namespace rvg {
+namespace {
+
+// How far an item may be moved to the front (in items).
+// Limits the sorting complexity.
+constexpr auto sortWindow = 64u;
+
+// The maximum number of damage regions returned.
+constexpr auto maxDamageRegions = 8u;
+
+// Per-item data for the culling compute shader, see cull.comp
+struct CullItem {
+	Vec4f bounds;
+	Mat4f transform;
+	std::uint32_t first;
+	std::uint32_t count;
+	std::uint32_t _pad[2];
+};
+
+static_assert(sizeof(CullItem) == 96u);
+constexpr auto cullGroupSize = 64u;
+constexpr auto commandSize = sizeof(vk::DrawIndirectCommand);
+
+bool overlap(const Rect2f& a, const Rect2f& b) {
+	return a.position.x < b.position.x + b.size.x &&
+		b.position.x < a.position.x + a.size.x &&
+		a.position.y < b.position.y + b.size.y &&
+		b.position.y < a.position.y + a.size.y;
+}
+
+Rect2f unite(const Rect2f& a, const Rect2f& b) {
+	auto x0 = std::min(a.position.x, b.position.x);
+	auto y0 = std::min(a.position.y, b.position.y);
+	auto x1 = std::max(a.position.x + a.size.x, b.position.x + b.size.x);
+	auto y1 = std::max(a.position.y + a.size.y, b.position.y + b.size.y);
+	return {{x0, y0}, {x1 - x0, y1 - y0}};
+}
+
+// Unites overlapping rects until there are no overlaps. A grown rect
+// might overlap rects that were already checked, so the scan restarts
+// after every merge.
+void mergeOverlaps(std::vector<Rect2f>& rects) {
+	for(auto i = 0u; i < rects.size();) {
+		auto merged = false;
+		for(auto j = 0u; j < rects.size(); ++j) {
+			if(j != i && overlap(rects[i], rects[j])) {
+				rects[i] = unite(rects[i], rects[j]);
+				rects.erase(rects.begin() + j);
+				merged = true;
+				break;
+			}
+		}
+
+		i = merged ? 0u : i + 1;
+	}
+}
+
+std::optional<Rect2f> intersection(const Rect2f& a, const Rect2f& b) {
+	auto x0 = std::max(a.position.x, b.position.x);
+	auto y0 = std::max(a.position.y, b.position.y);
+	auto x1 = std::min(a.position.x + a.size.x, b.position.x + b.size.x);
+	auto y1 = std::min(a.position.y + a.size.y, b.position.y + b.size.y);
+	if(x1 <= x0 || y1 <= y0) {
+		return std::nullopt;
+	}
+
+	return Rect2f {{x0, y0}, {x1 - x0, y1 - y0}};
+}
+
+const DeviceObject* object(const void* obj, bool text) {
+	return text ?
+		static_cast<const DeviceObject*>(static_cast<const Text*>(obj)) :
+		static_cast<const DeviceObject*>(static_cast<const Polygon*>(obj));
+}
+
+} // anon namespace
+
+Scene::Scene(Context& ctx) : context_(&ctx) {
+}
+
+Scene::ItemID Scene::fill(const Polygon& p, const State& state,
+		std::optional<Rect2f> bounds) {
+	return add(Type::fill, &p, state, bounds);
+}
+
+Scene::ItemID Scene::stroke(const Polygon& p, const State& state,
+		std::optional<Rect2f> bounds) {
+	return add(Type::stroke, &p, state, bounds);
+}
+
+Scene::ItemID Scene::draw(const Text& t, const State& state,
+		std::optional<Rect2f> bounds) {
+	return add(Type::text, &t, state, bounds);
+}
+
+Scene::ItemID Scene::add(Type type, const void* obj, const State& state,
+		std::optional<Rect2f> bounds) {
+	dlg_assert(context_);
+	dlg_assertm(state.paint, "Scene items need a paint");
+
+	auto id = nextID_++;
+	items_.push_back({id, type, obj, state, bounds});
+	++version_;
+	context().rerecord();
+	return id;
+}
+
+Scene::Item* Scene::find(ItemID id) {
+	auto it = std::find_if(items_.begin(), items_.end(),
+		[&](auto& item) { return item.id == id; });
+	return it == items_.end() ? nullptr : &*it;
+}
+
+void Scene::state(ItemID id, const State& state) {
+	dlg_assertm(state.paint, "Scene items need a paint");
+	auto* item = find(id);
+	dlg_assertm(item, "Invalid scene item");
+	item->state = state;
+	item->dirty = true;
+	++version_;
+	context().rerecord();
+}
+
+void Scene::bounds(ItemID id, std::optional<Rect2f> bounds) {
+	auto* item = find(id);
+	dlg_assertm(item, "Invalid scene item");
+	item->bounds = bounds;
+	item->dirty = true;
+	++version_;
+	context().rerecord();
+}
+
+bool Scene::remove(ItemID id) {
+	auto it = std::find_if(items_.begin(), items_.end(),
+		[&](auto& item) { return item.id == id; });
+	if(it == items_.end()) {
+		return false;
+	}
+
+	if(it->drawn) {
+		damage_.push_back(*it->drawn);
+	}
+
+	items_.erase(it);
+	++version_;
+	context().rerecord();
+	return true;
+}
+
+void Scene::clear() {
+	for(auto& item : items_) {
+		if(item.drawn) {
+			damage_.push_back(*item.drawn);
+		}
+	}
+
+	items_.clear();
+	++version_;
+	context().rerecord();
+}
+
+void Scene::sort() {
+	// Inserts each item directly after the last item with the same state,
+	// if it can be moved past all items in between without changing the
+	// result. Otherwise it is simply appended.
+	// Overlap is only checked for items with the same transform since we
+	// can't know how other transforms will change. Disjoint rects stay
+	// disjoint under any (invertible) transform.
+	auto same = [](const Item& a, const Item& b) {
+		return a.type == b.type &&
+			a.state.paint == b.state.paint &&
+			a.state.transform == b.state.transform &&
+			a.state.scissor == b.state.scissor;
+	};
+
+	auto passable = [](const Item& item, const Item& other) {
+		return item.bounds && other.bounds &&
+			item.state.transform == other.state.transform &&
+			!overlap(*item.bounds, *other.bounds);
+	};
+
+	order_.clear();
+	order_.reserve(items_.size());
+	for(auto& item : items_) {
+		auto pos = order_.size();
+		auto end = order_.size() > sortWindow ? order_.size() - sortWindow : 0u;
+		for(auto i = order_.size(); i-- > end;) {
+			if(same(*order_[i], item)) {
+				pos = i + 1;
+				break;
+			}
+
+			if(!passable(item, *order_[i])) {
+				break;
+			}
+		}
+
+		order_.insert(order_.begin() + pos, &item);
+	}
+}
+
+void Scene::record(vk::CommandBuffer cb, const Transform* base) {
+	dlg_assert(context_);
+	auto& ctx = context();
+	sort();
+
+	ctx.bindDefaults(cb);
+	ctx.trackState(cb, true);
+
+	// bindDefaults bound the default transform and scissor
+	bound_ = {nullptr, &ctx.identityTransform(), &ctx.defaultScissor()};
+	base_ = base ? base : &ctx.identityTransform();
+	for(auto* item : order_) {
+		if(culling_ == Culling::cpu && !item->visible) {
+			continue;
+		}
+
+		recordItem(cb, *item);
+	}
+
+	ctx.trackState(cb, false);
+}
+
+void Scene::record(vk::CommandBuffer cb,
+		nytl::Span<const vk::Rect2D> regions,
+		std::optional<vk::ClearColorValue> clear) {
+	dlg_assert(context_);
+	auto& ctx = context();
+	sort();
+
+	ctx.bindDefaults(cb);
+	ctx.trackState(cb, true);
+	bound_ = {nullptr, &ctx.identityTransform(), &ctx.defaultScissor()};
+	base_ = &ctx.identityTransform();
+
+	for(auto& region : regions) {
+		vk::cmdSetScissor(cb, 0, 1, region);
+		if(clear) {
+			vk::ClearAttachment attachment;
+			attachment.aspectMask = vk::ImageAspectBits::color;
+			attachment.colorAttachment = 0u;
+			attachment.clearValue.color = *clear;
+			vk::ClearRect rect {region, 0u, 1u};
+			vk::cmdClearAttachments(cb, {{attachment}}, {{rect}});
+		}
+
+		auto r = Rect2f {
+			{float(region.offset.x), float(region.offset.y)},
+			{float(region.extent.width), float(region.extent.height)}};
+
+		// items that were never part of a damage call are always drawn,
+		// the ones outside of the viewport never
+		for(auto* item : order_) {
+			if(culling_ == Culling::cpu && !item->visible) {
+				continue;
+			}
+
+			if(!item->damaged || (item->drawn && overlap(*item->drawn, r))) {
+				recordItem(cb, *item);
+			}
+		}
+	}
+
+	ctx.trackState(cb, false);
+}
+
+void Scene::recordItem(vk::CommandBuffer cb, const Item& item) {
+	auto& ctx = context();
+	auto& state = item.state;
+	auto* t = state.transform ? state.transform : base_;
+	auto* s = state.scissor ? state.scissor : &ctx.defaultScissor();
+
+	if(t != bound_.transform) {
+		t->bind(cb);
+		bound_.transform = t;
+	}
+
+	if(s != bound_.scissor) {
+		s->bind(cb);
+		bound_.scissor = s;
+	}
+
+	if(state.paint != bound_.paint) {
+		state.paint->bind(cb);
+		bound_.paint = state.paint;
+	}
+
+	// with gpu culling the (culled) copies of the commands are used
+	if(culling_ == Culling::gpu) {
+		dlg_assertm(cullCommands_.size(), "updateCulling wasn't called");
+		auto buf = cullCommands_.buffer().vkHandle();
+		auto off = cullCommands_.offset() + item.command * commandSize;
+		switch(item.type) {
+			case Type::fill:
+				static_cast<const Polygon*>(item.object)->fill(cb, buf, off);
+				break;
+			case Type::stroke:
+				static_cast<const Polygon*>(item.object)->stroke(cb, buf, off);
+				break;
+			case Type::text:
+				static_cast<const Text*>(item.object)->draw(cb, buf, off);
+				break;
+		}
+
+		return;
+	}
+
+	switch(item.type) {
+		case Type::fill:
+			static_cast<const Polygon*>(item.object)->fill(cb);
+			break;
+		case Type::stroke:
+			static_cast<const Polygon*>(item.object)->stroke(cb);
+			break;
+		case Type::text:
+			static_cast<const Text*>(item.object)->draw(cb);
+			break;
+	}
+}
+
+std::vector<IndirectCommand> Scene::commands(const Item& item) const {
+	switch(item.type) {
+		case Type::fill:
+			return static_cast<const Polygon*>(item.object)->commands(
+				DrawType::fill);
+		case Type::stroke:
+			return static_cast<const Polygon*>(item.object)->commands(
+				DrawType::stroke);
+		case Type::text: {
+			// indexed command, takes the space of two commands
+			auto cmd = static_cast<const Text*>(item.object)->command();
+			auto second = cmd;
+			second.offset += commandSize;
+			return {cmd, second};
+		}
+	}
+
+	return {};
+}
+
+std::optional<Rect2f> Scene::localBounds(const Item& item) const {
+	auto& ctx = context();
+	auto bounds = item.bounds;
+	if(!bounds) {
+		bounds = item.type == Type::text ?
+			static_cast<const Text*>(item.object)->drawBounds() :
+			static_cast<const Polygon*>(item.object)->bounds();
+	}
+
+	// the scissor is applied in local coordinates
+	auto* s = item.state.scissor ? item.state.scissor : &ctx.defaultScissor();
+	return intersection(*bounds, s->rect());
+}
+
+bool Scene::visible(const Item& item) const {
+	auto bounds = localBounds(item);
+	if(!bounds) {
+		return false;
+	}
+
+	auto* t = item.state.transform ?
+		item.state.transform : &context().identityTransform();
+	auto& m = t->matrix();
+	auto min = Vec2f {1e30f, 1e30f};
+	auto max = Vec2f {-1e30f, -1e30f};
+	for(auto i = 0u; i < 4; ++i) {
+		auto p = bounds->position;
+		p.x += (i == 1 || i == 2) * bounds->size.x;
+		p.y += (i >= 2) * bounds->size.y;
+
+		auto x = m[0][0] * p.x + m[0][1] * p.y + m[0][3];
+		auto y = m[1][0] * p.x + m[1][1] * p.y + m[1][3];
+		auto w = m[3][0] * p.x + m[3][1] * p.y + m[3][3];
+		if(w <= 0.f) { // conservative, see cull.comp
+			return true;
+		}
+
+		min = {std::min(min.x, x / w), std::min(min.y, y / w)};
+		max = {std::max(max.x, x / w), std::max(max.y, y / w)};
+	}
+
+	return min.x < 1.f && min.y < 1.f && max.x > -1.f && max.y > -1.f;
+}
+
+void Scene::culling(Culling culling) {
+	culling_ = culling;
+	for(auto& item : items_) {
+		item.visible = true;
+	}
+
+	context().rerecord();
+}
+
+bool Scene::updateCulling() {
+	dlg_assert(context_);
+	auto& ctx = context();
+	if(culling_ == Culling::cpu) {
+		auto changed = false;
+		for(auto& item : items_) {
+			auto vis = visible(item);
+			changed |= (vis != item.visible);
+			item.visible = vis;
+		}
+
+		if(changed) {
+			ctx.rerecord();
+		}
+
+		return changed;
+	} else if(culling_ != Culling::gpu) {
+		return false;
+	}
+
+	// the number of commands only changes with a rerecord (draw mode)
+	std::vector<CullItem> data;
+	data.reserve(items_.size());
+	auto count = 0u;
+	for(auto& item : items_) {
+		auto n = item.type == Type::text ? 2u :
+			static_cast<const Polygon*>(item.object)->commandCount(
+				item.type == Type::fill ? DrawType::fill : DrawType::stroke);
+		item.command = count;
+
+		// culled by giving it empty bounds
+		auto& d = data.emplace_back();
+		auto bounds = localBounds(item).value_or(Rect2f {});
+		d.bounds = {bounds.position.x, bounds.position.y,
+			bounds.size.x, bounds.size.y};
+		d.transform = item.state.transform ?
+			item.state.transform->matrix() : ctx.identityTransform().matrix();
+		d.first = count;
+		d.count = n;
+		count += n;
+	}
+
+	// (re)allocate the buffers
+	auto& dev = ctx.device();
+	auto align = dev.properties().limits.minStorageBufferOffsetAlignment;
+	auto realloc = false;
+	auto itemsSize = std::max<vk::DeviceSize>(data.size(), 1u) * sizeof(CullItem);
+	if(cullItems_.size() < itemsSize) {
+		cullItems_ = {ctx.bufferAllocator(), 2 * itemsSize,
+			vk::BufferUsageBits::storageBuffer, dev.hostMemoryTypes(), align};
+		realloc = true;
+	}
+
+	auto cmdsSize = std::max(count, 1u) * commandSize;
+	if(cullCommands_.size() < cmdsSize) {
+		auto usage = vk::BufferUsageBits::storageBuffer |
+			vk::BufferUsageBits::indirectBuffer |
+			vk::BufferUsageBits::transferDst;
+		cullCommands_ = {ctx.bufferAllocator(), 2 * cmdsSize,
+			usage, dev.deviceMemoryTypes(), align};
+		realloc = true;
+	}
+
+	if(realloc) {
+		if(!cullDs_) {
+			cullDs_ = {ctx.dsAllocator(), ctx.cullPipeline().dsLayout};
+		}
+
+		vpp::DescriptorSetUpdate update(cullDs_);
+		update.storage({{cullItems_.buffer(), cullItems_.offset(),
+			cullItems_.size()}});
+		update.storage({{cullCommands_.buffer(), cullCommands_.offset(),
+			cullCommands_.size()}});
+		ctx.rerecord();
+	}
+
+	if(!data.empty()) {
+		writeMapped(ctx, cullItems_, nytl::span(data.data(), data.size()));
+	}
+
+	return realloc;
+}
+
+void Scene::recordCull(vk::CommandBuffer cb) {
+	dlg_assert(culling_ == Culling::gpu);
+	dlg_assertm(cullCommands_.size(), "updateCulling wasn't called");
+	if(items_.empty()) {
+		return;
+	}
+
+	// copy the draw commands of all items, grouped by source buffer
+	auto dst = cullCommands_.buffer().vkHandle();
+	std::unordered_map<vk::Buffer, std::vector<vk::BufferCopy>> copies;
+	for(auto& item : items_) {
+		auto cmds = commands(item);
+		for(auto i = 0u; i < cmds.size(); ++i) {
+			auto off = cullCommands_.offset() + (item.command + i) * commandSize;
+			copies[cmds[i].buffer].push_back({cmds[i].offset, off, commandSize});
+		}
+	}
+
+	// the commands might have been written by an upload before
+	vk::MemoryBarrier barrier;
+	barrier.srcAccessMask = vk::AccessBits::transferWrite;
+	barrier.dstAccessMask = vk::AccessBits::transferRead;
+	vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::transfer,
+		vk::PipelineStageBits::transfer, {}, {{barrier}}, {}, {});
+
+	for(auto& copy : copies) {
+		vk::cmdCopyBuffer(cb, copy.first, dst, copy.second);
+	}
+
+	barrier.srcAccessMask = vk::AccessBits::transferWrite;
+	barrier.dstAccessMask = vk::AccessBits::shaderRead |
+		vk::AccessBits::shaderWrite;
+	vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::transfer,
+		vk::PipelineStageBits::computeShader, {}, {{barrier}}, {}, {});
+
+	auto& cull = context().cullPipeline();
+	std::uint32_t count = items_.size();
+	vk::cmdBindPipeline(cb, vk::PipelineBindPoint::compute, cull.pipe);
+	vk::cmdBindDescriptorSets(cb, vk::PipelineBindPoint::compute,
+		cull.layout, 0, {{cullDs_.vkHandle()}}, {});
+	vk::cmdPushConstants(cb, cull.layout, vk::ShaderStageBits::compute,
+		0, 4, &count);
+	vk::cmdDispatch(cb, (count + cullGroupSize - 1) / cullGroupSize, 1, 1);
+
+	barrier.srcAccessMask = vk::AccessBits::shaderWrite;
+	barrier.dstAccessMask = vk::AccessBits::indirectCommandRead;
+	vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::computeShader,
+		vk::PipelineStageBits::drawIndirect, {}, {{barrier}}, {}, {});
+}
+
+bool Scene::updated() const {
+	dlg_assert(context_);
+	auto& updated = context().updatedObjects();
+	auto changed = [&](const DeviceObject* obj) {
+		return obj && updated.find(obj) != updated.end();
+	};
+
+	for(auto& item : items_) {
+		auto& state = item.state;
+		if(changed(object(item.object, item.type == Type::text)) ||
+				changed(state.paint) ||
+				changed(state.transform) ||
+				changed(state.scissor)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+std::optional<Rect2f> Scene::drawRect(const Item& item,
+		const vk::Viewport& vp) const {
+	auto& ctx = context();
+	auto bounds = localBounds(item);
+	if(!bounds) {
+		return std::nullopt;
+	}
+
+	// local -> ndc -> framebuffer
+	auto* t = item.state.transform ?
+		item.state.transform : &ctx.identityTransform();
+	auto& m = t->matrix();
+	auto min = Vec2f {1e30f, 1e30f};
+	auto max = Vec2f {-1e30f, -1e30f};
+	for(auto i = 0u; i < 4; ++i) {
+		auto p = bounds->position;
+		p.x += (i == 1 || i == 2) * bounds->size.x;
+		p.y += (i >= 2) * bounds->size.y;
+
+		auto x = m[0][0] * p.x + m[0][1] * p.y + m[0][3];
+		auto y = m[1][0] * p.x + m[1][1] * p.y + m[1][3];
+		auto w = m[3][0] * p.x + m[3][1] * p.y + m[3][3];
+		x = vp.x + (x / w + 1.f) * 0.5f * vp.width;
+		y = vp.y + (y / w + 1.f) * 0.5f * vp.height;
+
+		min = {std::min(min.x, x), std::min(min.y, y)};
+		max = {std::max(max.x, x), std::max(max.y, y)};
+	}
+
+	// round outwards, clamp to viewport
+	auto view = Rect2f {{vp.x, vp.y}, {vp.width, vp.height}};
+	min = {std::floor(min.x), std::floor(min.y)};
+	max = {std::ceil(max.x), std::ceil(max.y)};
+	return intersection({min, max - min}, view);
+}
+
+std::vector<vk::Rect2D> Scene::damage(const vk::Viewport& vp) {
+	dlg_assert(context_);
+	auto& updated = context().updatedObjects();
+	auto changed = [&](const DeviceObject* obj) {
+		return obj && updated.find(obj) != updated.end();
+	};
+
+	auto rects = std::move(damage_);
+	damage_ = {};
+	for(auto& item : items_) {
+		auto& state = item.state;
+		auto dirty = item.dirty ||
+			changed(object(item.object, item.type == Type::text)) ||
+			changed(state.paint) ||
+			changed(state.transform) ||
+			changed(state.scissor);
+
+		auto rect = drawRect(item, vp);
+		if(dirty) {
+			if(item.drawn) {
+				rects.push_back(*item.drawn);
+			}
+
+			if(rect) {
+				rects.push_back(*rect);
+			}
+		}
+
+		item.drawn = rect;
+		item.damaged = true;
+		item.dirty = false;
+	}
+
+	// Regions must not overlap, items in them would be drawn twice.
+	// Limit their number by merging the last ones, which might
+	// create new overlaps
+	mergeOverlaps(rects);
+	while(rects.size() > maxDamageRegions) {
+		auto last = rects.back();
+		rects.pop_back();
+		rects.back() = unite(rects.back(), last);
+		mergeOverlaps(rects);
+	}
+
+	std::vector<vk::Rect2D> ret;
+	ret.reserve(rects.size());
+	for(auto& r : rects) {
+		ret.push_back({{int32_t(r.position.x), int32_t(r.position.y)},
+			{uint32_t(r.size.x), uint32_t(r.size.y)}});
+	}
+
+	return ret;
+}
+
+} // namespace rvg
@@ -7,9 +7,22 @@
 #include <rvg/context.hpp>
 #include <katachi/path.hpp>
 #include <katachi/curves.hpp>
+#include <nytl/vecOps.hpp>
 #include <dlg/dlg.hpp>
 
 namespace rvg {
+namespace {
+
+// The scale curves are flattened at: the scale of the shape times the
+// scale of its pre-transform (DrawMode::transform). Like the scale of
+// shapes only changes at powers of two so that transforming a shape
+// usually doesn't need to flatten its curves again.
+float detailScale(float scale, const nytl::Mat3f& transform) {
+	auto s = scale * rvg::scale(transform);
+	return s > 0.f ? lodScale(s) : scale;
+}
+
+} // anon namespace
 
 // Shape
 Shape::Shape(Context& ctx, std::vector<Vec2f> p, const DrawMode& d) :
@@ -23,6 +36,13 @@ void Shape::update() {
 	polygon_.update(state_.points, state_.drawMode);
 }
 
+void Shape::transform(const nytl::Mat3f& t) {
+	state_.drawMode.transform = t;
+	if(!polygon_.transform(t)) {
+		update();
+	}
+}
+
 void Shape::disable(bool d, DrawType t) {
 	polygon_.disable(d, t);
 }
@@ -41,12 +61,9 @@ RectShape::RectShape(Context& ctx, Vec2f p, Vec2f s,
 }
 
 void RectShape::update() {
-	// TODO: can probably all be done easier... first multiply
-	// pos and size with transforms and then use the multiplied
-	// radius
+	// the polygon applies the pre-transform
 	auto tp = [&](float x, float y) {
-		auto p = state_.position + Vec2f{x, y};
-		return multPos(state_.transform, p);
+		return state_.position + Vec2f{x, y};
 	};
 
 	if(state_.rounding == std::array<float, 4>{0.f, 0.f, 0.f, 0.f}) {
@@ -59,7 +76,13 @@ void RectShape::update() {
 		};
 		polygon_.update(points, state_.drawMode);
 	} else {
-		constexpr auto steps = 12u; // TODO: make dependent on size
+		auto tolerance = context().settings().curveTolerance;
+		auto s = detailScale(scale_, state_.drawMode.transform);
+		auto steps = [&](float radius) {
+			return arcSegments(s * radius, 0.5f * nytl::constants::pi,
+				tolerance);
+		};
+
 		auto size = state_.size;
 		std::vector<Vec2f> points;
 		auto& rounding = state_.rounding;
@@ -68,7 +91,6 @@ void RectShape::update() {
 		if(rounding[0] != 0.f) {
 			dlg_assert(rounding[0] > 0.f);
 			auto radius = Vec2f{rounding[0], rounding[0]};
-			radius = multDir(state_.transform, radius);
 
 			points.push_back(tp(0, rounding[0]));
 			auto a1 = ktc::CenterArc {
@@ -76,7 +98,7 @@ void RectShape::update() {
 				nytl::constants::pi,
 				nytl::constants::pi * 1.5f
 			};
-			ktc::flatten(a1, points, steps);
+			ktc::flatten(a1, points, steps(rounding[0]));
 		} else {
 			points.push_back(tp(0, 0));
 		}
@@ -85,7 +107,6 @@ void RectShape::update() {
 		if(rounding[1] != 0.f) {
 			dlg_assert(rounding[1] > 0.f);
 			auto radius = Vec2f{rounding[1], rounding[1]};
-			radius = multDir(state_.transform, radius);
 
 			points.push_back(tp(size.x - rounding[1], 0.f));
 			auto a1 = ktc::CenterArc {
@@ -93,7 +114,7 @@ void RectShape::update() {
 				nytl::constants::pi * 1.5f,
 				nytl::constants::pi * 2.f
 			};
-			ktc::flatten(a1, points, steps);
+			ktc::flatten(a1, points, steps(rounding[1]));
 		} else {
 			points.push_back(tp(size.x, 0.f));
 		}
@@ -102,7 +123,6 @@ void RectShape::update() {
 		if(rounding[2] != 0.f) {
 			dlg_assert(rounding[2] > 0.f);
 			auto radius = Vec2f{rounding[2], rounding[2]};
-			radius = multDir(state_.transform, radius);
 
 			points.push_back(tp(size.x, size.y - rounding[2]));
 			auto a1 = ktc::CenterArc {
@@ -110,7 +130,7 @@ void RectShape::update() {
 				0.f,
 				nytl::constants::pi * 0.5f
 			};
-			ktc::flatten(a1, points, steps);
+			ktc::flatten(a1, points, steps(rounding[2]));
 		} else {
 			points.push_back(tp(size.x, size.y));
 		}
@@ -119,7 +139,6 @@ void RectShape::update() {
 		if(rounding[3] != 0.f) {
 			dlg_assert(rounding[3] > 0.f);
 			auto radius = Vec2f{rounding[3], rounding[3]};
-			radius = multDir(state_.transform, radius);
 
 			points.push_back(tp(rounding[3], size.y));
 			auto a1 = ktc::CenterArc {
@@ -127,7 +146,7 @@ void RectShape::update() {
 				nytl::constants::pi * 0.5f,
 				nytl::constants::pi * 1.f,
 			};
-			ktc::flatten(a1, points, steps);
+			ktc::flatten(a1, points, steps(rounding[3]));
 		} else {
 			points.push_back(tp(0, size.y));
 		}
@@ -146,6 +165,24 @@ bool RectShape::disabled(DrawType t) const {
 	return polygon_.disabled(t);
 }
 
+void RectShape::scale(float scale) {
+	auto lod = lodScale(scale);
+	if(lod != scale_) {
+		scale_ = lod;
+		update();
+	}
+}
+
+void RectShape::transform(const nytl::Mat3f& t) {
+	auto& mode = state_.drawMode;
+	auto curved = state_.rounding != std::array<float, 4>{0.f, 0.f, 0.f, 0.f};
+	auto lod = detailScale(scale_, mode.transform) != detailScale(scale_, t);
+	mode.transform = t;
+	if((curved && lod) || !polygon_.transform(t)) {
+		update();
+	}
+}
+
 // CircleShape
 CircleShape::CircleShape(Context& ctx,
 	Vec2f xcenter, Vec2f xradius, const DrawMode& xdraw,
@@ -169,7 +206,11 @@ void CircleShape::update() {
 	auto radius = state_.radius;
 	auto center = state_.center;
 	if(pcount == defaultPointCount) {
-		pcount = std::min(8 + 8 * ((radius.x + radius.y) / 16), 256.f);
+		auto tolerance = context().settings().curveTolerance;
+		auto s = detailScale(scale_, state_.drawMode.transform);
+		auto r = s * std::max(radius.x, radius.y);
+		pcount = std::max(arcSegments(r, 2 * nytl::constants::pi, tolerance),
+			8u);
 	}
 
 	std::vector<Vec2f> pts;
@@ -180,7 +221,7 @@ void CircleShape::update() {
 	for(auto i = 0u; i < pcount + 1; ++i) {
 		using namespace nytl::vec::cw::operators;
 		auto p = nytl::Vec2f{std::cos(a), std::sin(a)};
-		pts.push_back(multPos(state_.transform, center + radius * p));
+		pts.push_back(center + radius * p);
 		a += d;
 	}
 
@@ -195,4 +236,278 @@ bool CircleShape::disabled(DrawType t) const {
 	return polygon_.disabled(t);
 }
 
+void CircleShape::scale(float scale) {
+	auto lod = lodScale(scale);
+	if(lod != scale_) {
+		scale_ = lod;
+		update();
+	}
+}
+
+void CircleShape::transform(const nytl::Mat3f& t) {
+	auto& mode = state_.drawMode;
+	auto automatic = state_.pointCount == defaultPointCount;
+	auto lod = detailScale(scale_, mode.transform) != detailScale(scale_, t);
+	mode.transform = t;
+	if((automatic && lod) || !polygon_.transform(t)) {
+		update();
+	}
+}
+
+// PathShape
+namespace {
+
+constexpr auto maxCurveSegments = 256.f;
+
+// The maximum distance between a bezier curve and n uniform segments
+// is bounded by max|B''| / (8 * n^2).
+unsigned curveSegments(float maxSecondDerivative, float tolerance) {
+	auto count = std::ceil(std::sqrt(maxSecondDerivative / (8 * tolerance)));
+	return unsigned(std::clamp(count, 1.f, maxCurveSegments));
+}
+
+struct PathFlattener {
+	std::vector<Vec2f>& points;
+	float scale;
+	float tolerance;
+
+	void operator()(const PathShape::Move& move) {
+		points.push_back(move.to);
+	}
+
+	void operator()(const PathShape::Line& line) {
+		points.push_back(line.to);
+	}
+
+	void operator()(const PathShape::Quad& quad) {
+		auto p0 = points.back();
+		auto dd = nytl::length(p0 - 2.f * quad.control + quad.to);
+		auto count = curveSegments(2.f * scale * dd, tolerance);
+		for(auto i = 1u; i < count; ++i) {
+			auto t = float(i) / count;
+			auto mt = 1 - t;
+			points.push_back(mt * mt * p0 + 2.f * mt * t * quad.control +
+				t * t * quad.to);
+		}
+
+		points.push_back(quad.to);
+	}
+
+	void operator()(const PathShape::Cubic& cubic) {
+		auto p0 = points.back();
+		auto& p1 = cubic.control1;
+		auto& p2 = cubic.control2;
+		auto& p3 = cubic.to;
+		auto dd = std::max(
+			nytl::length(p0 - 2.f * p1 + p2),
+			nytl::length(p1 - 2.f * p2 + p3));
+		auto count = curveSegments(6.f * scale * dd, tolerance);
+		for(auto i = 1u; i < count; ++i) {
+			auto t = float(i) / count;
+			auto mt = 1 - t;
+			points.push_back(mt * mt * mt * p0 + 3.f * mt * mt * t * p1 +
+				3.f * mt * t * t * p2 + t * t * t * p3);
+		}
+
+		points.push_back(p3);
+	}
+
+	// See the svg specification, implementation notes F.6.5
+	void operator()(const PathShape::Arc& arc) {
+		auto from = points.back();
+		auto rx = std::abs(arc.radius.x);
+		auto ry = std::abs(arc.radius.y);
+		if(from == arc.to || rx == 0.f || ry == 0.f) {
+			points.push_back(arc.to);
+			return;
+		}
+
+		// transform into the coordinate system of the ellipse
+		auto cr = std::cos(arc.rotation);
+		auto sr = std::sin(arc.rotation);
+		auto d = 0.5f * (from - arc.to);
+		auto x1 = cr * d.x + sr * d.y;
+		auto y1 = -sr * d.x + cr * d.y;
+
+		// scale up radii that are too small
+		auto lambda = (x1 * x1) / (rx * rx) + (y1 * y1) / (ry * ry);
+		if(lambda > 1.f) {
+			rx *= std::sqrt(lambda);
+			ry *= std::sqrt(lambda);
+		}
+
+		auto rx2 = rx * rx;
+		auto ry2 = ry * ry;
+		auto num = rx2 * ry2 - rx2 * y1 * y1 - ry2 * x1 * x1;
+		auto den = rx2 * y1 * y1 + ry2 * x1 * x1;
+		auto coeff = std::sqrt(std::max(num / den, 0.f));
+		if(arc.largeArc == arc.sweep) {
+			coeff = -coeff;
+		}
+
+		auto cx1 = coeff * rx * y1 / ry;
+		auto cy1 = -coeff * ry * x1 / rx;
+		auto mid = 0.5f * (from + arc.to);
+		auto center = Vec2f {
+			cr * cx1 - sr * cy1 + mid.x,
+			sr * cx1 + cr * cy1 + mid.y
+		};
+
+		constexpr auto pi = nytl::constants::pi;
+		auto start = std::atan2((y1 - cy1) / ry, (x1 - cx1) / rx);
+		auto end = std::atan2((-y1 - cy1) / ry, (-x1 - cx1) / rx);
+		auto delta = end - start;
+		if(arc.sweep && delta < 0.f) {
+			delta += 2.f * pi;
+		} else if(!arc.sweep && delta > 0.f) {
+			delta -= 2.f * pi;
+		}
+
+		auto count = arcSegments(scale * std::max(rx, ry), delta, tolerance);
+		for(auto i = 1u; i < count; ++i) {
+			auto a = start + delta * (float(i) / count);
+			auto x = rx * std::cos(a);
+			auto y = ry * std::sin(a);
+			points.push_back({
+				cr * x - sr * y + center.x,
+				sr * x + cr * y + center.y});
+		}
+
+		points.push_back(arc.to);
+	}
+};
+
+} // anon namespace
+
+PathShape::PathShape(Context& ctx, const DrawMode& mode) : polygon_(ctx) {
+	state_.drawMode = mode;
+}
+
+void PathShape::moveTo(Vec2f pos) {
+	if(state_.commands.empty()) {
+		state_.start = pos;
+		return;
+	}
+
+	state_.commands.push_back(Move {pos});
+}
+
+void PathShape::lineTo(Vec2f to) {
+	state_.commands.push_back(Line {to});
+}
+
+void PathShape::quadTo(Vec2f control, Vec2f to) {
+	state_.commands.push_back(Quad {control, to});
+}
+
+void PathShape::cubicTo(Vec2f control1, Vec2f control2, Vec2f to) {
+	state_.commands.push_back(Cubic {control1, control2, to});
+}
+
+void PathShape::arcTo(Vec2f radius, float rotation, bool largeArc,
+		bool sweep, Vec2f to) {
+	state_.commands.push_back(Arc {radius, rotation, largeArc, sweep, to});
+}
+
+void PathShape::close() {
+	auto start = state_.start;
+	for(auto it = state_.commands.rbegin(); it != state_.commands.rend(); ++it) {
+		if(auto* move = std::get_if<Move>(&*it)) {
+			start = move->to;
+			break;
+		}
+	}
+
+	state_.commands.push_back(Line {start});
+}
+
+void PathShape::clear() {
+	state_.start = {};
+	state_.commands.clear();
+}
+
+void PathShape::update() {
+	dlg_assertm(!state_.drawMode.color.fill && !state_.drawMode.color.stroke,
+		"PathShape does not support point colors");
+
+	// the points are moved into the polygon, reserve the size
+	// of the last update to avoid reallocations
+	std::vector<Vec2f> points;
+	points.reserve(pointCount_);
+	points.push_back(state_.start);
+
+	// Subpaths are holes for triangulated fills. Stencil fills draw all
+	// points as one fan, each subpath has to be closed so that the
+	// connections between them cancel out
+	auto& mode = state_.drawMode;
+	auto stencil = mode.fillRule == FillRule::nonZero ||
+		mode.fillRule == FillRule::evenOdd;
+	auto start = 0u;
+	auto closeSubpath = [&]{
+		if(stencil && points.back() != points[start]) {
+			points.push_back(points[start]);
+		}
+	};
+
+	std::vector<unsigned> subpaths;
+	auto tolerance = context().settings().curveTolerance;
+	auto scale = detailScale(scale_, mode.transform);
+	auto flattener = PathFlattener {points, scale, tolerance};
+	for(auto& cmd : state_.commands) {
+		if(std::holds_alternative<Move>(cmd)) {
+			closeSubpath();
+			start = unsigned(points.size());
+			subpaths.push_back(start);
+		}
+
+		std::visit(flattener, cmd);
+	}
+
+	if(subpaths.empty()) {
+		pointCount_ = points.size();
+		polygon_.update(std::move(points), mode);
+		return;
+	}
+
+	closeSubpath();
+	dlg_assertm(mode.fillRule != FillRule::convex || !mode.fill,
+		"PathShape: multiple subpaths can't be filled as convex polygon");
+	if(mode.stroke > 0.f) {
+		dlg_warn("PathShape: strokes don't support multiple subpaths");
+	}
+
+	auto polyMode = mode;
+	if(mode.fillRule == FillRule::triangulated) {
+		polyMode.holes = std::move(subpaths);
+	}
+
+	pointCount_ = points.size();
+	polygon_.update(std::move(points), polyMode);
+}
+
+void PathShape::disable(bool d, DrawType t) {
+	polygon_.disable(d, t);
+}
+
+bool PathShape::disabled(DrawType t) const {
+	return polygon_.disabled(t);
+}
+
+void PathShape::scale(float scale) {
+	auto lod = lodScale(scale);
+	if(lod != scale_) {
+		scale_ = lod;
+		update();
+	}
+}
+
+void PathShape::transform(const nytl::Mat3f& t) {
+	auto& mode = state_.drawMode;
+	auto lod = detailScale(scale_, mode.transform) != detailScale(scale_, t);
+	mode.transform = t;
+	if(lod || !polygon_.transform(t)) {
+		update();
+	}
+}
+
 } // namespac rvg
@@ -7,92 +7,172 @@
 #include <vpp/trackedDescriptor.hpp>
 #include <vpp/vk.hpp>
 #include <nytl/matOps.hpp>
+#include <algorithm>
+#include <cmath>
 
 namespace rvg {
 
 // Transform
-constexpr auto transformUboSize = sizeof(Mat4f);
 Transform::Transform(Context& ctx, bool deviceLocal) :
 	Transform(ctx, identity<4, float>(), deviceLocal) {
 }
 
 Transform::Transform(Context& ctx, const Mat4f& m, bool deviceLocal) :
 		DeviceObject(ctx), matrix_(m) {
-
-	auto usage = nytl::Flags {vk::BufferUsageBits::uniformBuffer};
-	if(deviceLocal) {
-		usage |= vk::BufferUsageBits::transferDst;
+	if(!ctx.settings().pushState) {
+		slot_ = ctx.transformArena(deviceLocal).allocate();
+		updateDevice();
 	}
-
-	auto memBits = deviceLocal ?
-		ctx.device().deviceMemoryTypes() :
-		ctx.device().hostMemoryTypes();
-
-	ubo_ = {ctx.bufferAllocator(), transformUboSize, usage, memBits, 16u};
-	ds_ = {ctx.dsAllocator(), ctx.dsLayoutTransform()};
-
-	updateDevice();
-	vpp::DescriptorSetUpdate update(ds_);
-	update.uniform({{ubo_.buffer(), ubo_.offset(), ubo_.size()}});
 }
 
 bool Transform::updateDevice() {
-	dlg_assert(valid() && ubo_.size() && ds_);
-	dlg_assert(writeBuffer(*this, ubo_, matrix_) == 64u);
-	return false;
+	dlg_assert(valid());
+
+	// the matrix was recorded into command buffers, either as push
+	// constant or as part of a hardware scissor
+	auto ret = recorded_;
+	recorded_ = false;
+	if(ret) {
+		context().rerecord(*this, RerecordReason::recorded);
+	}
+
+	if(context().settings().pushState) {
+		return ret;
+	}
+
+	dlg_assert(slot_.valid());
+	dlg_assert(writeBuffer(*this, slot_.span(), matrix_) == uboSize);
+	return ret;
 }
 
 void Transform::update() {
-	dlg_assert(valid() && ds_ && ubo_.size());
+	dlg_assert(valid());
 	context().registerUpdateDevice(this);
 }
 
 void Transform::bind(vk::CommandBuffer cb) const {
-	dlg_assert(valid() && ubo_.size() && ds_);
-	vk::cmdBindDescriptorSets(cb, vk::PipelineBindPoint::graphics,
-		context().pipeLayout(), Context::transformBindSet,
-		{{ds_.vkHandle()}}, {});
+	dlg_assert(valid());
+	if(context().settings().pushState) {
+		context().pushTransform(cb, matrix_);
+		recorded_ = true;
+		return;
+	}
+
+	dlg_assert(slot_.valid());
+	context().bindDescriptorSet(cb, Context::transformBindSet,
+		slot_.ds(), slot_.offset());
 }
 
 // Scissor
-constexpr auto scissorUboSize = sizeof(Vec2f) * 2;
 Scissor::Scissor(Context& ctx, const Rect2f& r, bool deviceLocal)
-	: DeviceObject(ctx), rect_(r) {
-
-	auto usage = nytl::Flags {vk::BufferUsageBits::uniformBuffer};
-	if(deviceLocal) {
-		usage |= vk::BufferUsageBits::transferDst;
+		: DeviceObject(ctx), rect_(r) {
+	if(!ctx.settings().pushState) {
+		slot_ = ctx.scissorArena(deviceLocal).allocate();
+		updateDevice();
 	}
-
-	auto memBits = deviceLocal ?
-		ctx.device().deviceMemoryTypes() :
-		ctx.device().hostMemoryTypes();
-
-	ubo_ = {ctx.bufferAllocator(), scissorUboSize, usage, memBits, 8u};
-	ds_ = {ctx.dsAllocator(), ctx.dsLayoutScissor()};
-
-	updateDevice();
-	vpp::DescriptorSetUpdate update(ds_);
-	update.uniform({{ubo_.buffer(), ubo_.offset(), ubo_.size()}});
 }
 
 void Scissor::update() {
-	dlg_assert(valid() && ds_ && ubo_.size());
+	dlg_assert(valid());
 	context().registerUpdateDevice(this);
 }
 
 bool Scissor::updateDevice() {
-	dlg_assert(ubo_.size() && ds_);
-	dlg_assert(writeBuffer(*this, ubo_, rect_.position, rect_.size) ==
-		scissorUboSize);
-	return false;
+	dlg_assert(valid());
+
+	// the rect was recorded into command buffers, either as push
+	// constant or as hardware scissor
+	auto ret = recorded_;
+	recorded_ = false;
+	if(ret) {
+		context().rerecord(*this, RerecordReason::recorded);
+	}
+
+	if(context().settings().pushState) {
+		return ret;
+	}
+
+	dlg_assert(slot_.valid());
+	dlg_assert(writeBuffer(*this, slot_.span(), rect_.position, rect_.size) ==
+		uboSize);
+	return ret;
 }
 
 void Scissor::bind(vk::CommandBuffer cmdb) const {
-	dlg_assert(ubo_.size() && ds_);
-	vk::cmdBindDescriptorSets(cmdb, vk::PipelineBindPoint::graphics,
-		context().pipeLayout(), Context::scissorBindSet,
-		{{ds_.vkHandle()}}, {});
+	dlg_assert(valid());
+
+	// reset a previously bound hardware scissor
+	auto& state = context().recordState(cmdb);
+	if(state.hwScissor) {
+		vk::cmdSetScissor(cmdb, 0, 1, state.fullScissor);
+		state.hwScissor = false;
+	}
+
+	if(context().settings().pushState) {
+		context().pushScissor(cmdb, rect_);
+		recorded_ = true;
+		return;
+	}
+
+	dlg_assert(slot_.valid());
+	context().bindDescriptorSet(cmdb, Context::scissorBindSet,
+		slot_.ds(), slot_.offset());
+}
+
+bool Scissor::bind(vk::CommandBuffer cmdb, const Transform& transform,
+		const vk::Viewport& vp) const {
+	dlg_assert(valid());
+	auto& ctx = context();
+	if(!ctx.settings().dynamicScissor) {
+		bind(cmdb);
+		return false;
+	}
+
+	// full viewport scissor, rounded outwards
+	auto vx = std::max(std::floor(vp.x), 0.f);
+	auto vy = std::max(std::floor(vp.y), 0.f);
+	auto vw = std::ceil(vp.x + vp.width) - vx;
+	auto vh = std::ceil(vp.y + vp.height) - vy;
+	vk::Rect2D full {{int32_t(vx), int32_t(vy)}, {uint32_t(vw), uint32_t(vh)}};
+
+	// the transform must only scale and translate, otherwise the
+	// scissored area is no axis-aligned rectangle in framebuffer space
+	auto& m = transform.matrix();
+	if(m[0][1] != 0.f || m[1][0] != 0.f || m[3][0] != 0.f ||
+			m[3][1] != 0.f || m[3][3] != 1.f) {
+		bind(cmdb);
+		return false;
+	}
+
+	// rect -> ndc -> framebuffer coordinates
+	auto map = [&](Vec2f p) {
+		auto nx = m[0][0] * p.x + m[0][3];
+		auto ny = m[1][1] * p.y + m[1][3];
+		return Vec2f {
+			vp.x + (nx + 1.f) * 0.5f * vp.width,
+			vp.y + (ny + 1.f) * 0.5f * vp.height};
+	};
+
+	auto a = map(rect_.position);
+	auto b = map(rect_.position + rect_.size);
+
+	// round to the nearest pixel centers, clamp to the viewport
+	auto x0 = std::clamp(std::round(std::min(a.x, b.x)), vx, vx + vw);
+	auto y0 = std::clamp(std::round(std::min(a.y, b.y)), vy, vy + vh);
+	auto x1 = std::clamp(std::round(std::max(a.x, b.x)), vx, vx + vw);
+	auto y1 = std::clamp(std::round(std::max(a.y, b.y)), vy, vy + vh);
+
+	vk::Rect2D scissor {{int32_t(x0), int32_t(y0)},
+		{uint32_t(x1 - x0), uint32_t(y1 - y0)}};
+	vk::cmdSetScissor(cmdb, 0, 1, scissor);
+
+	auto& state = ctx.recordState(cmdb);
+	state.hwScissor = true;
+	state.fullScissor = full;
+
+	recorded_ = true;
+	transform.markRecorded();
+	return true;
 }
 
 } // namespace rvg
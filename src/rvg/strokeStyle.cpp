@@ -0,0 +1,219 @@
+// Copyright (c) 2019 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include "strokeStyle.hpp"
+#include <rvg/util.hpp>
+#include <nytl/vecOps.hpp>
+#include <dlg/dlg.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace rvg {
+namespace {
+
+constexpr auto pi = float(nytl::constants::pi);
+
+// scratch memory for the points without duplicates
+thread_local std::vector<Vec2f> uniquePoints;
+
+Vec2f leftNormal(Vec2f dir) { return {-dir.y, dir.x}; }
+float perpDot(Vec2f a, Vec2f b) { return a.x * b.y - a.y * b.x; }
+
+Vec2f rotated(Vec2f v, float angle) {
+	auto c = std::cos(angle);
+	auto s = std::sin(angle);
+	return {c * v.x - s * v.y, s * v.x + c * v.y};
+}
+
+// Writes the vertices, the pair of every point has the left
+// side (offset along the normal) first.
+struct StyledBaker {
+	const StrokeStyle& style;
+	float hw; // half width
+	float minJoinDot;
+	std::vector<Vec2f>& out;
+	std::vector<Vec2f>* aa;
+
+	// side: -1 for left, 1 for right, 0 for the center
+	void vertex(Vec2f pos, float side, float len) {
+		out.push_back(pos);
+		if(aa) {
+			aa->push_back({style.arcLength ? len : 1.f, side});
+		}
+	}
+
+	void pair(Vec2f pos, Vec2f off, float len) {
+		vertex(pos + hw * off, -1.f, len);
+		vertex(pos - hw * off, 1.f, len);
+	}
+
+	// like in bakeStroke, limited to miterLimit times the half width
+	Vec2f miter(Vec2f n0, Vec2f n1) const {
+		auto m = n0 + n1;
+		return (1.f / std::max(dot(m, n1), minJoinDot)) * m;
+	}
+
+	// The pair at the start (or end) of an open stroke with direction
+	// dir and its cap. Round caps are a fan from the left to the right
+	// side before (or after) the pair.
+	void cap(Vec2f p, Vec2f dir, float len, bool start) {
+		auto n = leftNormal(dir);
+		auto away = start ? -1.f : 1.f;
+		if(style.cap == LineCap::square) {
+			pair(p + away * hw * dir, n, len + away * hw);
+			return;
+		} else if(style.cap == LineCap::butt) {
+			pair(p, n, len);
+			return;
+		}
+
+		if(!start) {
+			pair(p, n, len);
+		}
+
+		// the arc length is projected onto the direction
+		auto steps = arcSegments(hw, pi, style.tolerance);
+		vertex(p + hw * n, 1.f, len);
+		for(auto i = 1u; i < steps; ++i) {
+			auto angle = pi * i / steps;
+			auto off = std::sin(angle) * away;
+			vertex(p, 0.f, len);
+			vertex(p + hw * (std::cos(angle) * n + off * dir), 1.f,
+				len + hw * off);
+		}
+
+		vertex(p, 0.f, len);
+		vertex(p - hw * n, 1.f, len);
+
+		if(start) {
+			pair(p, n, len);
+		}
+	}
+
+	// The join at p between the segments with directions d0 and d1.
+	// Round and bevel joins have a single vertex on the inner side and
+	// a fan around p on the outer side, from the end of the first
+	// segment to the start of the next one.
+	// With exitOnly, only writes the pair the next segment starts with
+	// (for the first point of loops, the join is written at the end).
+	void join(Vec2f p, Vec2f d0, Vec2f d1, float len, bool exitOnly) {
+		auto n0 = leftNormal(d0);
+		auto n1 = leftNormal(d1);
+		auto m = miter(n0, n1);
+		auto turn = perpDot(d0, d1);
+		auto straight = std::abs(turn) < 1e-4f && dot(d0, d1) > 0.f;
+		if(style.join == LineJoin::miter || straight) {
+			pair(p, m, len);
+			return;
+		}
+
+		// when turning left (towards the normal), the right side is outside
+		auto left = turn >= 0.f;
+		auto innerSide = left ? -1.f : 1.f;
+		auto inner = p - innerSide * hw * m;
+		auto o0 = innerSide * n0;
+		auto o1 = innerSide * n1;
+		auto outer1 = p + hw * o1;
+
+		if(exitOnly) {
+			if(left) {
+				vertex(inner, innerSide, len);
+				vertex(outer1, -innerSide, len);
+			} else {
+				vertex(outer1, -innerSide, len);
+				vertex(inner, innerSide, len);
+			}
+			return;
+		}
+
+		// the last two vertices must be (inner, outer0) before the fan
+		auto outer0 = p + hw * o0;
+		if(left) {
+			vertex(inner, innerSide, len);
+			vertex(outer0, -innerSide, len);
+		} else {
+			vertex(outer0, -innerSide, len);
+			vertex(inner, innerSide, len);
+			vertex(outer0, -innerSide, len);
+		}
+
+		auto angle = std::atan2(perpDot(o0, o1), dot(o0, o1));
+		auto steps = 1u;
+		if(style.join == LineJoin::round) {
+			steps = arcSegments(hw, angle, style.tolerance);
+		}
+
+		for(auto i = 1u; i < steps; ++i) {
+			vertex(p, 0.f, len);
+			vertex(p + hw * rotated(o0, angle * i / steps), -innerSide, len);
+		}
+
+		vertex(p, 0.f, len);
+		vertex(outer1, -innerSide, len);
+
+		// the next segment starts with the pair (left, right)
+		vertex(inner, innerSide, len);
+		if(left) {
+			vertex(outer1, -innerSide, len);
+		}
+	}
+};
+
+} // anon namespace
+
+void bakeStyledStroke(Span<const Vec2f> points, float width, bool loop,
+		const StrokeStyle& style, std::vector<Vec2f>& out,
+		std::vector<Vec2f>* aa) {
+	dlg_assert(style.miterLimit >= 1.f);
+
+	auto& pts = uniquePoints;
+	pts.clear();
+	for(auto& p : points) {
+		if(pts.empty() || p != pts.back()) {
+			pts.push_back(p);
+		}
+	}
+
+	if(pts.size() > 1 && pts.front() == pts.back()) {
+		pts.pop_back();
+		loop = true;
+	}
+
+	auto n = pts.size();
+	if(n < 2) {
+		return;
+	}
+
+	loop = loop && n > 2;
+	auto limit = style.miterLimit;
+	StyledBaker baker {style, 0.5f * width, 2.f / (limit * limit), out, aa};
+	auto dir = [&](std::size_t i) {
+		return nytl::normalized(pts[(i + 1) % n] - pts[i]);
+	};
+
+	auto len = 0.f;
+	if(loop) {
+		baker.join(pts[0], dir(n - 1), dir(0), 0.f, true);
+		for(auto i = 1u; i < n; ++i) {
+			len += nytl::distance(pts[i - 1], pts[i]);
+			baker.join(pts[i], dir(i - 1), dir(i), len, false);
+		}
+
+		len += nytl::distance(pts[n - 1], pts[0]);
+		baker.join(pts[0], dir(n - 1), dir(0), len, false);
+		return;
+	}
+
+	baker.cap(pts[0], dir(0), 0.f, true);
+	for(auto i = 1u; i < n - 1; ++i) {
+		len += nytl::distance(pts[i - 1], pts[i]);
+		baker.join(pts[i], dir(i - 1), dir(i), len, false);
+	}
+
+	len += nytl::distance(pts[n - 2], pts[n - 1]);
+	baker.cap(pts[n - 1], dir(n - 2), len, false);
+}
+
+} // namespace rvg
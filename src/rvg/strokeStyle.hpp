@@ -0,0 +1,36 @@
+// Copyright (c) 2019 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <rvg/fwd.hpp>
+#include <rvg/polygon.hpp>
+#include <nytl/vec.hpp>
+#include <nytl/span.hpp>
+#include <vector>
+
+namespace rvg {
+
+// The stroke settings the bulk bakeStroke doesn't support,
+// see DrawMode::cap.
+struct StrokeStyle {
+	LineCap cap {LineCap::butt};
+	LineJoin join {LineJoin::miter};
+	float miterLimit {4.f};
+	float tolerance {0.25f}; // for round caps and joins
+	bool arcLength {}; // write the arc length into the aa x coords
+};
+
+// Appends a triangle strip of the given width along the points with
+// the given caps (only for open strokes) and joins to out. Round caps and
+// the outer side of round and bevel joins are fans around the point,
+// connected with degenerate triangles. When aa is not null, also appends
+// the edge antialiasing coordinates of every vertex (see fill.frag),
+// the center of fans has a y coordinate of zero. Their x coordinate
+// is 1 or, with arcLength, the distance along the stroke.
+// Consecutive duplicated points are skipped.
+void bakeStyledStroke(Span<const Vec2f> points, float width, bool loop,
+	const StrokeStyle&, std::vector<Vec2f>& out, std::vector<Vec2f>* aa);
+
+} // namespace rvg
@@ -14,8 +14,9 @@ namespace rvg {
 // utility
 namespace {
 
-constexpr auto vertIndex0 = 2; // vertex index on the left
-constexpr auto vertIndex2 = 3; // vertex index on the right
+constexpr auto glyphVerts = 4u; // vertices per glyph quad
+constexpr auto vertIndex0 = 1; // vertex index on the left
+constexpr auto vertIndex2 = 2; // vertex index on the right
 
 float quantatize(float value, float quantum) {
 	return std::round(value / quantum) * quantum;
@@ -38,6 +39,7 @@ Text::Text(Text&& rhs) noexcept : DeviceObject(std::move(rhs)) {
 	state_ = std::move(rhs.state_);
 	deviceLocal_ = rhs.deviceLocal_;
 	disable_ = rhs.disable_;
+	drawBounds_ = rhs.drawBounds_;
 	posCache_ = std::move(rhs.posCache_);
 	uvCache_ = std::move(rhs.uvCache_);
 	posBuf_ = std::move(rhs.posBuf_);
@@ -54,6 +56,7 @@ Text& Text::operator=(Text&& rhs) noexcept {
 	state_ = std::move(rhs.state_);
 	deviceLocal_ = rhs.deviceLocal_;
 	disable_ = rhs.disable_;
+	drawBounds_ = rhs.drawBounds_;
 	posCache_ = std::move(rhs.posCache_);
 	uvCache_ = std::move(rhs.uvCache_);
 	posBuf_ = std::move(rhs.posBuf_);
@@ -77,6 +80,8 @@ Text::~Text() {
 void Text::update() {
 	constexpr auto quantum = 0.5f;
 	dlg_assert(valid() && font().valid());
+	auto zone = TraceZone(context(), "rvg::Text::update",
+		context().frameStats().time.bake);
 	auto& font = state_.font;
 	auto& text = state_.text;
 	auto pos = state_.position;
@@ -90,7 +95,7 @@ void Text::update() {
 	}
 
 	if(oldAtlas_ && &font.atlas() != oldAtlas_) {
-		context().rerecord();
+		context().rerecord(*this, RerecordReason::descriptor);
 		oldAtlas_->removed(*this);
 		font.atlas().added(*this);
 		oldAtlas_ = &font.atlas();
@@ -143,15 +148,27 @@ void Text::update() {
 			return;
 		}
 
-		// we render using a strip pipe. Those doubled points allow us to
-		// jump to the next quad. Not less efficient than using a list pipe
-		for(auto i : {1, 1, 0, 2, 3, 3}) {
+		// quads in strip order, drawn with the shared quad indices
+		for(auto i : {1, 0, 2, 3}) {
 			addVert(q, i);
 		}
 
 		prev = iter;
 	}
 
+	// bounds of the drawn quads, e.g. for culling
+	drawBounds_ = {};
+	if(!posCache_.empty()) {
+		auto min = posCache_[0];
+		auto max = posCache_[0];
+		for(auto& p : posCache_) {
+			min = {std::min(min.x, p.x), std::min(min.y, p.y)};
+			max = {std::max(max.x, p.x), std::max(max.y, p.y)};
+		}
+
+		drawBounds_ = {min, max - min};
+	}
+
 	font.atlas().validate();
 	context().registerUpdateDevice(this);
 	dlg_assert(posCache_.size() == uvCache_.size());
@@ -176,18 +193,23 @@ bool Text::updateDevice() {
 				context().device().hostMemoryTypes();
 			auto align = 8u;
 			buf = {context().bufferAllocator(), needed, usage, memBits, align};
+			++context().frameStats().reallocations;
+			context().rerecord(*this, RerecordReason::realloc);
 			rerecord = true;
 		}
 	};
 
 	auto posCacheSize = sizeof(Vec2f) * posCache_.size();
-	checkResize(posBuf_, sizeof(vk::DrawIndirectCommand) + posCacheSize,
+	checkResize(posBuf_, sizeof(vk::DrawIndexedIndirectCommand) + posCacheSize,
 		vk::BufferUsageBits::indirectBuffer);
 	checkResize(uvBuf_, sizeof(Vec2f) * uvCache_.size());
 
+	auto count = unsigned(posCache_.size());
+	context().sharedIndices(IndexPattern::quads, count);
+
 	// positionBuf contains the indirect draw command
-	vk::DrawIndirectCommand cmd {};
-	cmd.vertexCount = !disable_ * posCache_.size();
+	vk::DrawIndexedIndirectCommand cmd {};
+	cmd.indexCount = !disable_ * Context::indexCount(IndexPattern::quads, count);
 	cmd.instanceCount = 1;
 
 	auto posData = nytl::span(posCache_.data(), posCache_.size());
@@ -206,41 +228,53 @@ bool Text::updateDevice() {
 }
 
 void Text::draw(vk::CommandBuffer cb) const {
-	dlg_assert(valid() && font().valid());
+	auto cmd = command();
+	draw(cb, cmd.buffer, cmd.offset);
+}
 
-	vk::cmdBindPipeline(cb, vk::PipelineBindPoint::graphics,
-		context().stripPipe());
-	vk::cmdBindDescriptorSets(cb, vk::PipelineBindPoint::graphics,
-		context().pipeLayout(), Context::fontBindSet,
-		{{font().atlas().ds().vkHandle()}}, {});
+IndirectCommand Text::command() const {
+	return {posBuf_.buffer().vkHandle(), posBuf_.offset()};
+}
 
-	static constexpr auto type = uint32_t(1);
-	vk::cmdPushConstants(cb, context().pipeLayout(),
-		vk::ShaderStageBits::fragment, 0, 4, &type);
+void Text::draw(vk::CommandBuffer cb, vk::Buffer indirect,
+		vk::DeviceSize offset) const {
+	dlg_assert(valid() && font().valid());
 
-	auto ioff = sizeof(vk::DrawIndirectCommand);
+	auto& ctx = context();
+	ctx.bindPipeline(cb, ctx.pipes(cb).list);
+	ctx.bindDescriptorSet(cb, Context::fontBindSet,
+		font().atlas().ds().vkHandle());
+	ctx.pushType(cb, 1u);
+
+	auto ioff = sizeof(vk::DrawIndexedIndirectCommand);
 	auto off = posBuf_.offset() + ioff;
 
 	// use a dummy color buffer
 	auto pBuf = posBuf_.buffer().vkHandle();
 	auto uvBuf = uvBuf_.buffer().vkHandle();
-	vk::cmdBindVertexBuffers(cb, 0, {{pBuf, uvBuf, pBuf}},
+	ctx.bindVertexBuffers(cb, 0, {{pBuf, uvBuf, pBuf}},
 		{{off, uvBuf_.offset(), off}});
-	vk::cmdDrawIndirect(cb, posBuf_.buffer(), posBuf_.offset(), 1, 0);
+
+	// not cached, the shared buffer might have been replaced since
+	// our last update
+	auto& indices = ctx.sharedIndexBuffer(IndexPattern::quads);
+	vk::cmdBindIndexBuffer(cb, indices.buffer(), indices.offset(),
+		vk::IndexType::uint32);
+	vk::cmdDrawIndexedIndirect(cb, indirect, offset, 1, 0);
 }
 
 // TODO: the given x is in logical space but posCache_ is in
 // (pre-)transformed state at the moment.
 unsigned Text::charAt(float x) const {
 	x += state_.position.x;
-	for(auto i = 0u; i < posCache_.size(); i += 6) {
+	for(auto i = 0u; i < posCache_.size(); i += glyphVerts) {
 		auto end = posCache_[i + vertIndex2].x;
 		if(x < end) {
-			return i / 6;
+			return i / glyphVerts;
 		}
 	}
 
-	return unsigned(posCache_.size() / 6);
+	return unsigned(posCache_.size() / glyphVerts);
 }
 
 // NOTE: although it would be desirable, we cannot derive the information of
@@ -313,9 +347,9 @@ void Text::deviceLocal(bool set) {
 				ud = true;
 			}
 
+			// reallocating the buffers will trigger a rerecord
 			if(ud) {
 				updateDevice();
-				context().rerecord();
 			}
 		}
 	}
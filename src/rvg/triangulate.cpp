@@ -0,0 +1,736 @@
+// Copyright (c) 2019 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+// Ear clipping with hole elimination, follows the algorithm of
+// mapbox/earcut. Instead of walking around the polygon and hashing all
+// points by z-order, larger polygons keep a queue of ear candidates and
+// a grid of the reflex points (only they can be inside an ear), which
+// avoids quadratic behavior for long concave chains.
+
+#include "triangulate.hpp"
+#include <dlg/dlg.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <limits>
+
+namespace rvg {
+namespace {
+
+struct Node {
+	std::uint32_t i; // index of the point
+
+	// double precision is needed for dense polygons, otherwise
+	// the orientation tests of nearly collinear points are noise
+	double x;
+	double y;
+
+	Node* prev {};
+	Node* next {};
+
+	bool steiner {};
+	bool removed {};
+	bool reflex {}; // part of the reflex grid
+	std::size_t queued {}; // last position in the candidate queue
+};
+
+double area(const Node& p, const Node& q, const Node& r) {
+	return (q.y - p.y) * (r.x - q.x) - (q.x - p.x) * (r.y - q.y);
+}
+
+bool equals(const Node& a, const Node& b) {
+	return a.x == b.x && a.y == b.y;
+}
+
+bool pointInTriangle(double ax, double ay, double bx, double by, double cx,
+		double cy, double px, double py) {
+	return (cx - px) * (ay - py) >= (ax - px) * (cy - py) &&
+		(ax - px) * (by - py) >= (bx - px) * (ay - py) &&
+		(bx - px) * (cy - py) >= (cx - px) * (by - py);
+}
+
+bool pointInTriangle(const Node& a, const Node& b, const Node& c,
+		const Node& p) {
+	return pointInTriangle(a.x, a.y, b.x, b.y, c.x, c.y, p.x, p.y);
+}
+
+int sign(double val) {
+	return (0.0 < val) - (val < 0.0);
+}
+
+// whether q lies on segment pr, given that they are collinear
+bool onSegment(const Node& p, const Node& q, const Node& r) {
+	return q.x <= std::max(p.x, r.x) && q.x >= std::min(p.x, r.x) &&
+		q.y <= std::max(p.y, r.y) && q.y >= std::min(p.y, r.y);
+}
+
+bool intersects(const Node& p1, const Node& q1, const Node& p2,
+		const Node& q2) {
+	auto o1 = sign(area(p1, q1, p2));
+	auto o2 = sign(area(p1, q1, q2));
+	auto o3 = sign(area(p2, q2, p1));
+	auto o4 = sign(area(p2, q2, q1));
+
+	if(o1 != o2 && o3 != o4) {
+		return true;
+	}
+
+	return (o1 == 0 && onSegment(p1, p2, q1)) ||
+		(o2 == 0 && onSegment(p1, q2, q1)) ||
+		(o3 == 0 && onSegment(p2, p1, q2)) ||
+		(o4 == 0 && onSegment(p2, q1, q2));
+}
+
+bool intersectsPolygon(const Node& a, const Node& b) {
+	auto* p = &a;
+	do {
+		if(p->i != a.i && p->next->i != a.i && p->i != b.i &&
+				p->next->i != b.i && intersects(*p, *p->next, a, b)) {
+			return true;
+		}
+		p = p->next;
+	} while(p != &a);
+
+	return false;
+}
+
+bool locallyInside(const Node& a, const Node& b) {
+	return area(*a.prev, a, *a.next) < 0 ?
+		area(a, b, *a.next) >= 0 && area(a, *a.prev, b) >= 0 :
+		area(a, b, *a.prev) < 0 || area(a, *a.next, b) < 0;
+}
+
+bool middleInside(const Node& a, const Node& b) {
+	auto* p = &a;
+	auto inside = false;
+	auto px = 0.5 * (a.x + b.x);
+	auto py = 0.5 * (a.y + b.y);
+	do {
+		auto& n = *p->next;
+		if(((p->y > py) != (n.y > py)) && n.y != p->y &&
+				(px < (n.x - p->x) * (py - p->y) / (n.y - p->y) + p->x)) {
+			inside = !inside;
+		}
+		p = p->next;
+	} while(p != &a);
+
+	return inside;
+}
+
+bool isValidDiagonal(const Node& a, const Node& b) {
+	return a.next->i != b.i && a.prev->i != b.i && !intersectsPolygon(a, b) &&
+		((locallyInside(a, b) && locallyInside(b, a) && middleInside(a, b) &&
+			(area(*a.prev, a, *b.prev) != 0.0 || area(a, *b.prev, b) != 0.0)) ||
+		(equals(a, b) && area(*a.prev, a, *a.next) > 0 &&
+			area(*b.prev, b, *b.next) > 0));
+}
+
+bool sectorContainsSector(const Node& m, const Node& p) {
+	return area(*m.prev, m, *p.prev) < 0 && area(*p.next, m, *m.next) < 0;
+}
+
+class Earcut {
+public:
+	Earcut(Span<const Vec2f> points, std::vector<std::uint32_t>& indices)
+		: points_(points), indices_(indices) {}
+
+	void run(Span<const unsigned> holes);
+
+protected:
+	Node* insertNode(std::uint32_t i, Node* last);
+	Node* linkedList(unsigned start, unsigned end, bool clockwise);
+	Node* filterPoints(Node* start, Node* end = nullptr);
+	Node* splitPolygon(Node& a, Node& b);
+	Node* eliminateHoles(Span<const unsigned> holes, Node* outer);
+	Node* findHoleBridge(Node& hole, Node& outer);
+	Node* cureLocalIntersections(Node* start);
+	void splitEarcut(Node& start);
+	void earcutLinked(Node* ear, unsigned pass);
+	Node* clipQueued(Node& start);
+	bool isEar(const Node& ear) const;
+	bool isEarGrid(const Node& ear);
+	bool containsReflex(const Node& ear, std::vector<Node*>& nodes);
+	void triangle(const Node& a, const Node& b, const Node& c);
+	void remove(Node& p);
+
+	// reflex grid
+	void buildGrid(Node& start);
+	void updateReflex(Node& p);
+	unsigned cell(double x, double y) const;
+
+protected:
+	Span<const Vec2f> points_;
+	std::vector<std::uint32_t>& indices_;
+	std::deque<Node> nodes_; // stable addresses
+
+	bool hashing_ {};
+	std::vector<Node*> queue_; // ear candidates
+
+	// grid over the bounds of the polygon, only contains reflex points.
+	// Points that are no longer reflex are only dropped when visited.
+	std::vector<std::vector<Node*>> cells_;
+	std::vector<Node*> reflexNodes_; // all reflex points
+	unsigned reflexCount_ {}; // points currently reflex
+	unsigned gridSize_ {};
+	double minX_ {};
+	double minY_ {};
+	double cellSize_ {};
+};
+
+void Earcut::run(Span<const unsigned> holes) {
+	auto outerEnd = holes.empty() ? points_.size() : holes[0];
+	auto* outer = linkedList(0u, outerEnd, true);
+	if(!outer || outer->next == outer->prev) {
+		return;
+	}
+
+	if(!holes.empty()) {
+		outer = eliminateHoles(holes, outer);
+	}
+
+	// only worth it for larger polygons
+	hashing_ = points_.size() > 80;
+	earcutLinked(outer, 0u);
+}
+
+Node* Earcut::insertNode(std::uint32_t i, Node* last) {
+	auto& p = nodes_.emplace_back();
+	p.i = i;
+	p.x = points_[i].x;
+	p.y = points_[i].y;
+
+	if(!last) {
+		p.prev = &p;
+		p.next = &p;
+	} else {
+		p.next = last->next;
+		p.prev = last;
+		last->next->prev = &p;
+		last->next = &p;
+	}
+
+	return &p;
+}
+
+Node* Earcut::linkedList(unsigned start, unsigned end, bool clockwise) {
+	auto sum = 0.f;
+	for(auto i = start, j = end - 1; i < end; j = i++) {
+		auto& a = points_[i];
+		auto& b = points_[j];
+		sum += (b.x - a.x) * (a.y + b.y);
+	}
+
+	Node* last {};
+	if(clockwise == (sum > 0)) {
+		for(auto i = start; i < end; ++i) {
+			last = insertNode(i, last);
+		}
+	} else {
+		for(auto i = end; i-- > start;) {
+			last = insertNode(i, last);
+		}
+	}
+
+	if(last && equals(*last, *last->next)) {
+		remove(*last);
+		last = last->next;
+	}
+
+	return last;
+}
+
+// eliminates duplicate and collinear points
+Node* Earcut::filterPoints(Node* start, Node* end) {
+	if(!start) {
+		return start;
+	}
+
+	if(!end) {
+		end = start;
+	}
+
+	auto* p = start;
+	bool again;
+	do {
+		again = false;
+		if(!p->steiner && (equals(*p, *p->next) ||
+				area(*p->prev, *p, *p->next) == 0)) {
+			remove(*p);
+			p = end = p->prev;
+			if(p == p->next) {
+				break;
+			}
+			again = true;
+		} else {
+			p = p->next;
+		}
+	} while(again || p != end);
+
+	return end;
+}
+
+// links a and b with a bridge, splitting the polygon into two.
+// Returns the copy of b that is part of the second polygon.
+Node* Earcut::splitPolygon(Node& a, Node& b) {
+	auto& a2 = nodes_.emplace_back(Node {a.i, a.x, a.y});
+	auto& b2 = nodes_.emplace_back(Node {b.i, b.x, b.y});
+	auto* an = a.next;
+	auto* bp = b.prev;
+
+	a.next = &b;
+	b.prev = &a;
+
+	a2.next = an;
+	an->prev = &a2;
+
+	b2.next = &a2;
+	a2.prev = &b2;
+
+	bp->next = &b2;
+	b2.prev = bp;
+
+	return &b2;
+}
+
+// connects all holes with the outline, from left to right
+Node* Earcut::eliminateHoles(Span<const unsigned> holes, Node* outer) {
+	std::vector<Node*> queue;
+	for(auto i = 0u; i < holes.size(); ++i) {
+		auto start = holes[i];
+		auto end = i + 1 < holes.size() ? holes[i + 1] : points_.size();
+		auto* list = linkedList(start, end, false);
+		if(!list) {
+			continue;
+		}
+
+		if(list == list->next) {
+			list->steiner = true;
+		}
+
+		// leftmost point
+		auto* p = list;
+		auto* leftmost = list;
+		do {
+			if(p->x < leftmost->x || (p->x == leftmost->x && p->y < leftmost->y)) {
+				leftmost = p;
+			}
+			p = p->next;
+		} while(p != list);
+
+		queue.push_back(leftmost);
+	}
+
+	std::sort(queue.begin(), queue.end(), [](auto* a, auto* b) {
+		return a->x < b->x;
+	});
+
+	for(auto* hole : queue) {
+		auto* bridge = findHoleBridge(*hole, *outer);
+		if(!bridge) {
+			continue;
+		}
+
+		auto* bridgeReverse = splitPolygon(*bridge, *hole);
+		filterPoints(bridgeReverse, bridgeReverse->next);
+		outer = filterPoints(bridge, bridge->next);
+	}
+
+	return outer;
+}
+
+// finds a point of the outline that can be connected with the hole
+Node* Earcut::findHoleBridge(Node& hole, Node& outer) {
+	auto* p = &outer;
+	auto hx = hole.x;
+	auto hy = hole.y;
+	auto qx = -std::numeric_limits<double>::infinity();
+	Node* m {};
+
+	// the segment left of the hole point on the horizontal ray
+	do {
+		auto& n = *p->next;
+		if(hy <= p->y && hy >= n.y && n.y != p->y) {
+			auto x = p->x + (hy - p->y) * (n.x - p->x) / (n.y - p->y);
+			if(x <= hx && x > qx) {
+				qx = x;
+				m = p->x < n.x ? p : &n;
+				if(x == hx) {
+					return m;
+				}
+			}
+		}
+		p = p->next;
+	} while(p != &outer);
+
+	if(!m) {
+		return nullptr;
+	}
+
+	// check for points inside the triangle of hole point, segment
+	// intersection and endpoint; use the one with the minimum angle
+	auto* stop = m;
+	auto mx = m->x;
+	auto my = m->y;
+	auto tanMin = std::numeric_limits<double>::infinity();
+
+	p = m;
+	do {
+		if(hx >= p->x && p->x >= mx && hx != p->x && pointInTriangle(
+				hy < my ? hx : qx, hy, mx, my, hy < my ? qx : hx, hy,
+				p->x, p->y)) {
+			auto tan = std::abs(hy - p->y) / (hx - p->x);
+			if(locallyInside(*p, hole) && (tan < tanMin || (tan == tanMin &&
+					(p->x > m->x || (p->x == m->x &&
+					sectorContainsSector(*m, *p)))))) {
+				m = p;
+				tanMin = tan;
+			}
+		}
+		p = p->next;
+	} while(p != stop);
+
+	return m;
+}
+
+Node* Earcut::cureLocalIntersections(Node* start) {
+	auto* p = start;
+	do {
+		auto& a = *p->prev;
+		auto& b = *p->next->next;
+		if(!equals(a, b) && intersects(a, *p, *p->next, b) &&
+				locallyInside(a, b) && locallyInside(b, a)) {
+			triangle(a, *p, b);
+			remove(*p);
+			remove(*p->next);
+			p = start = &b;
+		}
+		p = p->next;
+	} while(p != start);
+
+	return filterPoints(p);
+}
+
+void Earcut::splitEarcut(Node& start) {
+	auto* a = &start;
+	do {
+		auto* b = a->next->next;
+		while(b != a->prev) {
+			if(a->i != b->i && isValidDiagonal(*a, *b)) {
+				auto* c = splitPolygon(*a, *b);
+				a = filterPoints(a, a->next);
+				c = filterPoints(c, c->next);
+				earcutLinked(a, 0u);
+				earcutLinked(c, 0u);
+				return;
+			}
+			b = b->next;
+		}
+		a = a->next;
+	} while(a != &start);
+}
+
+// pass 0: plain ear clipping, 1: with filtered points,
+// 2: with cured local self intersections, then: splitting the polygon
+void Earcut::earcutLinked(Node* ear, unsigned pass) {
+	if(!ear) {
+		return;
+	}
+
+	if(pass == 0u && hashing_) {
+		ear = clipQueued(*ear);
+		if(!ear) {
+			return;
+		}
+	}
+
+	auto* stop = ear;
+	while(ear->prev != ear->next) {
+		auto* prev = ear->prev;
+		auto* next = ear->next;
+
+		if(hashing_ ? isEarGrid(*ear) : isEar(*ear)) {
+			triangle(*prev, *ear, *next);
+			remove(*ear);
+
+			// skipping the next vertex leads to less sliver triangles
+			ear = next->next;
+			stop = next->next;
+			continue;
+		}
+
+		ear = next;
+		if(ear == stop) {
+			if(pass == 0u) {
+				earcutLinked(filterPoints(ear), 1u);
+			} else if(pass == 1u) {
+				ear = cureLocalIntersections(filterPoints(ear));
+				earcutLinked(ear, 2u);
+			} else if(pass == 2u) {
+				splitEarcut(*ear);
+			}
+
+			break;
+		}
+	}
+}
+
+bool Earcut::isEar(const Node& ear) const {
+	auto& a = *ear.prev;
+	auto& b = ear;
+	auto& c = *ear.next;
+	if(area(a, b, c) >= 0) {
+		return false; // reflex
+	}
+
+	// no other point may be inside the ear
+	auto* p = ear.next->next;
+	while(p != ear.prev) {
+		if(pointInTriangle(a, b, c, *p) &&
+				area(*p->prev, *p, *p->next) >= 0) {
+			return false;
+		}
+		p = p->next;
+	}
+
+	return true;
+}
+
+// Clips ears from a queue of candidates. Initially contains all points,
+// the neighbors of every clipped ear are checked again. A candidate is
+// skipped while it is queued again later, so that (like when walking
+// around the polygon) the neighbor of a clipped ear is not immediately
+// clipped as well, which would produce fans of sliver triangles.
+// Returns a remaining point if the polygon could not be fully
+// triangulated, nullptr otherwise.
+Node* Earcut::clipQueued(Node& start) {
+	buildGrid(start);
+
+	queue_.clear();
+	auto* p = &start;
+	do {
+		p->queued = queue_.size();
+		queue_.push_back(p);
+		p = p->next;
+	} while(p != &start);
+
+	Node* last = &start;
+	for(auto i = 0u; i < queue_.size(); ++i) {
+		auto* ear = queue_[i];
+		if(ear->removed || ear->queued != i) {
+			continue;
+		}
+
+		if(ear->prev == ear->next) {
+			return nullptr;
+		}
+
+		if(!isEarGrid(*ear)) {
+			continue;
+		}
+
+		auto* prev = ear->prev;
+		auto* next = ear->next;
+		triangle(*prev, *ear, *next);
+		remove(*ear);
+
+		next->queued = queue_.size();
+		queue_.push_back(next);
+		prev->queued = queue_.size();
+		queue_.push_back(prev);
+		last = next;
+	}
+
+	return last->prev == last->next ? nullptr : last;
+}
+
+// Drops the points that are no longer reflex on the way.
+bool Earcut::containsReflex(const Node& ear, std::vector<Node*>& nodes) {
+	for(auto i = 0u; i < nodes.size();) {
+		auto& p = *nodes[i];
+		if(!p.reflex) {
+			nodes[i] = nodes.back();
+			nodes.pop_back();
+			continue;
+		}
+
+		if(&p != ear.prev && &p != ear.next &&
+				pointInTriangle(*ear.prev, ear, *ear.next, p) &&
+				area(*p.prev, p, *p.next) >= 0) {
+			return true;
+		}
+
+		++i;
+	}
+
+	return false;
+}
+
+bool Earcut::isEarGrid(const Node& ear) {
+	auto& a = *ear.prev;
+	auto& b = ear;
+	auto& c = *ear.next;
+	if(area(a, b, c) >= 0) {
+		return false; // reflex
+	}
+
+	// only reflex (or collinear) points can be inside an ear
+	if(reflexCount_ == 0u) {
+		return true;
+	}
+
+	auto minCell = cell(std::min({a.x, b.x, c.x}), std::min({a.y, b.y, c.y}));
+	auto maxCell = cell(std::max({a.x, b.x, c.x}), std::max({a.y, b.y, c.y}));
+	auto minX = minCell % gridSize_;
+	auto minY = minCell / gridSize_;
+	auto maxX = maxCell % gridSize_;
+	auto maxY = maxCell / gridSize_;
+
+	// for large triangles, checking all reflex points is cheaper
+	auto cellCount = std::size_t(maxX - minX + 1) * (maxY - minY + 1);
+	if(cellCount > reflexNodes_.size()) {
+		return !containsReflex(ear, reflexNodes_);
+	}
+
+	// only visit the cells the triangle touches in every row, thin
+	// diagonal ears would otherwise check many cells
+	const Node* edges[3][2] = {{&a, &b}, {&b, &c}, {&c, &a}};
+	for(auto y = minY; y <= maxY; ++y) {
+		auto y0 = minY_ + y * cellSize_;
+		auto y1 = y0 + cellSize_;
+		auto x0 = std::numeric_limits<double>::max();
+		auto x1 = -x0;
+		for(auto& edge : edges) {
+			auto& p = *edge[0];
+			auto& q = *edge[1];
+			auto ey0 = std::max(std::min(p.y, q.y), y0);
+			auto ey1 = std::min(std::max(p.y, q.y), y1);
+			if(ey0 > ey1) {
+				continue;
+			}
+
+			auto dy = q.y - p.y;
+			auto ex0 = dy == 0.0 ? p.x : p.x + (ey0 - p.y) * (q.x - p.x) / dy;
+			auto ex1 = dy == 0.0 ? q.x : p.x + (ey1 - p.y) * (q.x - p.x) / dy;
+			x0 = std::min({x0, ex0, ex1});
+			x1 = std::max({x1, ex0, ex1});
+		}
+
+		// the first and last row may only be touched by the clamping
+		if(x0 > x1) {
+			x0 = minX_ + minX * cellSize_;
+			x1 = minX_ + (maxX + 1) * cellSize_;
+		}
+
+		// small margin against rounding, points on the edges count
+		auto eps = 1e-6 * cellSize_;
+		auto rx0 = std::max(minX, cell(x0 - eps, y0) % gridSize_);
+		auto rx1 = std::min(maxX, cell(x1 + eps, y0) % gridSize_);
+		for(auto x = rx0; x <= rx1; ++x) {
+			if(containsReflex(ear, cells_[y * gridSize_ + x])) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+void Earcut::buildGrid(Node& start) {
+	auto minX = start.x;
+	auto minY = start.y;
+	auto maxX = start.x;
+	auto maxY = start.y;
+	auto count = 0u;
+	auto* p = &start;
+	do {
+		minX = std::min(minX, p->x);
+		minY = std::min(minY, p->y);
+		maxX = std::max(maxX, p->x);
+		maxY = std::max(maxY, p->y);
+		p->reflex = false;
+		++count;
+		p = p->next;
+	} while(p != &start);
+
+	// about one point per cell
+	gridSize_ = std::max(1u, unsigned(std::sqrt(double(count))));
+	minX_ = minX;
+	minY_ = minY;
+	cellSize_ = std::max(maxX - minX, maxY - minY) / gridSize_;
+	if(cellSize_ == 0.0) {
+		cellSize_ = 1.0;
+	}
+
+	cells_.clear();
+	cells_.resize(gridSize_ * gridSize_);
+	reflexNodes_.clear();
+	reflexCount_ = 0u;
+
+	p = &start;
+	do {
+		updateReflex(*p);
+		p = p->next;
+	} while(p != &start);
+}
+
+void Earcut::updateReflex(Node& p) {
+	if(!hashing_ || cells_.empty()) {
+		return;
+	}
+
+	auto reflex = area(*p.prev, p, *p.next) >= 0;
+	if(reflex && !p.reflex) {
+		cells_[cell(p.x, p.y)].push_back(&p);
+		reflexNodes_.push_back(&p);
+		++reflexCount_;
+	} else if(!reflex && p.reflex) {
+		--reflexCount_;
+	}
+
+	p.reflex = reflex;
+}
+
+unsigned Earcut::cell(double x, double y) const {
+	auto max = double(gridSize_ - 1);
+	auto cx = std::clamp(std::floor((x - minX_) / cellSize_), 0.0, max);
+	auto cy = std::clamp(std::floor((y - minY_) / cellSize_), 0.0, max);
+	return unsigned(cy) * gridSize_ + unsigned(cx);
+}
+
+void Earcut::remove(Node& p) {
+	p.next->prev = p.prev;
+	p.prev->next = p.next;
+	p.removed = true;
+	if(p.reflex) {
+		p.reflex = false;
+		--reflexCount_;
+	}
+
+	// the neighbors might have become reflex or convex
+	updateReflex(*p.prev);
+	updateReflex(*p.next);
+}
+
+void Earcut::triangle(const Node& a, const Node& b, const Node& c) {
+	indices_.push_back(a.i);
+	indices_.push_back(b.i);
+	indices_.push_back(c.i);
+}
+
+} // anon namespace
+
+void triangulate(Span<const Vec2f> points, Span<const unsigned> holes,
+		std::vector<std::uint32_t>& indices) {
+	dlg_assert(std::is_sorted(holes.begin(), holes.end()));
+	dlg_assert(holes.empty() || holes.back() <= points.size());
+	if(points.size() < 3) {
+		return;
+	}
+
+	indices.reserve(indices.size() + 3 * (points.size() + 2 * holes.size()));
+	Earcut(points, indices).run(holes);
+}
+
+} // namespace rvg
@@ -0,0 +1,26 @@
+// Copyright (c) 2019 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <rvg/fwd.hpp>
+#include <nytl/vec.hpp>
+#include <nytl/span.hpp>
+#include <cstdint>
+#include <vector>
+
+namespace rvg {
+
+// Triangulates the given (possibly concave) polygon via ear clipping.
+// The points before the first hole index are the outline, every hole
+// ends where the next one starts. The polygons don't have to be closed
+// and may have any orientation.
+// Larger polygons use a grid of the reflex points for the ear tests.
+// Self-intersecting polygons produce some triangulation that might
+// not match any fill rule.
+// Appends the point indices of the triangles to the given vector.
+void triangulate(Span<const Vec2f> points, Span<const unsigned> holes,
+	std::vector<std::uint32_t>& indices);
+
+} // namespace rvg
@@ -0,0 +1,129 @@
+// Copyright (c) 2019 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include <rvg/uniformArena.hpp>
+#include <rvg/context.hpp>
+#include <vpp/vk.hpp>
+#include <dlg/dlg.hpp>
+
+namespace rvg {
+
+// UniformSlot
+UniformSlot::~UniformSlot() {
+	if(arena_) {
+		arena_->free(*this);
+	}
+}
+
+UniformSlot::UniformSlot(UniformSlot&& rhs) noexcept :
+		arena_(rhs.arena_), block_(rhs.block_), slot_(rhs.slot_) {
+	rhs.arena_ = {};
+}
+
+UniformSlot& UniformSlot::operator=(UniformSlot&& rhs) noexcept {
+	if(arena_) {
+		arena_->free(*this);
+	}
+
+	arena_ = rhs.arena_;
+	block_ = rhs.block_;
+	slot_ = rhs.slot_;
+	rhs.arena_ = {};
+	return *this;
+}
+
+vpp::BufferSpan UniformSlot::span() const {
+	dlg_assert(valid());
+	auto& buf = blockBuffer();
+	return {buf.buffer(), arena_->size(), buf.offset() + offset()};
+}
+
+vk::DescriptorSet UniformSlot::ds() const {
+	dlg_assert(valid());
+	return arena_->blocks_[block_].ds;
+}
+
+std::uint32_t UniformSlot::offset() const {
+	dlg_assert(valid());
+	return slot_ * arena_->stride();
+}
+
+const vpp::SubBuffer& UniformSlot::blockBuffer() const {
+	dlg_assert(valid());
+	return arena_->blocks_[block_].buffer;
+}
+
+// UniformArena
+void UniformArena::init(Context& ctx, const vpp::TrDsLayout& layout,
+		vk::DeviceSize size, bool deviceLocal, vk::ImageView image) {
+	context_ = &ctx;
+	layout_ = &layout;
+	image_ = image;
+	size_ = size;
+	deviceLocal_ = deviceLocal;
+
+	auto align = ctx.device().properties().limits.minUniformBufferOffsetAlignment;
+	align = std::max<vk::DeviceSize>(align, 16u);
+	stride_ = align * ((size + align - 1) / align);
+}
+
+UniformSlot UniformArena::allocate() {
+	dlg_assert(context_);
+
+	unsigned id = 0u;
+	for(; id < blocks_.size(); ++id) {
+		if(!blocks_[id].free.empty()) {
+			break;
+		}
+	}
+
+	if(id == blocks_.size()) {
+		auto& ctx = *context_;
+		auto usage = nytl::Flags {vk::BufferUsageBits::uniformBuffer};
+		if(deviceLocal_) {
+			usage |= vk::BufferUsageBits::transferDst;
+		}
+
+		auto memBits = deviceLocal_ ?
+			ctx.device().deviceMemoryTypes() :
+			ctx.device().hostMemoryTypes();
+
+		// the offset of the block buffer must be aligned as well
+		// since it is used as base for the dynamic offsets
+		auto& block = blocks_.emplace_back();
+		block.buffer = {ctx.bufferAllocator(), blockSlots * stride_, usage,
+			memBits, stride_};
+		block.ds = {ctx.dsAllocator(), *layout_};
+
+		vpp::DescriptorSetUpdate update(block.ds);
+		update.uniformDynamic({{block.buffer.buffer(),
+			block.buffer.offset(), size_}});
+		if(image_) {
+			update.imageSampler({{{}, image_,
+				vk::ImageLayout::shaderReadOnlyOptimal}});
+		}
+
+		// reversed so that slots are handed out in ascending order
+		block.free.resize(blockSlots);
+		for(auto i = 0u; i < blockSlots; ++i) {
+			block.free[i] = blockSlots - i - 1;
+		}
+	}
+
+	UniformSlot ret;
+	ret.arena_ = this;
+	ret.block_ = id;
+	ret.slot_ = blocks_[id].free.back();
+	blocks_[id].free.pop_back();
+	return ret;
+}
+
+void UniformArena::free(UniformSlot& slot) noexcept {
+	dlg_assert(slot.arena_ == this);
+	dlg_assert(slot.block_ < blocks_.size());
+	blocks_[slot.block_].free.push_back(slot.slot_);
+	slot.arena_ = {};
+}
+
+} // namespace rvg
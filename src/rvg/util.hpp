@@ -11,6 +11,8 @@
 #include <vpp/vk.hpp>
 #include <dlg/dlg.hpp>
 
+#include <algorithm>
+#include <cmath>
 #include <cstdlib>
 #include <cstring>
 
@@ -39,37 +41,154 @@ struct Uploader {
 	nytl::Span<std::byte> data;
 };
 
+// Writes the given data into the mapped memory of the given hostVisible
+// buffer. Returns the number of bytes written.
+template<typename... Args>
+std::size_t writeMapped(Context& ctx, vpp::BufferSpan buf, const Args&... args) {
+	auto data = ctx.mapped(buf);
+	Uploader uploader;
+	uploader.data = data;
+
+	(uploader.write(args), ...);
+	return uploader.data.data() - data.data();
+}
+
 template<typename O, typename... Args>
 std::size_t writeBuffer(O& dobj, vpp::BufferSpan buf, const Args&... args) {
 	dlg_assert(buf.valid());
 
+	auto& ctx = dobj.context();
 	if(!buf.buffer().mappable()) {
-		auto& ctx = dobj.context();
 		auto cb = ctx.uploadCmdBuf();
 		auto stage = vpp::SubBuffer(ctx.bufferAllocator(),
 			buf.size(), vk::BufferUsageBits::transferSrc, 4u);
-		auto size = writeBuffer(dobj, stage, args...);
+		auto size = writeMapped(ctx, stage, args...);
 
 		vk::BufferCopy copy;
 		copy.srcOffset = stage.offset();
 		copy.dstOffset = buf.offset();
 		copy.size = size;
 		vk::cmdCopyBuffer(cb, stage.buffer(), buf.buffer(), {{copy}});
+		ctx.finishUpload(&dobj, cb, {buf.buffer(), size, buf.offset()});
 
-		dobj.context().addStage(std::move(stage));
-		dobj.context().addCommandBuffer(&dobj, std::move(cb));
+		ctx.frameStats().stagedBytes += size;
+		ctx.addStage(std::move(stage));
+		ctx.addCommandBuffer(&dobj, std::move(cb));
 		return size;
 	}
 
-	vpp::MemoryMapView map;
-	map = buf.memoryMap();
-	Uploader uploader;
-	uploader.data = map.span();
-
-	(uploader.write(args), ...);
-	return uploader.data.data() - map.ptr();
+	auto size = writeMapped(ctx, buf, args...);
+	ctx.frameStats().hostBytes += size;
+	return size;
 }
 
+// Provides memory to write the first size bytes of the given buffer into
+// directly, e.g. for baking into it without an intermediate copy. That is
+// the mapped memory for hostVisible buffers or a staging buffer that is
+// copied into the buffer on destruction otherwise. Like writeBuffer,
+// must only be used for buffers not in use by the device.
+template<typename O>
+class BufferWriter {
+public:
+	BufferWriter(O& dobj, vpp::BufferSpan buf, std::size_t size)
+			: dobj_(dobj), buf_(buf), size_(size) {
+		dlg_assert(buf.valid() && size <= buf.size());
+		auto& ctx = dobj.context();
+		if(buf.buffer().mappable()) {
+			data_ = ctx.mapped(buf).first(size);
+			ctx.frameStats().hostBytes += size;
+			return;
+		}
+
+		stage_ = vpp::SubBuffer(ctx.bufferAllocator(),
+			std::max(size, std::size_t(4u)),
+			vk::BufferUsageBits::transferSrc, 4u);
+		data_ = ctx.mapped(stage_).first(size);
+	}
+
+	~BufferWriter() {
+		if(!stage_.size() || !size_) {
+			return;
+		}
+
+		auto& ctx = dobj_.context();
+		auto cb = ctx.uploadCmdBuf();
+		vk::BufferCopy copy;
+		copy.srcOffset = stage_.offset();
+		copy.dstOffset = buf_.offset();
+		copy.size = size_;
+		vk::cmdCopyBuffer(cb, stage_.buffer(), buf_.buffer(), {{copy}});
+		ctx.finishUpload(&dobj_, cb, {buf_.buffer(), size_, buf_.offset()});
+
+		ctx.frameStats().stagedBytes += size_;
+		ctx.addStage(std::move(stage_));
+		ctx.addCommandBuffer(&dobj_, std::move(cb));
+	}
+
+	BufferWriter(const BufferWriter&) = delete;
+	BufferWriter& operator=(const BufferWriter&) = delete;
+
+	// Returns count objects of type T at the given byte offset.
+	template<typename T>
+	nytl::Span<T> span(std::size_t offset, std::size_t count) {
+		dlg_assert(offset + count * sizeof(T) <= data_.size());
+		dlg_assert(offset % alignof(T) == 0);
+		auto ptr = reinterpret_cast<T*>(data_.data() + offset);
+		return {ptr, count};
+	}
+
+	template<typename T>
+	void write(std::size_t offset, const T& obj) {
+		dlg_assert(offset + sizeof(T) <= data_.size());
+		std::memcpy(data_.data() + offset, &obj, sizeof(obj));
+	}
+
+protected:
+	O& dobj_;
+	vpp::BufferSpan buf_;
+	std::size_t size_;
+	vpp::SubBuffer stage_;
+	nytl::Span<std::byte> data_;
+};
+
+// Measures the time until destruction (or end) into the given duration
+// and calls the trace hooks of the context.
+class TraceZone {
+public:
+	TraceZone(const Context& ctx, const char* name, FrameStats::Duration& time)
+			: hooks_(ctx.settings().trace), name_(name), time_(&time),
+			start_(FrameStats::Clock::now()) {
+		if(hooks_.begin) {
+			hooks_.begin(hooks_.data, name_);
+		}
+	}
+
+	~TraceZone() {
+		end();
+	}
+
+	void end() {
+		if(!time_) {
+			return;
+		}
+
+		*time_ += FrameStats::Clock::now() - start_;
+		time_ = nullptr;
+		if(hooks_.end) {
+			hooks_.end(hooks_.data, name_);
+		}
+	}
+
+	TraceZone(const TraceZone&) = delete;
+	TraceZone& operator=(const TraceZone&) = delete;
+
+protected:
+	const TraceHooks& hooks_;
+	const char* name_;
+	FrameStats::Duration* time_;
+	FrameStats::Clock::time_point start_;
+};
+
 inline Vec2f multPos(const nytl::Mat3f& transform, nytl::Vec2f pos) {
 	auto p3 = transform * Vec3f{pos.x, pos.y, 1.f};
 	return (1.f / p3.z) * Vec2f{p3.x, p3.y};
@@ -83,8 +202,32 @@ inline Vec2f multDir(const nytl::Mat3f& transform, nytl::Vec2f pos) {
 // Returns by how much the given transform matrix scales an axis on average.
 inline float scale(const nytl::Mat3f& t) {
 	// square root of determinant should work since the determinant
-	// describes by how much this transform would multiply an area
-	return std::sqrt(t[0][0] * t[1][1] - t[0][1] * t[1][0]);
+	// describes by how much this transform would multiply an area.
+	// Mirroring transforms have a negative one
+	return std::sqrt(std::abs(t[0][0] * t[1][1] - t[0][1] * t[1][0]));
+}
+
+// Returns the number of segments needed to flatten an arc with the given
+// radius and angle (in radians) so that it deviates at most by tolerance
+// from the real arc. Radius and tolerance must be in the same unit.
+inline unsigned arcSegments(float radius, float angle, float tolerance) {
+	constexpr auto maxSegments = 256.f;
+	if(radius <= tolerance) {
+		return 1u;
+	}
+
+	// the distance between a segment with angle a and the arc is
+	// r * (1 - cos(a / 2))
+	auto step = 2 * std::acos(1 - tolerance / radius);
+	auto count = std::ceil(std::abs(angle) / step);
+	return unsigned(std::clamp(count, 1.f, maxSegments));
+}
+
+// Rounds the given scale up to the next power of two. Shapes are only
+// tessellated again when this level of detail changes.
+inline float lodScale(float scale) {
+	dlg_assert(scale > 0.f);
+	return std::exp2(std::ceil(std::log2(scale)));
 }
 
 } // namespace rvg
@@ -20,21 +20,34 @@ layout(set = 2, binding = 0) uniform sampler2D font;
 const uint TypeDefault = 0;
 const uint TypeText = 1;
 const uint TypeStroke = 2;
+const uint TypeDashedStroke = 3;
+// see rvg::Context::pushTypeOffset
 layout(push_constant) uniform Type {
 	uint type;
+#if defined(PUSH_STATE) && defined(FRAG_SCISSOR)
+	layout(offset = 16) vec4 scissor; // xy: position, zw: size
+#endif
 } type;
 
 // - scissor -
 #ifdef FRAG_SCISSOR
 	layout(location = 3) in vec2 in_rawpos;
 
-	layout(set = 3, binding = 0) uniform Scissor {
-		vec2 pos;
-		vec2 size;
-	} scissor;
+	#ifdef PUSH_STATE
+		vec2 scissorPos() { return type.scissor.xy; }
+		vec2 scissorSize() { return type.scissor.zw; }
+	#else
+		layout(set = 3, binding = 0) uniform Scissor {
+			vec2 pos;
+			vec2 size;
+		} scissor;
+
+		vec2 scissorPos() { return scissor.pos; }
+		vec2 scissorSize() { return scissor.size; }
+	#endif
 
 	void applyScissor() {
-		vec2 c = clamp(in_rawpos, scissor.pos, scissor.pos + scissor.size);
+		vec2 c = clamp(in_rawpos, scissorPos(), scissorPos() + scissorSize());
 		if(in_rawpos != c) {
 			discard;
 		}
@@ -45,9 +58,36 @@ layout(push_constant) uniform Type {
 
 // - anti aliasing -
 #ifdef EDGE_AA
+	// only dashed strokes bind (and use) more than mult, see rvg::Polygon
 	layout(set = 4, binding = 0) uniform Stroke {
-		float mult;
+		float mult; // zero for dashed strokes without edge aa
+		float dashOffset;
+		float dashPeriod;
+		float dashCount;
+		vec4 dashes[2]; // alternating dash and gap lengths
 	} stroke;
+
+	// Coverage of the dash pattern at the given distance along the
+	// stroke (the x aa coordinate), smoothed over a pixel.
+	float dashCoverage(float len) {
+		float t = mod(len + stroke.dashOffset, stroke.dashPeriod);
+		float pixel = max(fwidth(len), 0.001);
+		float start = 0.0;
+		uint count = uint(stroke.dashCount);
+		for(uint i = 0u; i < count; ++i) {
+			float end = start + stroke.dashes[i / 4u][i % 4u];
+			if(t < end || i + 1u == count) {
+				// distance to the closer border of the dash or gap
+				float d = min(t - start, end - t) / pixel;
+				float c = clamp(0.5 + d, 0.0, 1.0);
+				return (i % 2u) == 0u ? c : 1.0 - c;
+			}
+
+			start = end;
+		}
+
+		return 1.0;
+	}
 #endif
 
 // - main -
@@ -68,6 +108,13 @@ void main() {
 		// float fac = (1.0 - abs(in_uv.y)) * stroke.mult * in_uv.x;
 		float fac = (min(1.0, 1.0 - abs(in_uv.y)) * stroke.mult) * in_uv.x;
 		out_color.a *= fac;
+	} else if(type.type == TypeDashedStroke) {
+		float fac = 1.0;
+		if(stroke.mult > 0.0) {
+			fac = min(1.0, 1.0 - abs(in_uv.y)) * stroke.mult;
+		}
+
+		out_color.a *= fac * dashCoverage(in_uv.x);
 	}
 #endif
 
@@ -1,29 +1,106 @@
 #version 450
 
 layout(location = 0) in vec2 in_pos;
-layout(location = 1) in vec2 in_uv;
-layout(location = 2) in vec4 in_color;
+#ifndef LINES
+	layout(location = 1) in vec2 in_uv;
+	layout(location = 2) in vec4 in_color;
+#endif
+
+#ifdef INSTANCED
+	// see rvg::InstancedShape::Instance
+	layout(location = 4) in vec4 in_instance; // xy: offset, z: scale, w: angle
+	layout(location = 5) in vec4 in_instanceColor;
+
+	vec2 instancePos(vec2 pos) {
+		float c = cos(in_instance.w);
+		float s = sin(in_instance.w);
+		return in_instance.xy + in_instance.z * vec2(
+			c * pos.x - s * pos.y,
+			s * pos.x + c * pos.y);
+	}
+#else
+	vec2 instancePos(vec2 pos) { return pos; }
+#endif
+
+#ifdef COMPACT
+	// snorm16 positions relative to the bounds of the draw, the
+	// per-instance binding is the header in the vertex buffer,
+	// see rvg::ContextSettings::compactPrecision
+	layout(location = 3) in vec4 in_frame; // xy: center, zw: half extent
+
+	vec2 vertexPos() { return in_frame.xy + in_frame.zw * in_pos; }
+#elif defined(LINES)
+	// one instance per segment with in_pos as its start, the vertices
+	// are the corners of the quad around it (triangle strip). The header
+	// of the draw is bound with a stride of zero, see rvg::StrokeType::lines
+	layout(location = 3) in vec2 in_end;
+	layout(location = 4) in vec4 in_line; // x: half width
+
+	// like in the strips baked on the cpu, the aa coords are (1, side)
+	float lineSide() { return (gl_VertexIndex & 1) == 0 ? -1.0 : 1.0; }
+
+	vec2 vertexPos() {
+		vec2 d = in_end - in_pos;
+		float len = length(d);
+		vec2 normal = len > 0.0 ? vec2(-d.y, d.x) / len : vec2(0.0);
+		vec2 base = (gl_VertexIndex & 2) == 0 ? in_pos : in_end;
+		return base - lineSide() * in_line.x * normal;
+	}
+#else
+	vec2 vertexPos() { return in_pos; }
+#endif
 
 layout(location = 0) out vec2 out_uv;
 layout(location = 1) out vec2 out_paint;
 layout(location = 2) out vec4 out_color;
 
-layout(row_major, set = 0, binding = 0) uniform Transform {
-	mat4 matrix;
-} transform;
-
 layout(row_major, set = 1, binding = 0) uniform Paint {
 	mat4 matrix;
 } paint;
 
+// - transform, scissor state -
+#ifdef PUSH_STATE
+	// see rvg::Context::pushTransformOffset
+	layout(push_constant) uniform State {
+	#ifdef PLANE_SCISSOR
+		layout(offset = 16) vec4 scissor; // xy: position, zw: size
+	#endif
+		layout(offset = 32) vec4 transform[2]; // rows of affine 2D matrix
+	} state;
+
+	vec4 transformPos(vec2 pos) {
+		vec3 p = vec3(pos, 1.0);
+		return vec4(dot(state.transform[0].xyz, p),
+			dot(state.transform[1].xyz, p), 0.0, 1.0);
+	}
+
+	#ifdef PLANE_SCISSOR
+		vec2 scissorPos() { return state.scissor.xy; }
+		vec2 scissorSize() { return state.scissor.zw; }
+	#endif
+#else // PUSH_STATE
+	layout(row_major, set = 0, binding = 0) uniform Transform {
+		mat4 matrix;
+	} transform;
+
+	vec4 transformPos(vec2 pos) {
+		return transform.matrix * vec4(pos, 0.0, 1.0);
+	}
+
+	#ifdef PLANE_SCISSOR
+		layout(set = 3, binding = 0) uniform Scissor {
+			vec2 pos;
+			vec2 size;
+		} scissor;
+
+		vec2 scissorPos() { return scissor.pos; }
+		vec2 scissorSize() { return scissor.size; }
+	#endif
+#endif // PUSH_STATE
+
 #if defined(PLANE_SCISSOR)
 	out float gl_ClipDistance[4];
 
-	layout(set = 3, binding = 0) uniform Scissor {
-		vec2 pos;
-		vec2 size;
-	} scissor;
-
 	vec2 point(vec2 rpos, vec2 rsize, uint id) {
 		vec2 ret = rpos;
 		ret.x += float(id == 1 || id == 2) * rsize.x;
@@ -31,24 +108,24 @@ layout(row_major, set = 1, binding = 0) uniform Paint {
 		return ret;
 	}
 
-	void applyScissor() {
+	void applyScissor(vec2 pos) {
 		uint last = 3;
 		for(int i = 0; i < 4; ++i) {
-			const vec2 p = point(scissor.pos, scissor.size, i);
-			const vec2 diff = point(scissor.pos, scissor.size, last) - p;
+			const vec2 p = point(scissorPos(), scissorSize(), i);
+			const vec2 diff = point(scissorPos(), scissorSize(), last) - p;
 			const vec2 normal = normalize(vec2(diff.y, -diff.x));
-			gl_ClipDistance[i] = dot(in_pos, normal) - dot(p, normal);
+			gl_ClipDistance[i] = dot(pos, normal) - dot(p, normal);
 			last = i;
 		}
 	}
 #elif defined(FRAG_SCISSOR)
 	layout(location = 3) out vec2 out_rawpos;
 
-	void applyScissor() {
-		out_rawpos = in_pos;
+	void applyScissor(vec2 pos) {
+		out_rawpos = pos;
 	}
 #else
-	void applyScissor() {}
+	void applyScissor(vec2 pos) {}
 #endif
 
 const float gamma = 2.2;
@@ -57,13 +134,24 @@ vec4 linearize(vec4 srgb) {
 }
 
 void main() {
-	gl_Position = transform.matrix * vec4(in_pos, 0.0, 1.0);
-	out_paint = (paint.matrix * vec4(in_pos, 0.0, 1.0)).xy;
+	vec2 pos = instancePos(vertexPos());
+	gl_Position = transformPos(pos);
+	out_paint = (paint.matrix * vec4(pos, 0.0, 1.0)).xy;
+#ifdef LINES
+	out_uv = vec2(1.0, lineSide());
+#else
 	out_uv = in_uv;
+#endif
 
 	// fill.frag expects *all* colors in linear space.
 	// polygon specifies that it - as everything in rvg - expects colors
 	// in srgb space so we have to linearize it here.
+#if defined(INSTANCED)
+	out_color = linearize(in_instanceColor);
+#elif defined(LINES)
+	out_color = vec4(1.0); // no point colors
+#else
 	out_color = linearize(in_color);
-	applyScissor();
+#endif
+	applyScissor(pos);
 }
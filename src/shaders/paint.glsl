@@ -45,7 +45,13 @@ vec4 paintColor(vec2 coords, PaintData paint, sampler2D tex, vec4 col) {
 		float fac = (length(coords - center) - r1) / (r2 - r1);
 		return mixColor(paint.inner, paint.outer, clamp(fac, 0, 1));
 	} else if(paint.type == paintTypeTexRGBA) {
-		return paint.inner * texture(tex, coords);
+		// custom.x signals premultiplied alpha, e.g. for rvg::Layer
+		vec4 tcol = texture(tex, coords);
+		if(paint.custom.x != 0.0 && tcol.a > 0.0) {
+			tcol.rgb /= tcol.a;
+		}
+
+		return paint.inner * tcol;
 	} else if(paint.type == paintTypeTexA) {
 		return paint.inner * texture(tex, coords).a;
 	} else if(paint.type == paintTypePointColor) {